@@ -27,6 +27,7 @@ static int screen_height = 0;
 static int screen_left = SDL_WINDOWPOS_CENTERED;
 static int screen_top = SDL_WINDOWPOS_CENTERED;
 static bool audio_disable = false;
+static bool subtitle_disable = false;
 static bool seek_by_bytes = true;
 static int startup_volume = 100;
 static float seek_interval = 10;
@@ -35,7 +36,6 @@ static int64_t duration = AV_NOPTS_VALUE;
 static bool fast = false;
 static bool genpts = false;
 static int lowres = false;
-static bool muted = false;
 static bool decoder_reorder_pts = false;
 static int exit_on_keydown;
 static bool loop = true;
@@ -44,7 +44,11 @@ static int64_t cursor_last_shown;
 static bool cursor_hidden = 0;
 static bool find_stream_info = true;
 static bool autorotate = true;
+static bool adaptive_skip = true;
+static bool drop_disposable = true;
+static bool threaded_filters = true;
 static SDL_Texture *vid_texture = NULL;
+static SDL_Texture *sub_texture = NULL;
 
 static SDL_Window* window = NULL;
 static SDL_Renderer* renderer;
@@ -84,6 +88,22 @@ static enum AVColorSpace sdl_supported_color_spaces[] = {
     AVCOL_SPC_UNSPECIFIED,
 };
 
+static const struct AudioFormatEntry {
+    enum AVSampleFormat format;
+    SDL_AudioFormat audio_fmt;
+} sdl_audio_format_map[] = {
+    { AV_SAMPLE_FMT_FLT, AUDIO_F32SYS },
+    { AV_SAMPLE_FMT_S32, AUDIO_S32SYS },
+    { AV_SAMPLE_FMT_S16, AUDIO_S16SYS },
+};
+
+static enum AVSampleFormat sdl_supported_sample_fmts[] = {
+    AV_SAMPLE_FMT_FLT,
+    AV_SAMPLE_FMT_S32,
+    AV_SAMPLE_FMT_S16,
+    AV_SAMPLE_FMT_NONE,
+};
+
 static int realloc_texture(SDL_Texture **texture, Uint32 new_format, int new_width, int new_height, SDL_BlendMode blendmode)
 {
     Uint32 format;
@@ -213,7 +233,34 @@ static int video_open(void) {
     return 0;
 }
 
-static void video_display(ff_frame_t* frame) {
+static void subtitle_display(ff_player_t* player, const SDL_Rect* rect) {
+    ff_frame_t* sp = ff_player_acquire_subtitle(player);
+    if (sp == NULL) {
+        return;
+    }
+    if (!sp->uploaded) {
+        if (realloc_texture(&sub_texture, SDL_PIXELFORMAT_ARGB8888, sp->width, sp->height, SDL_BLENDMODE_BLEND) < 0) {
+            return;
+        }
+        uint8_t* pixels;
+        int pitch;
+        if (SDL_LockTexture(sub_texture, NULL, (void**)&pixels, &pitch) == 0) {
+            for (int i = 0; i < sp->height; i++) {
+                memset(pixels + i * pitch, 0, sp->width * 4);
+            }
+            SDL_UnlockTexture(sub_texture);
+        }
+        for (int i = 0; i < sp->nb_sub_rects; i++) {
+            const ff_subtitle_rect_t* sub_rect = sp->sub_rects + i;
+            const SDL_Rect dst = { sub_rect->x, sub_rect->y, sub_rect->width, sub_rect->height };
+            SDL_UpdateTexture(sub_texture, &dst, sub_rect->data, sub_rect->linesize);
+        }
+        sp->uploaded = true;
+    }
+    SDL_RenderCopy(renderer, sub_texture, NULL, rect);
+}
+
+static void video_display(ff_player_t* player, ff_frame_t* frame) {
     if (width == 0) {
         video_open();
     }
@@ -224,60 +271,24 @@ static void video_display(ff_frame_t* frame) {
     calculate_display_rect(&rect, xleft, ytop, width, height, frame->width, frame->height, frame->sample_aspect_ratio);
     set_sdl_yuv_conversion_mode(frame->base);
 
-    if (!frame->uploaded) {
-        if (upload_texture(&vid_texture, frame->base) < 0) {
+    if (ff_player_begin_video_upload(player, frame)) {
+        const bool uploaded = upload_texture(&vid_texture, frame->base) >= 0;
+        ff_player_end_video_upload(player, frame, uploaded);
+        if (!uploaded) {
             set_sdl_yuv_conversion_mode(NULL);
             return;
         }
-        frame->uploaded = true;
         frame->flip_v = frame->base->linesize[0] < 0;
     }
     SDL_RenderCopyEx(renderer, vid_texture, NULL, &rect, 0, NULL, frame->flip_v ? SDL_FLIP_VERTICAL : 0);
     set_sdl_yuv_conversion_mode(NULL);
+    subtitle_display(player, &rect);
 
     SDL_RenderPresent(renderer);
 }
 
 static void audio_callback(void *opaque, Uint8* buf, int buf_len) {
-    ff_player_t* player = opaque;
-
-    static int audio_buf_pos = 0;
-    static int audio_buf_size = 0;
-    static const uint8_t* audio_buf = NULL;
-
-    const int64_t write_time_start = av_gettime_relative();
-
-    while (buf_len > 0) {
-        if (audio_buf_pos >= audio_buf_size) {
-            int audio_size;
-            audio_buf = ff_player_acquire_audio_buf(player, &audio_size);
-            if (audio_buf == NULL) {
-                const int frame_size = ff_player_get_audio_params(player)->frame_size;
-                audio_buf_size = SDL_AUDIO_MIN_BUFFER_SIZE / frame_size * frame_size;
-            } else {
-                audio_buf_size = audio_size;
-            }
-            audio_buf_pos = 0;
-        }
-        int len_to_write = audio_buf_size - audio_buf_pos;
-        if (len_to_write > buf_len) {
-            len_to_write = buf_len;
-        }
-        const int volume = ff_player_get_audio_volume(player);
-        if (!muted && audio_buf != NULL && volume == SDL_MIX_MAXVOLUME) {
-            memcpy(buf, audio_buf + audio_buf_pos, len_to_write);
-        } else {
-            memset(buf, 0, len_to_write);
-            if (!muted && audio_buf != NULL) {
-                SDL_MixAudioFormat(buf, audio_buf + audio_buf_pos, AUDIO_S16SYS, len_to_write, volume);
-            }
-        }
-        buf_len -= len_to_write;
-        buf += len_to_write;
-        audio_buf_pos += len_to_write;
-    }
-    const int written = audio_buf_size - audio_buf_pos;
-    ff_player_sync_audio(player, write_time_start, written);
+    ff_player_read_audio(opaque, buf, buf_len, av_gettime_relative());
 }
 
 static int audio_open(void *opaque, AVChannelLayout *wanted_channel_layout, const int wanted_sample_rate, ff_audio_params_t* audio_hw_params) {
@@ -307,6 +318,12 @@ static int audio_open(void *opaque, AVChannelLayout *wanted_channel_layout, cons
     for(;next_sample_rate_idx && next_sample_rates[next_sample_rate_idx] >= wanted_spec.freq; --next_sample_rate_idx)
         ;
     wanted_spec.format = AUDIO_S16SYS;
+    for (int i = 0; i < FF_ARRAY_ELEMS(sdl_audio_format_map); i++) {
+        if (audio_hw_params->fmt == sdl_audio_format_map[i].format) {
+            wanted_spec.format = sdl_audio_format_map[i].audio_fmt;
+            break;
+        }
+    }
     wanted_spec.silence = 0;
     wanted_spec.samples = FFMAX(SDL_AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / SDL_AUDIO_MAX_CALLBACKS_PER_SEC));
     wanted_spec.callback = audio_callback;
@@ -330,7 +347,14 @@ static int audio_open(void *opaque, AVChannelLayout *wanted_channel_layout, cons
         }
         av_channel_layout_default(wanted_channel_layout, wanted_spec.channels);
     }
-    if (spec.format != AUDIO_S16SYS) {
+    audio_hw_params->fmt = AV_SAMPLE_FMT_NONE;
+    for (int i = 0; i < FF_ARRAY_ELEMS(sdl_audio_format_map); i++) {
+        if (spec.format == sdl_audio_format_map[i].audio_fmt) {
+            audio_hw_params->fmt = sdl_audio_format_map[i].format;
+            break;
+        }
+    }
+    if (audio_hw_params->fmt == AV_SAMPLE_FMT_NONE) {
         av_log(NULL, AV_LOG_ERROR,
                "SDL advised audio format %d is not supported!\n", spec.format);
         return -1;
@@ -345,7 +369,6 @@ static int audio_open(void *opaque, AVChannelLayout *wanted_channel_layout, cons
         }
     }
 
-    audio_hw_params->fmt = AV_SAMPLE_FMT_S16;
     audio_hw_params->freq = spec.freq;
     if (av_channel_layout_copy(&audio_hw_params->ch_layout, wanted_channel_layout) < 0) {
         return -1;
@@ -361,6 +384,17 @@ static int audio_open(void *opaque, AVChannelLayout *wanted_channel_layout, cons
     return 0;
 }
 
+static int64_t get_vsync_period(void) {
+    if (!(renderer_info.flags & SDL_RENDERER_PRESENTVSYNC)) {
+        return 0;
+    }
+    SDL_DisplayMode mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) != 0 || mode.refresh_rate <= 0) {
+        return 0;
+    }
+    return 1000000 / mode.refresh_rate;
+}
+
 static void refresh_loop_wait_event(ff_player_t* player, SDL_Event *event) {
     double remaining_time = 0.0;
     SDL_PumpEvents();
@@ -374,19 +408,33 @@ static void refresh_loop_wait_event(ff_player_t* player, SDL_Event *event) {
         }
         remaining_time = REFRESH_RATE;
         if (!ff_player_get_paused(player) || ff_player_get_force_refresh(player)) {
-            ff_frame_t* frame = ff_player_acquire_video_frame(player, &remaining_time);
-            if (frame != NULL) {
-                video_display(frame);
+            const int64_t vsync_period = get_vsync_period();
+            if (vsync_period > 0) {
+                ff_present_info_t info;
+                ff_frame_t* frame = ff_player_acquire_video_frame_at_vsync(player, &info);
+                if (frame != NULL && !info.repeat) {
+                    // presenting blocks until the vsync, so returning marks it
+                    video_display(player, frame);
+                    ff_player_set_display_timing(player, vsync_period, av_gettime_relative());
+                    remaining_time = 0.0;
+                } else if (frame != NULL) {
+                    // until the first present the player knows no period and targets now
+                    const int64_t wait = info.target_vsync - av_gettime_relative();
+                    if (wait > 0) {
+                        remaining_time = FFMIN(REFRESH_RATE, (double)wait / 1000000.0);
+                    }
+                }
+            } else {
+                ff_frame_t* frame = ff_player_acquire_video_frame(player, &remaining_time);
+                if (frame != NULL) {
+                    video_display(player, frame);
+                }
             }
         }
         SDL_PumpEvents();
     }
 }
 
-static void toggle_mute(void) {
-    muted = !muted;
-}
-
 static void event_loop(ff_player_t* player) {
     SDL_Event event;
     double incr;
@@ -408,7 +456,7 @@ static void event_loop(ff_player_t* player) {
                 ff_player_toggle_pause(player);
                 break;
             case SDLK_m:
-                toggle_mute();
+                ff_player_toggle_mute(player);
                 break;
             case SDLK_KP_MULTIPLY:
             case SDLK_0:
@@ -427,6 +475,9 @@ static void event_loop(ff_player_t* player) {
             case SDLK_v:
                 ff_player_cycle_channel(player, AVMEDIA_TYPE_VIDEO);
                 break;
+            case SDLK_t:
+                ff_player_cycle_channel(player, AVMEDIA_TYPE_SUBTITLE);
+                break;
             case SDLK_c:
                 ff_player_cycle_channel(player, AVMEDIA_TYPE_VIDEO);
                 ff_player_cycle_channel(player, AVMEDIA_TYPE_AUDIO);
@@ -555,6 +606,7 @@ int main(const int argc, char* argv[]) {
     }
     const int ret = ff_player_open(player, argv[1], NULL, NULL, &(ff_player_opts_t){
         .audio_disable = audio_disable,
+        .subtitle_disable = subtitle_disable,
         .seek_by_bytes = seek_by_bytes,
         .start_time = start_time,
         .duration = duration,
@@ -564,6 +616,10 @@ int main(const int argc, char* argv[]) {
         .opaque = player,
         .on_error_cb = on_error,
         .audio_volume = startup_volume,
+        .max_volume = SDL_MIX_MAXVOLUME,
+        .pull_audio = true,
+        .audio_prebuffer_duration = AV_TIME_BASE,
+        .smooth_audio_clock = true,
         .video_stream_params = (ff_stream_params_t){
             .lowres = lowres,
             .fast = fast,
@@ -574,6 +630,9 @@ int main(const int argc, char* argv[]) {
                 .color_spaces_size = FF_ARRAY_ELEMS(sdl_supported_color_spaces),
                 .autorotate = autorotate,
                 .reorder_pts = decoder_reorder_pts,
+                .adaptive_skip = adaptive_skip,
+                .drop_disposable = drop_disposable,
+                .threaded_filters = threaded_filters,
                 .meta_cb = set_default_window_size,
             },
         },
@@ -581,6 +640,8 @@ int main(const int argc, char* argv[]) {
             .lowres = lowres,
             .fast = fast,
             .extended.audio = (ff_audio_stream_params_t){
+                .sample_fmts = sdl_supported_sample_fmts,
+                .sample_fmts_size = FF_ARRAY_ELEMS(sdl_supported_sample_fmts),
                 .meta_cb = audio_open,
             },
         },
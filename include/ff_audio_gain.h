@@ -0,0 +1,47 @@
+#ifndef FF_AUDIO_GAIN_H_
+#define FF_AUDIO_GAIN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavutil/samplefmt.h>
+
+typedef void (*ff_audio_gain_kernel)(uint8_t* dst, const uint8_t* src, int count, float gain);
+
+typedef struct ff_audio_gain {
+    float current;
+    float target;
+    float step;
+    int ramp_length;
+    int ramp_remaining;
+
+    ff_audio_gain_kernel scale_s16;
+    ff_audio_gain_kernel scale_flt;
+    ff_audio_gain_kernel mix_s16;
+    ff_audio_gain_kernel mix_flt;
+} ff_audio_gain_t;
+
+extern void ff_audio_gain_init(ff_audio_gain_t* gain, float value, int ramp_length);
+extern void ff_audio_gain_set(ff_audio_gain_t* gain, float value);
+extern bool ff_audio_gain_is_unity(const ff_audio_gain_t* gain);
+
+// dst receives the planes back to back; it may alias src as long as every
+// output plane starts at or before its source plane
+extern void ff_audio_gain_apply(
+    ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* const* src,
+    enum AVSampleFormat format,
+    int nb_channels,
+    int nb_samples
+);
+extern void ff_audio_gain_mix(
+    ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* src,
+    enum AVSampleFormat format,
+    int nb_channels,
+    int nb_samples
+);
+
+#endif // FF_AUDIO_GAIN_H_
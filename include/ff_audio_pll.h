@@ -0,0 +1,19 @@
+#ifndef FF_AUDIO_PLL_H_
+#define FF_AUDIO_PLL_H_
+
+#include <stdint.h>
+
+// second order loop tracking the audio device position against the
+// monotonic clock; times are nanoseconds from ff_clock_now()
+typedef struct ff_audio_pll {
+    double phase;
+    int64_t phase_time;
+    double rate;
+    int serial;
+} ff_audio_pll_t;
+
+extern void ff_audio_pll_reset(ff_audio_pll_t* pll);
+// feeds a raw position estimate and returns the smoothed pts at now
+extern double ff_audio_pll_update(ff_audio_pll_t* pll, double pts, int serial, int64_t now);
+
+#endif // FF_AUDIO_PLL_H_
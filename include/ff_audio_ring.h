@@ -0,0 +1,25 @@
+#ifndef FF_AUDIO_RING_H_
+#define FF_AUDIO_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ff_audio_ring_chunk {
+    size_t end;
+    double pts;
+    int serial;
+} ff_audio_ring_chunk_t;
+
+typedef struct ff_audio_ring ff_audio_ring_t;
+
+extern ff_audio_ring_t* ff_audio_ring_create(size_t min_size, size_t nb_chunks);
+extern void ff_audio_ring_destroy(ff_audio_ring_t* ring);
+
+extern size_t ff_audio_ring_get_free(const ff_audio_ring_t* ring);
+extern int ff_audio_ring_write(ff_audio_ring_t* ring, const uint8_t* src, size_t size, double pts, int serial);
+
+extern bool ff_audio_ring_peek(const ff_audio_ring_t* ring, ff_audio_ring_chunk_t* chunk, size_t* pending);
+extern void ff_audio_ring_read(ff_audio_ring_t* ring, uint8_t* dst, size_t size);
+
+#endif // FF_AUDIO_RING_H_
@@ -1,21 +1,51 @@
 #ifndef FF_CLOCK_H_
 #define FF_CLOCK_H_
 
-typedef struct ff_clock {
-    double pts;
-    double pts_drift;
-    double last_updated;
-    double speed;
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FF_CLOCK_NOPTS INT64_MIN
+
+// consistent copy of a clock; times are monotonic nanoseconds and speed is
+// in parts per million
+typedef struct ff_clock_state {
+    int64_t pts;
+    int64_t last_updated;
+    int64_t speed;
     int serial;
-    int paused;
+    bool paused;
+} ff_clock_state_t;
+
+// writers serialize on the odd/even sequence, readers retry until they see
+// the same even sequence before and after the copy
+typedef struct ff_clock {
+    atomic_uint sequence;
+    atomic_llong pts;
+    atomic_llong last_updated;
+    atomic_llong speed;
+    atomic_int serial;
+    atomic_bool paused;
     const int *queue_serial;
 } ff_clock_t;
 
+extern int64_t ff_clock_now(void);
+
+// a NULL queue_serial makes the clock its own reference
 extern void ff_clock_init(ff_clock_t* clock, const int *queue_serial);
+extern void ff_clock_read(const ff_clock_t* clock, ff_clock_state_t* state);
+extern int64_t ff_clock_get_ns_at(const ff_clock_t* clock, int64_t now);
+extern double ff_clock_get_at(const ff_clock_t* clock, int64_t now);
 extern double ff_clock_get(const ff_clock_t* clock);
-extern void ff_clock_set_at(ff_clock_t* clock, double pts, int serial, double time);
+// pts of the last update, without extrapolation
+extern double ff_clock_get_pts(const ff_clock_t* clock);
+extern int ff_clock_get_serial(const ff_clock_t* clock);
+extern double ff_clock_get_speed(const ff_clock_t* clock);
+extern void ff_clock_set_at(ff_clock_t* clock, double pts, int serial, int64_t now);
 extern void ff_clock_set(ff_clock_t* clock, double pts, int serial);
 extern void ff_clock_set_speed(ff_clock_t* clock, double speed);
+extern void ff_clock_set_paused(ff_clock_t* clock, bool paused);
+extern void ff_clock_sync_to_slave_at(ff_clock_t* clock, const ff_clock_t* slave, double no_sync_threshold, int64_t now);
 extern void ff_clock_sync_to_slave(ff_clock_t* clock, const ff_clock_t* slave, double no_sync_threshold);
 
 #endif // FF_CLOCK_H_
@@ -0,0 +1,18 @@
+#ifndef FF_COMMAND_QUEUE_H_
+#define FF_COMMAND_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct ff_command_queue ff_command_queue_t;
+
+// fixed size items, pushed from any thread and popped by a single consumer
+extern ff_command_queue_t* ff_command_queue_create(size_t item_size);
+extern void ff_command_queue_destroy(ff_command_queue_t* queue);
+
+// lock-free; fails only when the item cannot be allocated
+extern int ff_command_queue_push(ff_command_queue_t* queue, const void* item);
+// returns false when empty, or while a concurrent push is still linking in
+extern bool ff_command_queue_pop(ff_command_queue_t* queue, void* item);
+
+#endif // FF_COMMAND_QUEUE_H_
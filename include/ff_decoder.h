@@ -17,6 +17,13 @@ typedef struct ff_decoder ff_decoder_t;
 
 typedef int (*decoder_func_t)(void* arg);
 
+typedef enum ff_decoder_skip_level {
+    FF_DECODER_SKIP_NONE = 0,
+    FF_DECODER_SKIP_LOOP_FILTER,
+    FF_DECODER_SKIP_NONREF,
+    FF_DECODER_SKIP_NONKEY
+} ff_decoder_skip_level_t;
+
 extern ff_decoder_t* ff_decoder_create(
     AVCodecContext* decoder_context,
     ff_packet_queue_t* queue,
@@ -25,12 +32,24 @@ extern ff_decoder_t* ff_decoder_create(
 );
 extern void ff_decoder_destroy(ff_decoder_t* decoder);
 extern int ff_decoder_start(ff_decoder_t* decoder, decoder_func_t decoder_func, void* arg);
-extern void ff_decoder_abort(const ff_decoder_t* decoder, ff_frame_queue_t* frame_queue);
+// parks the decoder thread; a parked decoder can be rebound and started again
+extern void ff_decoder_abort(ff_decoder_t* decoder, ff_frame_queue_t* frame_queue);
+extern void ff_decoder_rebind(ff_decoder_t* decoder, ff_packet_queue_t* queue);
 extern int ff_decoder_decode(ff_decoder_t* decoder, AVFrame* frame);
+extern int ff_decoder_decode_subtitle(ff_decoder_t* decoder, AVSubtitle* sub);
 extern const AVCodecContext* ff_decoder_get_codec_context(const ff_decoder_t* decoder);
 extern int ff_decoder_get_packet_serial(const ff_decoder_t* decoder);
 extern int ff_decoder_get_finished(const ff_decoder_t* decoder);
-extern void ff_decoder_set_finished(ff_decoder_t* decoder);
+// marks serial as fully output; safe from a thread other than the decoding one
+extern void ff_decoder_set_finished(ff_decoder_t* decoder, int serial);
 extern void ff_decoder_set_start_pts(ff_decoder_t* decoder, int64_t pts, AVRational time_base);
+// feeds how late a decoded frame is in seconds; must be called from the decoding thread
+extern ff_decoder_skip_level_t ff_decoder_update_skip_level(ff_decoder_t* decoder, double lateness);
+extern ff_decoder_skip_level_t ff_decoder_get_skip_level(const ff_decoder_t* decoder);
+// discards disposable packets before decoding until the next serial change
+extern void ff_decoder_set_drop_disposable(ff_decoder_t* decoder, bool drop_disposable);
+extern int64_t ff_decoder_get_dropped_packets(const ff_decoder_t* decoder);
+// spreads intra-only video over nb_workers codec contexts; call before ff_decoder_start
+extern int ff_decoder_set_parallel(ff_decoder_t* decoder, int nb_workers);
 
 #endif // FF_DECODER_H_
@@ -0,0 +1,30 @@
+#ifndef FF_DECODER_CACHE_H_
+#define FF_DECODER_CACHE_H_
+
+#include <stdbool.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+
+typedef struct ff_decoder ff_decoder_t;
+typedef struct ff_decoder_cache ff_decoder_cache_t;
+
+// everything a decoder was opened with, since none of it can change afterwards
+typedef struct ff_decoder_cache_key {
+    const AVCodecParameters* codecpar;
+    const char* codec_name;
+    const AVDictionary* codec_opts;
+    int lowres;
+    bool fast;
+    bool reorder_pts;
+} ff_decoder_cache_key_t;
+
+extern ff_decoder_cache_t* ff_decoder_cache_create(int capacity);
+extern void ff_decoder_cache_destroy(ff_decoder_cache_t* cache);
+
+// takes ownership of a parked decoder, evicting the oldest one when full
+extern void ff_decoder_cache_put(ff_decoder_cache_t* cache, ff_decoder_t* decoder, const ff_decoder_cache_key_t* key);
+// returns a parked decoder opened with a matching key or NULL
+extern ff_decoder_t* ff_decoder_cache_take(ff_decoder_cache_t* cache, const ff_decoder_cache_key_t* key);
+
+#endif // FF_DECODER_CACHE_H_
@@ -0,0 +1,25 @@
+#ifndef FF_DECODER_POOL_H_
+#define FF_DECODER_POOL_H_
+
+#include <stdbool.h>
+
+#include <libavcodec/avcodec.h>
+
+typedef struct ff_decoder_pool ff_decoder_pool_t;
+
+// decodes independent packets on nb_workers copies of an opened codec context
+extern ff_decoder_pool_t* ff_decoder_pool_create(const AVCodecContext* codec_context, int nb_workers);
+extern void ff_decoder_pool_destroy(ff_decoder_pool_t* pool);
+
+extern bool ff_decoder_pool_can_submit(ff_decoder_pool_t* pool);
+extern int ff_decoder_pool_get_pending(ff_decoder_pool_t* pool);
+// drain decodes the packet on its own and resets the worker afterwards, for
+// packets that do not continue the previous one on the same worker
+extern void ff_decoder_pool_submit(ff_decoder_pool_t* pool, AVPacket* packet, bool drain);
+// frames come out in submission order; AVERROR(EAGAIN) when the oldest job is still running
+extern int ff_decoder_pool_receive(ff_decoder_pool_t* pool, AVFrame* frame, bool wait);
+extern void ff_decoder_pool_flush(ff_decoder_pool_t* pool);
+// applied by each worker before its next packet
+extern void ff_decoder_pool_set_discard(ff_decoder_pool_t* pool, enum AVDiscard skip_frame, enum AVDiscard skip_loop_filter);
+
+#endif // FF_DECODER_POOL_H_
@@ -4,15 +4,29 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <libavcodec/avcodec.h>
 #include <libavutil/rational.h>
 #include <libavutil/frame.h>
 
 typedef struct ff_frame_data {
     int64_t pkt_pos;
+    int serial;
 } ff_frame_data_t;
 
+typedef struct ff_subtitle_rect {
+    int x;
+    int y;
+    int width;
+    int height;
+    uint8_t* data;
+    int linesize;
+} ff_subtitle_rect_t;
+
 typedef struct ff_frame {
     AVFrame* base;
+    AVSubtitle sub;
+    ff_subtitle_rect_t* sub_rects;
+    int nb_sub_rects;
     int serial;
     double pts;
     double duration;
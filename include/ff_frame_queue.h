@@ -24,12 +24,19 @@ extern void ff_frame_queue_signal(ff_frame_queue_t* queue);
 
 extern ff_frame_t* ff_frame_queue_peek(ff_frame_queue_t* queue);
 extern ff_frame_t* ff_frame_queue_peek_next(ff_frame_queue_t* queue);
+// n-th frame not yet shown, NULL if fewer are queued
+extern ff_frame_t* ff_frame_queue_peek_nth(ff_frame_queue_t* queue, int n);
 extern ff_frame_t* ff_frame_queue_peek_last(ff_frame_queue_t* queue);
 extern ff_frame_t* ff_frame_queue_peek_writable(ff_frame_queue_t* queue);
 extern ff_frame_t* ff_frame_queue_peek_readable(ff_frame_queue_t* queue);
 extern void ff_frame_queue_push(ff_frame_queue_t* queue);
 extern void ff_frame_queue_next(ff_frame_queue_t* queue);
 
+// a claimed frame is not recycled by ff_frame_queue_next until the upload ends
+extern bool ff_frame_queue_begin_upload(ff_frame_queue_t* queue, ff_frame_t* frame);
+extern void ff_frame_queue_end_upload(ff_frame_queue_t* queue, ff_frame_t* frame, bool uploaded);
+extern bool ff_frame_queue_wait_upload(ff_frame_queue_t* queue, ff_frame_t* frame);
+
 extern int ff_frame_queue_get_frames_remaining(const ff_frame_queue_t* queue);
 extern int64_t ff_frame_queue_get_last_pos(const ff_frame_queue_t* queue);
 extern int ff_frame_queue_rindex_shown(const ff_frame_queue_t* queue);
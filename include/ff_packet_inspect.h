@@ -0,0 +1,11 @@
+#ifndef FF_PACKET_INSPECT_H_
+#define FF_PACKET_INSPECT_H_
+
+#include <stdbool.h>
+
+#include <libavcodec/avcodec.h>
+
+// true when no other frame references the picture in the packet
+extern bool ff_packet_is_disposable(const AVCodecContext* codec_context, const AVPacket* packet);
+
+#endif // FF_PACKET_INSPECT_H_
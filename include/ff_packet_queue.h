@@ -18,6 +18,10 @@ extern bool ff_packet_queue_get_aborted(const ff_packet_queue_t* queue);
 extern int64_t ff_packet_queue_get_duration(const ff_packet_queue_t* queue);
 
 extern void ff_packet_queue_flush(ff_packet_queue_t* queue);
+// drops the oldest packets until both limits hold
+extern void ff_packet_queue_trim(ff_packet_queue_t* queue, int64_t max_duration, size_t max_size);
+// drops the oldest packets that end at or before timestamp
+extern void ff_packet_queue_drop_before(ff_packet_queue_t* queue, int64_t timestamp);
 extern void ff_packet_queue_start(ff_packet_queue_t* queue);
 extern void ff_packet_queue_abort(ff_packet_queue_t* queue);
 
@@ -11,6 +11,7 @@
 #include <libavutil/pixfmt.h>
 
 #include "ff_frame.h"
+#include "ff_recorder.h"
 
 typedef enum ff_av_sync {
     FF_AV_SYNC_AUDIO_MASTER = 0,
@@ -30,9 +31,57 @@ typedef int (*ff_audio_meta_callback)(void* opaque, AVChannelLayout* channel_lay
 typedef int (*ff_video_meta_callback)(void* opaque, int width, int height, AVRational sample_aspect_ratio);
 typedef void (*ff_on_error_callback)(void* opaque, int error);
 
+typedef struct ff_present_info {
+    // av_gettime_relative() time of the vsync the frame is chosen for
+    int64_t target_vsync;
+    // the frame is already on screen, presenting it again is optional
+    bool repeat;
+    int dropped;
+    // detected display vsyncs per frame, e.g. 2.5 for 3:2 pulldown, 0 if none
+    double cadence;
+} ff_present_info_t;
+
+// push mode: called from the player's presentation thread when a frame is
+// due; the frame is only valid during the call, take a reference to its
+// base to keep the picture longer
+typedef void (*ff_video_frame_callback)(void* opaque, ff_frame_t* frame, const ff_present_info_t* info);
+
+typedef enum ff_player_command_type {
+    FF_PLAYER_COMMAND_TOGGLE_PAUSE = 0,
+    FF_PLAYER_COMMAND_TOGGLE_MUTE,
+    FF_PLAYER_COMMAND_UPDATE_VOLUME,
+    FF_PLAYER_COMMAND_STEP_TO_NEXT_FRAME,
+    FF_PLAYER_COMMAND_CYCLE_CHANNEL,
+    FF_PLAYER_COMMAND_SEEK_CHAPTER,
+    FF_PLAYER_COMMAND_SEEK,
+    FF_PLAYER_COMMAND_SET_STANDBY
+} ff_player_command_type_t;
+
+typedef struct ff_player_command {
+    ff_player_command_type_t type;
+    union {
+        struct {
+            int max_volume;
+            int sign;
+            double step;
+        } volume;
+        enum AVMediaType media_type;
+        int chapter_incr;
+        double seek_incr;
+        bool standby;
+    } args;
+} ff_player_command_t;
+
+// result is a negative AVERROR, AVERROR_EXIT when the player closed before
+// the command ran, or else the new paused/muted state or volume, 0 otherwise
+typedef void (*ff_command_done_callback)(void* opaque, int result);
+
 typedef struct ff_audio_stream_params {
     AVDictionary* swr_opts;
 
+    enum AVSampleFormat* sample_fmts;
+    size_t sample_fmts_size;
+
     ff_audio_meta_callback meta_cb;
 } ff_audio_stream_params_t;
 
@@ -47,6 +96,10 @@ typedef struct ff_video_stream_params {
 
     bool autorotate;
     bool reorder_pts;
+    bool adaptive_skip;
+    bool drop_disposable;
+    int parallel_decode;
+    bool threaded_filters;
 
     ff_video_meta_callback meta_cb;
 } ff_video_stream_params_t;
@@ -71,6 +124,7 @@ typedef struct ff_player_opts {
     const AVInputFormat* input_format;
 
     bool audio_disable;
+    bool subtitle_disable;
     bool seek_by_bytes;
 
     int64_t start_time;
@@ -82,17 +136,39 @@ typedef struct ff_player_opts {
     bool find_stream_info;
 
     int audio_volume;
+    int max_volume;
+    bool pull_audio;
+    // keeps every other audio stream decodable from the audio clock on for instant
+    // switching, or this much of it while the clock is unknown; 0 disables
+    int64_t audio_prebuffer_duration;
+    // filters device position estimates through a phase-locked loop
+    bool smooth_audio_clock;
+    // opens with clocks held and no output pulled while demux and decode fill
+    // the queues; the audio meta_cb still negotiates the output format
+    bool standby;
+    // bytes of disk-backed time-shift buffer for realtime inputs, 0 disables;
+    // the file is created at timeshift_path or as an anonymous temporary file
+    int64_t timeshift_size;
+    char* timeshift_path;
 
     void* opaque;
     ff_on_error_callback on_error_cb;
+    ff_video_frame_callback video_frame_cb;
 
     AVDictionary* format_opts;
     AVDictionary* stream_opts;
 
     ff_stream_params_t video_stream_params;
     ff_stream_params_t audio_stream_params;
+    ff_stream_params_t subtitle_stream_params;
 } ff_player_opts_t;
 
+typedef struct ff_frame_lookahead {
+    ff_frame_t* frame;
+    // av_gettime_relative() time the frame is scheduled for, AV_NOPTS_VALUE if unknown
+    int64_t present_time;
+} ff_frame_lookahead_t;
+
 typedef struct ff_player ff_player_t;
 
 extern int ff_audio_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params_t* src);
@@ -101,6 +177,9 @@ extern void ff_audio_stream_params_destroy(ff_stream_params_t* params);
 extern int ff_video_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params_t* src);
 extern void ff_video_stream_params_destroy(ff_stream_params_t* params);
 
+extern int ff_subtitle_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params_t* src);
+extern void ff_subtitle_stream_params_destroy(ff_stream_params_t* params);
+
 extern int ff_player_opts_copy(ff_player_opts_t* dst, const ff_player_opts_t* src);
 extern void ff_player_opts_destroy(ff_player_opts_t* opts);
 
@@ -116,22 +195,89 @@ extern void ff_player_abort(ff_player_t* player);
 extern void ff_player_close(ff_player_t* player);
 extern void ff_player_destroy(ff_player_t* player);
 
+// pull mode only; with video_frame_cb set, frames arrive on the callback
 extern ff_frame_t* ff_player_acquire_video_frame(ff_player_t* player, double *remaining_time);
+// picks the frame whose display interval covers the next vsync, using the
+// timing from ff_player_set_display_timing (both in av_gettime_relative() units)
+extern ff_frame_t* ff_player_acquire_video_frame_at_vsync(ff_player_t* player, ff_present_info_t* info);
+extern void ff_player_set_display_timing(ff_player_t* player, int64_t refresh_period, int64_t last_vsync);
+// upcoming frames without consuming them, called from the presenting thread;
+// they stay valid until acquiring moves past them, or until an upload claimed
+// with ff_player_begin_video_upload on any thread has ended
+extern int ff_player_peek_video_frames(ff_player_t* player, ff_frame_lookahead_t* frames, int max_frames);
+extern bool ff_player_begin_video_upload(ff_player_t* player, ff_frame_t* frame);
+extern void ff_player_end_video_upload(ff_player_t* player, ff_frame_t* frame, bool uploaded);
+// waits for an upload in progress and returns whether the frame is uploaded
+extern bool ff_player_wait_video_upload(ff_player_t* player, ff_frame_t* frame);
+// the overlay is a width x height canvas at the subtitle's own resolution,
+// to be scaled by the host onto the video it covers
+extern ff_frame_t* ff_player_acquire_subtitle(ff_player_t* player);
 extern uint8_t* ff_player_acquire_audio_buf(ff_player_t* player, int* size);
 extern void ff_player_sync_audio(ff_player_t* player, int64_t write_start_time, int written);
-
-extern void ff_player_toggle_pause(ff_player_t* player);
-extern void ff_player_update_volume(ff_player_t* player, int max_volume, int sign, double step);
-extern void ff_player_step_to_next_frame(ff_player_t* player);
-extern void ff_player_cycle_channel(ff_player_t* player, enum AVMediaType media_type);
-extern void ff_player_seek_chapter(ff_player_t* player, int incr);
-extern void ff_player_seek(ff_player_t* player, double incr);
+extern int ff_player_read_audio(ff_player_t* player, uint8_t* dst, int nbytes, int64_t now);
+// optional device feedback, called from the audio callback thread: latency
+// in microseconds from the end of the delivered data to the speaker (negative
+// clears it), or the sample frames played since the stream opened at time
+extern void ff_player_report_audio_latency(ff_player_t* player, int64_t latency);
+extern void ff_player_report_audio_position(ff_player_t* player, int64_t frames_played, int64_t time);
+
+// control commands never block the caller: they are queued and run in order
+// on the read thread, except mute and volume which apply at once; done is
+// called afterwards if it is not NULL. Fails when the player is not open
+extern int ff_player_post_command(
+    ff_player_t* player,
+    const ff_player_command_t* command,
+    ff_command_done_callback done,
+    void* opaque
+);
+extern int ff_player_toggle_pause(ff_player_t* player);
+extern int ff_player_update_volume(ff_player_t* player, int max_volume, int sign, double step);
+extern int ff_player_toggle_mute(ff_player_t* player);
+extern int ff_player_step_to_next_frame(ff_player_t* player);
+extern int ff_player_cycle_channel(ff_player_t* player, enum AVMediaType media_type);
+extern int ff_player_seek_chapter(ff_player_t* player, int incr);
+extern int ff_player_seek(ff_player_t* player, double incr);
+// leaving standby starts the clocks and forces a refresh
+extern int ff_player_set_standby(ff_player_t* player, bool standby);
 
 extern const ff_audio_params_t* ff_player_get_audio_params(const ff_player_t* player);
 extern int ff_player_get_audio_volume(const ff_player_t* player);
 extern const AVFormatContext* ff_player_get_format_context(const ff_player_t* player);
+extern bool ff_player_get_muted(const ff_player_t* player);
+// smoothed audio position in seconds, NAN when unknown
+extern double ff_player_get_audio_clock(const ff_player_t* player);
+// current ff_decoder_skip_level_t of the video decoder
+extern int ff_player_get_video_skip_level(const ff_player_t* player);
 extern bool ff_player_get_paused(const ff_player_t* player);
+extern bool ff_player_get_standby(const ff_player_t* player);
+// demuxed bytes waiting in the packet queues
+extern int64_t ff_player_get_buffered_bytes(const ff_player_t* player);
+// seekable range in AV_TIME_BASE units, false without a time-shift buffer;
+// seeking past end jumps back to live
+extern bool ff_player_get_timeshift_window(const ff_player_t* player, int64_t* start, int64_t* end);
+// tees the demuxed packets of the played streams into a file without
+// re-reading the source; the read thread starts it before its next read and
+// reports a failure through the stats error. Stopping waits for the queued
+// packets to be written
+extern int ff_player_start_recording(ff_player_t* player, const char* path, const char* format);
+extern void ff_player_stop_recording(ff_player_t* player);
+// false when not recording, true from start until stop otherwise
+extern bool ff_player_get_recording_stats(ff_player_t* player, ff_recorder_stats_t* stats);
 extern bool ff_player_get_force_refresh(const ff_player_t* player);
 extern void ff_player_set_force_refresh(ff_player_t* player, bool force_refresh);
 
+// the new chain is built on the filter thread at the next frame boundary; a
+// chain that fails to configure is logged and the running one is kept. NULL
+// removes all user filters
+extern int ff_player_set_video_filters(ff_player_t* player, const char* filters);
+extern int ff_player_set_audio_filters(ff_player_t* player, const char* filters);
+// queued and run through avfilter_graph_send_command before the next frame
+extern int ff_player_send_filter_command(
+    ff_player_t* player,
+    enum AVMediaType media_type,
+    const char* target,
+    const char* command,
+    const char* arg
+);
+
 #endif // FF_PLAYER_H_
@@ -0,0 +1,26 @@
+#ifndef FF_PLAYER_POOL_H_
+#define FF_PLAYER_POOL_H_
+
+#include <stdint.h>
+
+#include "ff_player.h"
+
+typedef struct ff_player_pool ff_player_pool_t;
+
+// keeps up to capacity players open in standby, evicting the least recently
+// used one when full or when their buffered bytes exceed max_bytes (0 for no
+// limit); not thread-safe, use it from the thread that drives the players
+extern ff_player_pool_t* ff_player_pool_create(int capacity, int64_t max_bytes);
+extern void ff_player_pool_destroy(ff_player_pool_t* pool);
+
+// opens filename in standby unless it is pooled already
+extern int ff_player_pool_prepare(ff_player_pool_t* pool, const char* filename, const ff_player_opts_t* opts);
+// hands out the pooled player for filename, or opens a new one, and activates
+// it; the caller owns it until it is released or destroyed
+extern int ff_player_pool_acquire(ff_player_pool_t* pool, const char* filename, const ff_player_opts_t* opts, ff_player_t** player);
+// puts an active player back into standby under filename
+extern int ff_player_pool_release(ff_player_pool_t* pool, const char* filename, ff_player_t* player);
+// re-checks the memory budget as standby queues fill up
+extern void ff_player_pool_trim(ff_player_pool_t* pool);
+
+#endif // FF_PLAYER_POOL_H_
@@ -0,0 +1,36 @@
+#ifndef FF_RECORDER_H_
+#define FF_RECORDER_H_
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+typedef struct ff_recorder_stats {
+    int64_t packets_written;
+    int64_t bytes_written;
+    int64_t packets_dropped;
+    int64_t bytes_dropped;
+    // first muxing error, 0 while healthy
+    int error;
+} ff_recorder_stats_t;
+
+typedef struct ff_recorder ff_recorder_t;
+
+// remuxes the given input streams into path on its own thread; format may
+// be NULL to guess it from path
+extern ff_recorder_t* ff_recorder_create(
+    const char* path,
+    const char* format,
+    const AVFormatContext* input,
+    const int* stream_indices,
+    int nb_stream_indices
+);
+// writes what is still queued and finalizes the file
+extern void ff_recorder_destroy(ff_recorder_t* recorder);
+
+// never blocks on the muxer: packets are shared by reference, start at the
+// next video keyframe and are dropped when the queue is over its budget
+extern void ff_recorder_write(ff_recorder_t* recorder, const AVPacket* packet);
+extern void ff_recorder_get_stats(ff_recorder_t* recorder, ff_recorder_stats_t* stats);
+
+#endif // FF_RECORDER_H_
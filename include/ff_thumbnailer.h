@@ -0,0 +1,40 @@
+#ifndef FF_THUMBNAILER_H_
+#define FF_THUMBNAILER_H_
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+typedef struct ff_thumbnailer_opts {
+    // output size; a zero side follows the display aspect, both zero keep
+    // the decoded size
+    int width;
+    int height;
+    // AV_PIX_FMT_NONE keeps the decoder format
+    enum AVPixelFormat pix_fmt;
+    // decoder copies working in parallel, 0 for one per CPU
+    int nb_threads;
+} ff_thumbnailer_opts_t;
+
+// frame is only valid during the call and NULL when error is negative
+typedef void (*ff_thumbnail_callback)(void* opaque, int index, const AVFrame* frame, int error);
+
+typedef struct ff_thumbnailer ff_thumbnailer_t;
+
+// opens and probes url once for any number of extractions
+extern ff_thumbnailer_t* ff_thumbnailer_create(const char* url, const ff_thumbnailer_opts_t* opts);
+extern void ff_thumbnailer_destroy(ff_thumbnailer_t* thumbnailer);
+
+// decodes the keyframe at or before each timestamp (AV_TIME_BASE units) and
+// calls back with its index into timestamps; decoded frames come in the order
+// of timestamps, a timestamp that cannot be read is reported right away
+extern int ff_thumbnailer_extract(
+    ff_thumbnailer_t* thumbnailer,
+    const int64_t* timestamps,
+    int count,
+    ff_thumbnail_callback callback,
+    void* opaque
+);
+
+#endif // FF_THUMBNAILER_H_
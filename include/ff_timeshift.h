@@ -0,0 +1,30 @@
+#ifndef FF_TIMESHIFT_H_
+#define FF_TIMESHIFT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavcodec/packet.h>
+
+typedef struct ff_timeshift ff_timeshift_t;
+
+// append-only packet ring in a fixed-size file, path NULL for an anonymous
+// temporary file; only the sparse seek index stays in memory
+extern ff_timeshift_t* ff_timeshift_create(const char* path, int64_t size);
+extern void ff_timeshift_destroy(ff_timeshift_t* timeshift);
+
+// time is in AV_TIME_BASE units; seek points are taken from sync packets at
+// most every TIMESHIFT_INDEX_INTERVAL apart and reclaimed with the data
+extern int ff_timeshift_write(ff_timeshift_t* timeshift, const AVPacket* packet, int64_t time, bool sync);
+// AVERROR(EAGAIN) once caught up with the writer; discontinuity is set when
+// the writer overran the read position and reading resumed at the oldest
+// seek point
+extern int ff_timeshift_read(ff_timeshift_t* timeshift, AVPacket* packet, bool* discontinuity);
+// moves the read position to the last seek point at or before time, clamped
+// to the window
+extern int ff_timeshift_seek(ff_timeshift_t* timeshift, int64_t time);
+// oldest seek point and newest written time, AV_NOPTS_VALUE while empty;
+// safe to call from any thread
+extern void ff_timeshift_get_window(const ff_timeshift_t* timeshift, int64_t* start, int64_t* end);
+
+#endif // FF_TIMESHIFT_H_
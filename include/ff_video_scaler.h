@@ -0,0 +1,16 @@
+#ifndef FF_VIDEO_SCALER_H_
+#define FF_VIDEO_SCALER_H_
+
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+typedef struct ff_video_scaler ff_video_scaler_t;
+
+// converts horizontal bands on up to nb_threads threads
+extern ff_video_scaler_t* ff_video_scaler_create(const AVDictionary* sws_opts, int nb_threads);
+extern void ff_video_scaler_destroy(ff_video_scaler_t* scaler);
+
+extern int ff_video_scaler_convert(ff_video_scaler_t* scaler, AVFrame* dst, const AVFrame* src, enum AVPixelFormat dst_format);
+
+#endif // FF_VIDEO_SCALER_H_
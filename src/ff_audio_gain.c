@@ -0,0 +1,407 @@
+#include "ff_audio_gain.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_GAIN_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HAVE_GAIN_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GAIN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GAIN_TARGET(isa)
+#endif
+
+static void scale_s16_c(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int16_t* d = (int16_t*)dst;
+    const int16_t* s = (const int16_t*)src;
+    for (int i = 0; i < count; ++i) {
+        d[i] = av_clip_int16((int)lrintf((float)s[i] * gain));
+    }
+}
+
+static void mix_s16_c(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int16_t* d = (int16_t*)dst;
+    const int16_t* s = (const int16_t*)src;
+    for (int i = 0; i < count; ++i) {
+        d[i] = av_clip_int16((int)lrintf((float)d[i] + (float)s[i] * gain));
+    }
+}
+
+static void scale_flt_c(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    float* d = (float*)dst;
+    const float* s = (const float*)src;
+    for (int i = 0; i < count; ++i) {
+        d[i] = s[i] * gain;
+    }
+}
+
+static void mix_flt_c(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    float* d = (float*)dst;
+    const float* s = (const float*)src;
+    for (int i = 0; i < count; ++i) {
+        d[i] += s[i] * gain;
+    }
+}
+
+#ifdef HAVE_GAIN_X86
+
+GAIN_TARGET("sse2")
+static void scale_s16_sse2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        const __m128i out = _mm_packs_epi32(
+            _mm_cvtps_epi32(_mm_mul_ps(lo, g)),
+            _mm_cvtps_epi32(_mm_mul_ps(hi, g))
+        );
+        _mm_storeu_si128((__m128i*)(dst + i * 2), out);
+    }
+    scale_s16_c(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+GAIN_TARGET("sse2")
+static void mix_s16_sse2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i * 2));
+        const __m128 s_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+        const __m128 s_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        const __m128 d_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16));
+        const __m128 d_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16));
+        const __m128i out = _mm_packs_epi32(
+            _mm_cvtps_epi32(_mm_add_ps(d_lo, _mm_mul_ps(s_lo, g))),
+            _mm_cvtps_epi32(_mm_add_ps(d_hi, _mm_mul_ps(s_hi, g)))
+        );
+        _mm_storeu_si128((__m128i*)(dst + i * 2), out);
+    }
+    mix_s16_c(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+GAIN_TARGET("sse2")
+static void scale_flt_sse2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps((float*)dst + i, _mm_mul_ps(_mm_loadu_ps((const float*)src + i), g));
+    }
+    scale_flt_c(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+GAIN_TARGET("sse2")
+static void mix_flt_sse2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 d = _mm_loadu_ps((const float*)dst + i);
+        _mm_storeu_ps((float*)dst + i, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps((const float*)src + i), g)));
+    }
+    mix_flt_c(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+GAIN_TARGET("avx2")
+static void scale_s16_avx2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2))));
+        const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2 + 16))));
+        const __m256i out = _mm256_packs_epi32(
+            _mm256_cvtps_epi32(_mm256_mul_ps(lo, g)),
+            _mm256_cvtps_epi32(_mm256_mul_ps(hi, g))
+        );
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute4x64_epi64(out, 0xD8));
+    }
+    scale_s16_sse2(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+GAIN_TARGET("avx2")
+static void mix_s16_avx2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 s_lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2))));
+        const __m256 s_hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2 + 16))));
+        const __m256 d_lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(dst + i * 2))));
+        const __m256 d_hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(dst + i * 2 + 16))));
+        const __m256i out = _mm256_packs_epi32(
+            _mm256_cvtps_epi32(_mm256_add_ps(d_lo, _mm256_mul_ps(s_lo, g))),
+            _mm256_cvtps_epi32(_mm256_add_ps(d_hi, _mm256_mul_ps(s_hi, g)))
+        );
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute4x64_epi64(out, 0xD8));
+    }
+    mix_s16_sse2(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+GAIN_TARGET("avx2")
+static void scale_flt_avx2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps((float*)dst + i, _mm256_mul_ps(_mm256_loadu_ps((const float*)src + i), g));
+    }
+    scale_flt_sse2(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+GAIN_TARGET("avx2")
+static void mix_flt_avx2(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 d = _mm256_loadu_ps((const float*)dst + i);
+        _mm256_storeu_ps((float*)dst + i, _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps((const float*)src + i), g)));
+    }
+    mix_flt_sse2(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+#endif // HAVE_GAIN_X86
+
+#ifdef HAVE_GAIN_NEON
+
+static void scale_s16_neon(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int16x8_t s = vld1q_s16((const int16_t*)src + i);
+        const float32x4_t lo = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), gain);
+        const float32x4_t hi = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), gain);
+        vst1q_s16((int16_t*)dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+    }
+    scale_s16_c(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+static void mix_s16_neon(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int16x8_t s = vld1q_s16((const int16_t*)src + i);
+        const int16x8_t d = vld1q_s16((const int16_t*)dst + i);
+        const float32x4_t lo = vmlaq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(d))), vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), gain);
+        const float32x4_t hi = vmlaq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(d))), vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), gain);
+        vst1q_s16((int16_t*)dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+    }
+    mix_s16_c(dst + i * 2, src + i * 2, count - i, gain);
+}
+
+static void scale_flt_neon(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32((float*)dst + i, vmulq_n_f32(vld1q_f32((const float*)src + i), gain));
+    }
+    scale_flt_c(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+static void mix_flt_neon(uint8_t* dst, const uint8_t* src, const int count, const float gain) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32((float*)dst + i, vmlaq_n_f32(vld1q_f32((const float*)dst + i), vld1q_f32((const float*)src + i), gain));
+    }
+    mix_flt_c(dst + i * 4, src + i * 4, count - i, gain);
+}
+
+#endif // HAVE_GAIN_NEON
+
+static void process_sample(uint8_t* dst, const uint8_t* src, const int i, const enum AVSampleFormat format, const float gain, const bool accumulate) {
+    switch (format) {
+    case AV_SAMPLE_FMT_U8: {
+        const float value = (float)(src[i] - 0x80) * gain + (accumulate ? (float)(dst[i] - 0x80) : 0.0f);
+        dst[i] = av_clip_uint8((int)lrintf(value) + 0x80);
+        break;
+    }
+    case AV_SAMPLE_FMT_S16: {
+        const float value = (float)((const int16_t*)src)[i] * gain + (accumulate ? (float)((int16_t*)dst)[i] : 0.0f);
+        ((int16_t*)dst)[i] = av_clip_int16((int)lrintf(value));
+        break;
+    }
+    case AV_SAMPLE_FMT_S32: {
+        const double value = (double)((const int32_t*)src)[i] * gain + (accumulate ? (double)((int32_t*)dst)[i] : 0.0);
+        ((int32_t*)dst)[i] = av_clipl_int32(llrint(value));
+        break;
+    }
+    case AV_SAMPLE_FMT_S64: {
+        const double value = (double)((const int64_t*)src)[i] * gain + (accumulate ? (double)((int64_t*)dst)[i] : 0.0);
+        ((int64_t*)dst)[i] = llrint(value);
+        break;
+    }
+    case AV_SAMPLE_FMT_FLT:
+        ((float*)dst)[i] = ((const float*)src)[i] * gain + (accumulate ? ((float*)dst)[i] : 0.0f);
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        ((double*)dst)[i] = ((const double*)src)[i] * gain + (accumulate ? ((double*)dst)[i] : 0.0);
+        break;
+    default:
+        break;
+    }
+}
+
+static void process_block(
+    const ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* src,
+    const enum AVSampleFormat format,
+    const int count,
+    const float value,
+    const bool accumulate
+) {
+    if (count <= 0) {
+        return;
+    }
+    if (accumulate) {
+        if (value == 0.0f) {
+            return;
+        }
+    } else if (value == 1.0f) {
+        if (dst != src) {
+            memmove(dst, src, (size_t)count * av_get_bytes_per_sample(format));
+        }
+        return;
+    } else if (value == 0.0f) {
+        memset(dst, format == AV_SAMPLE_FMT_U8 ? 0x80 : 0, (size_t)count * av_get_bytes_per_sample(format));
+        return;
+    }
+    switch (format) {
+    case AV_SAMPLE_FMT_S16:
+        (accumulate ? gain->mix_s16 : gain->scale_s16)(dst, src, count, value);
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        (accumulate ? gain->mix_flt : gain->scale_flt)(dst, src, count, value);
+        break;
+    default:
+        for (int i = 0; i < count; ++i) {
+            process_sample(dst, src, i, format, value, accumulate);
+        }
+        break;
+    }
+}
+
+static void process_plane(
+    const ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* src,
+    const enum AVSampleFormat format,
+    const int nb_channels,
+    const int nb_samples,
+    const int ramp,
+    const bool accumulate
+) {
+    float value = gain->current;
+    for (int n = 0, i = 0; n < ramp; ++n) {
+        value += gain->step;
+        for (int c = 0; c < nb_channels; ++c, ++i) {
+            process_sample(dst, src, i, format, value, accumulate);
+        }
+    }
+    const int ramp_size = ramp * nb_channels * av_get_bytes_per_sample(format);
+    process_block(gain, dst + ramp_size, src + ramp_size, format, (nb_samples - ramp) * nb_channels, gain->target, accumulate);
+}
+
+static void advance_ramp(ff_audio_gain_t* gain, const int ramp) {
+    if (ramp > 0) {
+        gain->ramp_remaining -= ramp;
+        gain->current = gain->ramp_remaining > 0 ? gain->current + gain->step * (float)ramp : gain->target;
+    }
+}
+
+void ff_audio_gain_init(ff_audio_gain_t* gain, const float value, const int ramp_length) {
+    gain->current = value;
+    gain->target = value;
+    gain->step = 0.0f;
+    gain->ramp_length = ramp_length;
+    gain->ramp_remaining = 0;
+
+    gain->scale_s16 = scale_s16_c;
+    gain->scale_flt = scale_flt_c;
+    gain->mix_s16 = mix_s16_c;
+    gain->mix_flt = mix_flt_c;
+#if defined(HAVE_GAIN_X86)
+    const int cpu_flags = av_get_cpu_flags();
+    if (cpu_flags & AV_CPU_FLAG_SSE2) {
+        gain->scale_s16 = scale_s16_sse2;
+        gain->scale_flt = scale_flt_sse2;
+        gain->mix_s16 = mix_s16_sse2;
+        gain->mix_flt = mix_flt_sse2;
+    }
+    if (cpu_flags & AV_CPU_FLAG_AVX2) {
+        gain->scale_s16 = scale_s16_avx2;
+        gain->scale_flt = scale_flt_avx2;
+        gain->mix_s16 = mix_s16_avx2;
+        gain->mix_flt = mix_flt_avx2;
+    }
+#elif defined(HAVE_GAIN_NEON)
+    gain->scale_s16 = scale_s16_neon;
+    gain->scale_flt = scale_flt_neon;
+    gain->mix_s16 = mix_s16_neon;
+    gain->mix_flt = mix_flt_neon;
+#endif
+}
+
+void ff_audio_gain_set(ff_audio_gain_t* gain, const float value) {
+    if (gain->target == value) {
+        return;
+    }
+    gain->target = value;
+    if (gain->ramp_length > 0) {
+        gain->step = (gain->target - gain->current) / (float)gain->ramp_length;
+        gain->ramp_remaining = gain->ramp_length;
+    } else {
+        gain->current = value;
+        gain->ramp_remaining = 0;
+    }
+}
+
+bool ff_audio_gain_is_unity(const ff_audio_gain_t* gain) {
+    return gain->ramp_remaining == 0 && gain->current == 1.0f;
+}
+
+void ff_audio_gain_apply(
+    ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* const* src,
+    const enum AVSampleFormat format,
+    const int nb_channels,
+    const int nb_samples
+) {
+    const enum AVSampleFormat packed_format = av_get_packed_sample_fmt(format);
+    const int ramp = FFMIN(gain->ramp_remaining, nb_samples);
+    if (av_sample_fmt_is_planar(format)) {
+        const int plane_size = nb_samples * av_get_bytes_per_sample(format);
+        for (int i = 0; i < nb_channels; ++i) {
+            process_plane(gain, dst + i * plane_size, src[i], packed_format, 1, nb_samples, ramp, false);
+        }
+    } else {
+        process_plane(gain, dst, src[0], packed_format, nb_channels, nb_samples, ramp, false);
+    }
+    advance_ramp(gain, ramp);
+}
+
+void ff_audio_gain_mix(
+    ff_audio_gain_t* gain,
+    uint8_t* dst,
+    const uint8_t* src,
+    const enum AVSampleFormat format,
+    const int nb_channels,
+    const int nb_samples
+) {
+    const enum AVSampleFormat packed_format = av_get_packed_sample_fmt(format);
+    const int ramp = FFMIN(gain->ramp_remaining, nb_samples);
+    if (av_sample_fmt_is_planar(format)) {
+        const int plane_size = nb_samples * av_get_bytes_per_sample(format);
+        for (int i = 0; i < nb_channels; ++i) {
+            process_plane(gain, dst + i * plane_size, src + i * plane_size, packed_format, 1, nb_samples, ramp, true);
+        }
+    } else {
+        process_plane(gain, dst, src, packed_format, nb_channels, nb_samples, ramp, true);
+    }
+    advance_ramp(gain, ramp);
+}
@@ -0,0 +1,38 @@
+#include "ff_audio_pll.h"
+
+#include <math.h>
+
+#include <libavutil/common.h>
+
+#define PLL_PHASE_GAIN      0.0625
+#define PLL_RATE_GAIN       0.002
+#define PLL_RATE_LIMIT      0.02
+#define PLL_RESET_THRESHOLD 0.25
+
+void ff_audio_pll_reset(ff_audio_pll_t* pll) {
+    pll->phase = NAN;
+    pll->phase_time = 0;
+    pll->rate = 1.0;
+    pll->serial = -1;
+}
+
+double ff_audio_pll_update(ff_audio_pll_t* pll, const double pts, const int serial, const int64_t now) {
+    const double elapsed = (double)(now - pll->phase_time) / 1000000000.0;
+    const double predicted = pll->phase + elapsed * pll->rate;
+    const double error = pts - predicted;
+    // seeks, stream switches and device stalls restart the loop instead of
+    // being slewed through
+    if (isnan(pll->phase) || serial != pll->serial || elapsed < 0 || fabs(error) > PLL_RESET_THRESHOLD) {
+        pll->phase = pts;
+        pll->phase_time = now;
+        pll->rate = 1.0;
+        pll->serial = serial;
+        return pts;
+    }
+    pll->phase = predicted + PLL_PHASE_GAIN * error;
+    pll->phase_time = now;
+    if (elapsed > 0) {
+        pll->rate = av_clipd(pll->rate + PLL_RATE_GAIN * error / elapsed, 1.0 - PLL_RATE_LIMIT, 1.0 + PLL_RATE_LIMIT);
+    }
+    return pll->phase;
+}
@@ -0,0 +1,122 @@
+#include "ff_audio_ring.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/error.h>
+
+// single producer, single consumer: the writer owns write_index and
+// publishes chunks, the reader owns the read indices
+struct ff_audio_ring {
+    uint8_t* data;
+    size_t size;
+
+    ff_audio_ring_chunk_t* chunks;
+    size_t nb_chunks;
+
+    size_t write_index;
+    atomic_size_t read_index;
+    atomic_size_t chunk_write_index;
+    atomic_size_t chunk_read_index;
+};
+
+static size_t round_up_pow2(const size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+ff_audio_ring_t* ff_audio_ring_create(const size_t min_size, const size_t nb_chunks) {
+    ff_audio_ring_t* ring = (ff_audio_ring_t*)calloc(1, sizeof(ff_audio_ring_t));
+    if (ring != NULL) {
+        ring->size = round_up_pow2(min_size);
+        ring->nb_chunks = round_up_pow2(nb_chunks);
+        ring->data = (uint8_t*)malloc(ring->size);
+        if (ring->data != NULL) {
+            ring->chunks = (ff_audio_ring_chunk_t*)calloc(ring->nb_chunks, sizeof(ff_audio_ring_chunk_t));
+            if (ring->chunks != NULL) {
+                atomic_init(&ring->read_index, 0);
+                atomic_init(&ring->chunk_write_index, 0);
+                atomic_init(&ring->chunk_read_index, 0);
+                return ring;
+            }
+            free(ring->data);
+        }
+        free(ring);
+    }
+    return NULL;
+}
+
+void ff_audio_ring_destroy(ff_audio_ring_t* ring) {
+    free(ring->chunks);
+    free(ring->data);
+    free(ring);
+}
+
+size_t ff_audio_ring_get_free(const ff_audio_ring_t* ring) {
+    const size_t chunk_read_index = atomic_load_explicit(&ring->chunk_read_index, memory_order_acquire);
+    const size_t chunk_write_index = atomic_load_explicit(&ring->chunk_write_index, memory_order_relaxed);
+    if (chunk_write_index - chunk_read_index >= ring->nb_chunks) {
+        return 0;
+    }
+    const size_t read_index = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    return ring->size - (ring->write_index - read_index);
+}
+
+int ff_audio_ring_write(ff_audio_ring_t* ring, const uint8_t* src, const size_t size, const double pts, const int serial) {
+    if (size == 0) {
+        return 0;
+    }
+    if (ff_audio_ring_get_free(ring) < size) {
+        return AVERROR(EAGAIN);
+    }
+    const size_t offset = ring->write_index & (ring->size - 1);
+    const size_t first = ring->size - offset < size ? ring->size - offset : size;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, src + first, size - first);
+    ring->write_index += size;
+
+    const size_t chunk_write_index = atomic_load_explicit(&ring->chunk_write_index, memory_order_relaxed);
+    ff_audio_ring_chunk_t* chunk = ring->chunks + (chunk_write_index & (ring->nb_chunks - 1));
+    chunk->end = ring->write_index;
+    chunk->pts = pts;
+    chunk->serial = serial;
+    atomic_store_explicit(&ring->chunk_write_index, chunk_write_index + 1, memory_order_release);
+
+    return 0;
+}
+
+bool ff_audio_ring_peek(const ff_audio_ring_t* ring, ff_audio_ring_chunk_t* chunk, size_t* pending) {
+    const size_t chunk_read_index = atomic_load_explicit(&ring->chunk_read_index, memory_order_relaxed);
+    const size_t chunk_write_index = atomic_load_explicit(&ring->chunk_write_index, memory_order_acquire);
+    if (chunk_read_index == chunk_write_index) {
+        return false;
+    }
+    *chunk = ring->chunks[chunk_read_index & (ring->nb_chunks - 1)];
+    *pending = chunk->end - atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+
+    return true;
+}
+
+void ff_audio_ring_read(ff_audio_ring_t* ring, uint8_t* dst, const size_t size) {
+    ff_audio_ring_chunk_t chunk;
+    size_t pending;
+    if (!ff_audio_ring_peek(ring, &chunk, &pending) || size > pending) {
+        return;
+    }
+    const size_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    if (dst != NULL) {
+        const size_t offset = read_index & (ring->size - 1);
+        const size_t first = ring->size - offset < size ? ring->size - offset : size;
+        memcpy(dst, ring->data + offset, first);
+        memcpy(dst + first, ring->data, size - first);
+    }
+    atomic_store_explicit(&ring->read_index, read_index + size, memory_order_release);
+    if (size == pending) {
+        const size_t chunk_read_index = atomic_load_explicit(&ring->chunk_read_index, memory_order_relaxed);
+        atomic_store_explicit(&ring->chunk_read_index, chunk_read_index + 1, memory_order_release);
+    }
+}
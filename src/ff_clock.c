@@ -1,48 +1,165 @@
 #include "ff_clock.h"
 
 #include <math.h>
+#include <stdlib.h>
 
 #include <libavutil/time.h>
 
+enum {
+    NS_PER_SEC = 1000000000,
+    SPEED_ONE  = 1000000,
+};
+
+// frame timing and the audio callbacks are in av_gettime_relative() time, so
+// the clocks use the same source rather than a possibly different monotonic one
+int64_t ff_clock_now(void) {
+    return av_gettime_relative() * 1000;
+}
+
+static int64_t seconds_to_ns(const double value) {
+    return isnan(value) ? FF_CLOCK_NOPTS : llrint(value * NS_PER_SEC);
+}
+
+static double ns_to_seconds(const int64_t value) {
+    return value == FF_CLOCK_NOPTS ? NAN : (double)value / NS_PER_SEC;
+}
+
+static void clock_write_begin(ff_clock_t* clock) {
+    unsigned int sequence = atomic_load_explicit(&clock->sequence, memory_order_relaxed);
+    for (;;) {
+        if ((sequence & 1) == 0 &&
+            atomic_compare_exchange_weak_explicit(&clock->sequence, &sequence, sequence + 1, memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        sequence = atomic_load_explicit(&clock->sequence, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static void clock_write_end(ff_clock_t* clock) {
+    atomic_fetch_add_explicit(&clock->sequence, 1, memory_order_release);
+}
+
+static void clock_load(const ff_clock_t* clock, ff_clock_state_t* state) {
+    state->pts = atomic_load_explicit(&clock->pts, memory_order_relaxed);
+    state->last_updated = atomic_load_explicit(&clock->last_updated, memory_order_relaxed);
+    state->speed = atomic_load_explicit(&clock->speed, memory_order_relaxed);
+    state->serial = atomic_load_explicit(&clock->serial, memory_order_relaxed);
+    state->paused = atomic_load_explicit(&clock->paused, memory_order_relaxed);
+}
+
+static void clock_store(ff_clock_t* clock, const int64_t pts, const int serial, const int64_t now) {
+    atomic_store_explicit(&clock->pts, pts, memory_order_relaxed);
+    atomic_store_explicit(&clock->last_updated, now, memory_order_relaxed);
+    atomic_store_explicit(&clock->serial, serial, memory_order_relaxed);
+}
+
+static int64_t clock_value_at(const ff_clock_t* clock, const ff_clock_state_t* state, const int64_t now) {
+    if (clock->queue_serial != NULL && *clock->queue_serial != state->serial) {
+        return FF_CLOCK_NOPTS;
+    }
+    if (state->pts == FF_CLOCK_NOPTS || state->paused) {
+        return state->pts;
+    }
+    // split to keep elapsed * speed from overflowing on long runs
+    const int64_t elapsed = now - state->last_updated;
+    const int64_t skew = state->speed - SPEED_ONE;
+    return state->pts + elapsed + elapsed / SPEED_ONE * skew + elapsed % SPEED_ONE * skew / SPEED_ONE;
+}
+
 void ff_clock_init(ff_clock_t* clock, const int *queue_serial) {
-    clock->speed = 1.0;
-    clock->paused = 0;
+    atomic_init(&clock->sequence, 0);
+    atomic_init(&clock->pts, FF_CLOCK_NOPTS);
+    atomic_init(&clock->last_updated, ff_clock_now());
+    atomic_init(&clock->speed, SPEED_ONE);
+    atomic_init(&clock->serial, -1);
+    atomic_init(&clock->paused, false);
     clock->queue_serial = queue_serial;
-    ff_clock_set(clock, NAN, -1);
 }
 
-double ff_clock_get(const ff_clock_t* clock) {
-    if (*clock->queue_serial != clock->serial) {
-        return NAN;
+void ff_clock_read(const ff_clock_t* clock, ff_clock_state_t* state) {
+    for (;;) {
+        const unsigned int sequence = atomic_load_explicit(&clock->sequence, memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        clock_load(clock, state);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&clock->sequence, memory_order_relaxed) == sequence) {
+            break;
+        }
     }
-    if (clock->paused) {
-        return clock->pts;
-    }
-    const double time = (double)av_gettime_relative() / 1000000.0;
-    return clock->pts_drift + time - (time - clock->last_updated) * (1.0 - clock->speed);
 }
 
-void ff_clock_set_at(ff_clock_t* clock, const double pts, const int serial, const double time) {
-    clock->pts = pts;
-    clock->last_updated = time;
-    clock->pts_drift = clock->pts - time;
-    clock->serial = serial;
+int64_t ff_clock_get_ns_at(const ff_clock_t* clock, const int64_t now) {
+    ff_clock_state_t state;
+    ff_clock_read(clock, &state);
+    return clock_value_at(clock, &state, now);
+}
+
+double ff_clock_get_at(const ff_clock_t* clock, const int64_t now) {
+    return ns_to_seconds(ff_clock_get_ns_at(clock, now));
+}
+
+double ff_clock_get(const ff_clock_t* clock) {
+    return ff_clock_get_at(clock, ff_clock_now());
+}
+
+double ff_clock_get_pts(const ff_clock_t* clock) {
+    ff_clock_state_t state;
+    ff_clock_read(clock, &state);
+    return ns_to_seconds(state.pts);
+}
+
+int ff_clock_get_serial(const ff_clock_t* clock) {
+    return atomic_load_explicit(&clock->serial, memory_order_relaxed);
+}
+
+double ff_clock_get_speed(const ff_clock_t* clock) {
+    return (double)atomic_load_explicit(&clock->speed, memory_order_relaxed) / SPEED_ONE;
+}
+
+void ff_clock_set_at(ff_clock_t* clock, const double pts, const int serial, const int64_t now) {
+    clock_write_begin(clock);
+    clock_store(clock, seconds_to_ns(pts), serial, now);
+    clock_write_end(clock);
 }
 
 void ff_clock_set(ff_clock_t* clock, const double pts, const int serial) {
-    const double time = (double)av_gettime_relative() / 1000000.0;
-    ff_clock_set_at(clock, pts, serial, time);
+    ff_clock_set_at(clock, pts, serial, ff_clock_now());
 }
 
 void ff_clock_set_speed(ff_clock_t* clock, const double speed) {
-    ff_clock_set(clock, ff_clock_get(clock), clock->serial);
-    clock->speed = speed;
+    const int64_t now = ff_clock_now();
+    clock_write_begin(clock);
+    ff_clock_state_t state;
+    clock_load(clock, &state);
+    clock_store(clock, clock_value_at(clock, &state, now), state.serial, now);
+    atomic_store_explicit(&clock->speed, llrint(speed * SPEED_ONE), memory_order_relaxed);
+    clock_write_end(clock);
 }
 
-void ff_clock_sync_to_slave(ff_clock_t* clock, const ff_clock_t* slave, const double no_sync_threshold) {
-    const double clock_val = ff_clock_get(clock);
-    const double slave_clock = ff_clock_get(slave);
-    if (!isnan(slave_clock) && (isnan(clock_val) || fabs(clock_val - slave_clock) > no_sync_threshold)) {
-        ff_clock_set(clock, slave_clock, slave->serial);
+void ff_clock_set_paused(ff_clock_t* clock, const bool paused) {
+    clock_write_begin(clock);
+    atomic_store_explicit(&clock->paused, paused, memory_order_relaxed);
+    clock_write_end(clock);
+}
+
+void ff_clock_sync_to_slave_at(ff_clock_t* clock, const ff_clock_t* slave, const double no_sync_threshold, const int64_t now) {
+    ff_clock_state_t slave_state;
+    ff_clock_read(slave, &slave_state);
+    const int64_t slave_clock = clock_value_at(slave, &slave_state, now);
+    if (slave_clock == FF_CLOCK_NOPTS) {
+        return;
+    }
+    const int64_t clock_val = ff_clock_get_ns_at(clock, now);
+    if (clock_val == FF_CLOCK_NOPTS || llabs(clock_val - slave_clock) > seconds_to_ns(no_sync_threshold)) {
+        clock_write_begin(clock);
+        clock_store(clock, slave_clock, slave_state.serial, now);
+        clock_write_end(clock);
     }
 }
+
+void ff_clock_sync_to_slave(ff_clock_t* clock, const ff_clock_t* slave, const double no_sync_threshold) {
+    ff_clock_sync_to_slave_at(clock, slave, no_sync_threshold, ff_clock_now());
+}
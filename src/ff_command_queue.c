@@ -0,0 +1,89 @@
+#include "ff_command_queue.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/error.h>
+
+typedef struct command_node {
+    _Atomic(struct command_node*) next;
+    max_align_t data[];
+} command_node_t;
+
+// intrusive multi-producer queue: producers swap themselves in at head and
+// then link the previous node, the consumer walks from tail; the stub node
+// keeps the list non-empty so neither side touches the other's end
+struct ff_command_queue {
+    _Atomic(command_node_t*) head;
+    command_node_t* tail;
+    command_node_t stub;
+    size_t item_size;
+};
+
+static void push_node(ff_command_queue_t* queue, command_node_t* node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    command_node_t* prev = atomic_exchange_explicit(&queue->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+ff_command_queue_t* ff_command_queue_create(const size_t item_size) {
+    ff_command_queue_t* queue = (ff_command_queue_t*)calloc(1, sizeof(ff_command_queue_t));
+    if (queue != NULL) {
+        atomic_init(&queue->stub.next, NULL);
+        atomic_init(&queue->head, &queue->stub);
+        queue->tail = &queue->stub;
+        queue->item_size = item_size;
+    }
+    return queue;
+}
+
+void ff_command_queue_destroy(ff_command_queue_t* queue) {
+    command_node_t* node = queue->tail;
+    while (node != NULL) {
+        command_node_t* next = atomic_load_explicit(&node->next, memory_order_acquire);
+        if (node != &queue->stub) {
+            free(node);
+        }
+        node = next;
+    }
+    free(queue);
+}
+
+int ff_command_queue_push(ff_command_queue_t* queue, const void* item) {
+    command_node_t* node = (command_node_t*)malloc(sizeof(command_node_t) + queue->item_size);
+    if (node == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    memcpy(node->data, item, queue->item_size);
+    push_node(queue, node);
+    return 0;
+}
+
+bool ff_command_queue_pop(ff_command_queue_t* queue, void* item) {
+    command_node_t* tail = queue->tail;
+    command_node_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return false;
+        }
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next == NULL) {
+        if (tail != atomic_load_explicit(&queue->head, memory_order_acquire)) {
+            return false;
+        }
+        // tail is the last node; put the stub behind it so it can be unlinked
+        push_node(queue, &queue->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (next == NULL) {
+            return false;
+        }
+    }
+    queue->tail = next;
+    memcpy(item, tail->data, queue->item_size);
+    free(tail);
+    return true;
+}
@@ -1,14 +1,26 @@
 #include "ff_decoder.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
 #include <libavutil/log.h>
+#include <libavutil/time.h>
 #include <libavcodec/avcodec.h>
 
 #include "ff_packet_queue.h"
+#include "ff_decoder_pool.h"
 #include "ff_frame.h"
 #include "ff_frame_queue.h"
+#include "ff_packet_inspect.h"
+
+enum {
+    SKIP_ESCALATE_FRAMES = 8,
+    // wall-clock time, since a high level decodes only a few frames
+    SKIP_RELAX_DELAY_US = 2 * 1000 * 1000,
+};
+
+#define SKIP_LATE_THRESHOLD 0.1
 
 struct ff_decoder {
     AVPacket* packet;
@@ -16,7 +28,8 @@ struct ff_decoder {
     ff_packet_queue_t* queue;
 
     int packet_serial;
-    int finished;
+    // also set from the video filter stage and read by the read thread
+    atomic_int finished;
     bool packet_pending;
 
     int64_t start_pts;
@@ -26,8 +39,27 @@ struct ff_decoder {
 
     cnd_t* empty_queue_cond;
     thrd_t thread;
+    bool thread_started;
+
+    mtx_t mutex;
+    cnd_t cond;
+    decoder_func_t func;
+    void* arg;
+    bool exit;
 
     bool reorder_pts;
+
+    // ff_decoder_skip_level_t, read by the host through ff_decoder_get_skip_level
+    atomic_int skip_level;
+    int late_count;
+    int64_t on_time_start;
+
+    bool drop_disposable;
+    // read by the host through ff_decoder_get_dropped_packets
+    atomic_llong dropped_packets;
+
+    ff_decoder_pool_t* pool;
+    bool eof_pending;
 };
 
 ff_decoder_t* ff_decoder_create(
@@ -40,21 +72,67 @@ ff_decoder_t* ff_decoder_create(
     if (decoder != NULL) {
         decoder->packet = av_packet_alloc();
         if (decoder->packet != NULL) {
-            decoder->codec_context = decoder_context;
-            decoder->queue = queue;
-            decoder->empty_queue_cond = empty_queue_cond;
-            decoder->start_pts = AV_NOPTS_VALUE;
-            decoder->packet_serial = -1;
-            decoder->reorder_pts = reorder_pts;
+            if (mtx_init(&decoder->mutex, mtx_plain) == thrd_success) {
+                if (cnd_init(&decoder->cond) == thrd_success) {
+                    decoder->codec_context = decoder_context;
+                    decoder->queue = queue;
+                    decoder->empty_queue_cond = empty_queue_cond;
+                    decoder->start_pts = AV_NOPTS_VALUE;
+                    decoder->packet_serial = -1;
+                    decoder->reorder_pts = reorder_pts;
+                    decoder->on_time_start = AV_NOPTS_VALUE;
 
-            return decoder;
+                    return decoder;
+                }
+                mtx_destroy(&decoder->mutex);
+            }
+            av_packet_free(&decoder->packet);
         }
         free(decoder);
     }
     return NULL;
 }
 
+static int decoder_thread(void* arg) {
+    ff_decoder_t* decoder = arg;
+
+    mtx_lock(&decoder->mutex);
+    for (;;) {
+        while (decoder->func == NULL && !decoder->exit) {
+            cnd_wait(&decoder->cond, &decoder->mutex);
+        }
+        if (decoder->exit) {
+            break;
+        }
+        const decoder_func_t func = decoder->func;
+        void* func_arg = decoder->arg;
+        mtx_unlock(&decoder->mutex);
+
+        func(func_arg);
+
+        mtx_lock(&decoder->mutex);
+        decoder->func = NULL;
+        cnd_broadcast(&decoder->cond);
+    }
+    mtx_unlock(&decoder->mutex);
+
+    return 0;
+}
+
 void ff_decoder_destroy(ff_decoder_t* decoder) {
+    if (decoder->thread_started) {
+        mtx_lock(&decoder->mutex);
+        decoder->exit = true;
+        cnd_broadcast(&decoder->cond);
+        mtx_unlock(&decoder->mutex);
+
+        thrd_join(decoder->thread, NULL);
+    }
+    if (decoder->pool != NULL) {
+        ff_decoder_pool_destroy(decoder->pool);
+    }
+    cnd_destroy(&decoder->cond);
+    mtx_destroy(&decoder->mutex);
     av_packet_free(&decoder->packet);
     avcodec_free_context(&decoder->codec_context);
     free(decoder);
@@ -62,22 +140,164 @@ void ff_decoder_destroy(ff_decoder_t* decoder) {
 
 int ff_decoder_start(ff_decoder_t* decoder, const decoder_func_t decoder_func, void* arg) {
     ff_packet_queue_start(decoder->queue);
-    const int ret = thrd_create(&decoder->thread, decoder_func, arg);
-    if (ret != thrd_success) {
-        return AVERROR(ENOMEM);
+
+    mtx_lock(&decoder->mutex);
+    decoder->func = decoder_func;
+    decoder->arg = arg;
+    cnd_broadcast(&decoder->cond);
+    mtx_unlock(&decoder->mutex);
+
+    if (!decoder->thread_started) {
+        if (thrd_create(&decoder->thread, decoder_thread, decoder) != thrd_success) {
+            decoder->func = NULL;
+            return AVERROR(ENOMEM);
+        }
+        decoder->thread_started = true;
     }
     return 0;
 }
 
-void ff_decoder_abort(const ff_decoder_t* decoder, ff_frame_queue_t* frame_queue) {
+void ff_decoder_abort(ff_decoder_t* decoder, ff_frame_queue_t* frame_queue) {
     ff_packet_queue_abort(decoder->queue);
     ff_frame_queue_signal(frame_queue);
 
-    thrd_join(decoder->thread, NULL);
+    mtx_lock(&decoder->mutex);
+    while (decoder->func != NULL) {
+        cnd_wait(&decoder->cond, &decoder->mutex);
+    }
+    mtx_unlock(&decoder->mutex);
+
     ff_packet_queue_flush(decoder->queue);
 }
 
-int ff_decoder_decode(ff_decoder_t* decoder, AVFrame* frame) {
+static void decoder_apply_skip_level(ff_decoder_t* decoder, const ff_decoder_skip_level_t level) {
+    decoder->skip_level = level;
+    decoder->late_count = 0;
+    decoder->on_time_start = AV_NOPTS_VALUE;
+
+    AVCodecContext* codec_context = decoder->codec_context;
+    codec_context->skip_loop_filter = level >= FF_DECODER_SKIP_LOOP_FILTER ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+    switch (level) {
+    case FF_DECODER_SKIP_NONKEY:
+        codec_context->skip_frame = AVDISCARD_NONKEY;
+        break;
+    case FF_DECODER_SKIP_NONREF:
+        codec_context->skip_frame = AVDISCARD_NONREF;
+        break;
+    default:
+        codec_context->skip_frame = AVDISCARD_DEFAULT;
+        break;
+    }
+    if (decoder->pool != NULL) {
+        ff_decoder_pool_set_discard(decoder->pool, codec_context->skip_frame, codec_context->skip_loop_filter);
+    }
+}
+
+void ff_decoder_rebind(ff_decoder_t* decoder, ff_packet_queue_t* queue) {
+    avcodec_flush_buffers(decoder->codec_context);
+    av_packet_unref(decoder->packet);
+
+    decoder->queue = queue;
+    decoder->packet_serial = -1;
+    decoder->finished = 0;
+    decoder->packet_pending = false;
+    decoder->start_pts = AV_NOPTS_VALUE;
+    decoder->next_pts = AV_NOPTS_VALUE;
+    decoder->drop_disposable = false;
+    decoder->eof_pending = false;
+    if (decoder->pool != NULL) {
+        ff_decoder_pool_flush(decoder->pool);
+    }
+
+    decoder_apply_skip_level(decoder, FF_DECODER_SKIP_NONE);
+}
+
+static int attach_packet_data(AVPacket* packet, const int serial) {
+    if (packet->buf != NULL && packet->opaque_ref == NULL) {
+        packet->opaque_ref = av_buffer_allocz(sizeof(ff_frame_data_t));
+        if (packet->opaque_ref == NULL) {
+            return AVERROR(ENOMEM);
+        }
+        ff_frame_data_t* frame_data = (ff_frame_data_t*)packet->opaque_ref->data;
+        frame_data->pkt_pos = packet->pos;
+        frame_data->serial = serial;
+    }
+    return 0;
+}
+
+static int decoder_decode_parallel(ff_decoder_t* decoder, AVFrame* frame) {
+    bool wait = false;
+    for (;;) {
+        if (ff_packet_queue_get_aborted(decoder->queue)) {
+            return -1;
+        }
+        int ret = ff_decoder_pool_receive(decoder->pool, frame, wait);
+        if (ret >= 0) {
+            if (decoder->reorder_pts) {
+                frame->pts = frame->best_effort_timestamp;
+            } else {
+                frame->pts = frame->pkt_dts;
+            }
+            return 1;
+        }
+        wait = false;
+        if (ret != AVERROR(EAGAIN)) {
+            continue;
+        }
+        const int pending = ff_decoder_pool_get_pending(decoder->pool);
+        if (decoder->eof_pending) {
+            if (pending == 0) {
+                decoder->eof_pending = false;
+                decoder->finished = decoder->packet_serial;
+                return 0;
+            }
+            wait = true;
+            continue;
+        }
+        if (!ff_decoder_pool_can_submit(decoder->pool)) {
+            wait = true;
+            continue;
+        }
+        if (ff_packet_queue_get_packet_count(decoder->queue) == 0) {
+            cnd_signal(decoder->empty_queue_cond);
+        }
+        const int old_serial = decoder->packet_serial;
+        ret = ff_packet_queue_get(decoder->queue, decoder->packet, pending == 0, &decoder->packet_serial);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            wait = true;
+            continue;
+        }
+        if (old_serial != decoder->packet_serial) {
+            ff_decoder_pool_flush(decoder->pool);
+            decoder->drop_disposable = false;
+            decoder->finished = 0;
+            decoder_apply_skip_level(decoder, FF_DECODER_SKIP_NONE);
+        }
+        if (ff_packet_queue_get_serial(decoder->queue) != decoder->packet_serial) {
+            av_packet_unref(decoder->packet);
+            continue;
+        }
+        if (decoder->packet->data == NULL) {
+            decoder->eof_pending = true;
+            continue;
+        }
+        if (decoder->drop_disposable && ff_packet_is_disposable(decoder->codec_context, decoder->packet)) {
+            ++decoder->dropped_packets;
+            av_packet_unref(decoder->packet);
+            continue;
+        }
+        ret = attach_packet_data(decoder->packet, decoder->packet_serial);
+        if (ret < 0) {
+            return ret;
+        }
+        ff_decoder_pool_submit(decoder->pool, decoder->packet, false);
+    }
+}
+
+static int decoder_decode(ff_decoder_t* decoder, AVFrame* frame, AVSubtitle* sub) {
     int ret = AVERROR(EAGAIN);
 
     for (;;)
@@ -140,34 +360,60 @@ int ff_decoder_decode(ff_decoder_t* decoder, AVFrame* frame) {
                 }
                 if (old_serial != decoder->packet_serial) {
                     avcodec_flush_buffers(decoder->codec_context);
+                    decoder->drop_disposable = false;
                     decoder->finished = 0;
+                    decoder_apply_skip_level(decoder, FF_DECODER_SKIP_NONE);
                     decoder->next_pts = decoder->start_pts;
                     decoder->next_pts_tb = decoder->start_pts_time_base;
                 }
             }
             if (ff_packet_queue_get_serial(decoder->queue) == decoder->packet_serial) {
-                break;
+                if (!decoder->drop_disposable || decoder->packet->data == NULL ||
+                    !ff_packet_is_disposable(decoder->codec_context, decoder->packet)) {
+                    break;
+                }
+                ++decoder->dropped_packets;
             }
             av_packet_unref(decoder->packet);
         } while (true);
 
-        if (decoder->packet->buf != NULL && decoder->packet->opaque_ref == NULL) {
-            decoder->packet->opaque_ref = av_buffer_allocz(sizeof(ff_frame_data_t));
-            if (decoder->packet->opaque_ref == NULL) {
-                return AVERROR(ENOMEM);
+        if (decoder->codec_context->codec_type == AVMEDIA_TYPE_SUBTITLE) {
+            int got_frame = 0;
+            ret = avcodec_decode_subtitle2(decoder->codec_context, sub, &got_frame, decoder->packet);
+            if (ret < 0) {
+                ret = AVERROR(EAGAIN);
+            } else {
+                if (got_frame && decoder->packet->data == NULL) {
+                    decoder->packet_pending = true;
+                }
+                ret = got_frame ? 0 : (decoder->packet->data != NULL ? AVERROR(EAGAIN) : AVERROR_EOF);
             }
-            ff_frame_data_t* frame_data = (ff_frame_data_t*)decoder->packet->opaque_ref->data;
-            frame_data->pkt_pos = decoder->packet->pos;
-        }
-        if (avcodec_send_packet(decoder->codec_context, decoder->packet) == AVERROR(EAGAIN)) {
-            av_log(decoder->codec_context, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
-            decoder->packet_pending = true;
-        } else {
             av_packet_unref(decoder->packet);
+        } else {
+            if (attach_packet_data(decoder->packet, decoder->packet_serial) < 0) {
+                return AVERROR(ENOMEM);
+            }
+            if (avcodec_send_packet(decoder->codec_context, decoder->packet) == AVERROR(EAGAIN)) {
+                av_log(decoder->codec_context, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
+                decoder->packet_pending = true;
+            } else {
+                av_packet_unref(decoder->packet);
+            }
         }
     }
 }
 
+int ff_decoder_decode(ff_decoder_t* decoder, AVFrame* frame) {
+    if (decoder->pool != NULL) {
+        return decoder_decode_parallel(decoder, frame);
+    }
+    return decoder_decode(decoder, frame, NULL);
+}
+
+int ff_decoder_decode_subtitle(ff_decoder_t* decoder, AVSubtitle* sub) {
+    return decoder_decode(decoder, NULL, sub);
+}
+
 const AVCodecContext* ff_decoder_get_codec_context(const ff_decoder_t* decoder) {
     return decoder->codec_context;
 }
@@ -180,11 +426,61 @@ int ff_decoder_get_finished(const ff_decoder_t* decoder) {
     return decoder->finished;
 }
 
-void ff_decoder_set_finished(ff_decoder_t* decoder) {
-    decoder->finished = decoder->packet_serial;
+void ff_decoder_set_finished(ff_decoder_t* decoder, const int serial) {
+    decoder->finished = serial;
 }
 
 void ff_decoder_set_start_pts(ff_decoder_t* decoder, const int64_t pts, const AVRational time_base) {
     decoder->start_pts = pts;
     decoder->start_pts_time_base = time_base;
-}
\ No newline at end of file
+}
+
+ff_decoder_skip_level_t ff_decoder_update_skip_level(ff_decoder_t* decoder, const double lateness) {
+    if (lateness > SKIP_LATE_THRESHOLD) {
+        decoder->on_time_start = AV_NOPTS_VALUE;
+        if (++decoder->late_count >= SKIP_ESCALATE_FRAMES && decoder->skip_level < FF_DECODER_SKIP_NONKEY) {
+            decoder_apply_skip_level(decoder, decoder->skip_level + 1);
+            av_log(decoder->codec_context, AV_LOG_VERBOSE, "Video is %.3fs late, raising skip level to %d\n", lateness, decoder->skip_level);
+        }
+    } else if (lateness <= 0) {
+        decoder->late_count = 0;
+        const int64_t now = av_gettime_relative();
+        if (decoder->on_time_start == AV_NOPTS_VALUE) {
+            decoder->on_time_start = now;
+        }
+        if (now - decoder->on_time_start >= SKIP_RELAX_DELAY_US && decoder->skip_level > FF_DECODER_SKIP_NONE) {
+            decoder_apply_skip_level(decoder, decoder->skip_level - 1);
+            av_log(decoder->codec_context, AV_LOG_VERBOSE, "Video caught up, lowering skip level to %d\n", decoder->skip_level);
+        }
+    }
+    return decoder->skip_level;
+}
+
+ff_decoder_skip_level_t ff_decoder_get_skip_level(const ff_decoder_t* decoder) {
+    return decoder->skip_level;
+}
+
+void ff_decoder_set_drop_disposable(ff_decoder_t* decoder, const bool drop_disposable) {
+    decoder->drop_disposable = drop_disposable;
+}
+
+int64_t ff_decoder_get_dropped_packets(const ff_decoder_t* decoder) {
+    return decoder->dropped_packets;
+}
+
+int ff_decoder_set_parallel(ff_decoder_t* decoder, const int nb_workers) {
+    const AVCodecContext* codec_context = decoder->codec_context;
+    const AVCodecDescriptor* descriptor = avcodec_descriptor_get(codec_context->codec_id);
+    if (decoder->pool != NULL || nb_workers < 2 ||
+        codec_context->codec_type != AVMEDIA_TYPE_VIDEO ||
+        descriptor == NULL || !(descriptor->props & AV_CODEC_PROP_INTRA_ONLY)) {
+        return 0;
+    }
+    decoder->pool = ff_decoder_pool_create(codec_context, nb_workers);
+    if (decoder->pool == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    av_log(decoder->codec_context, AV_LOG_VERBOSE, "Decoding intra-only video on %d contexts\n", nb_workers);
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "ff_decoder_cache.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/mem.h>
+
+#ifdef HAVE_THREAD_H
+#include "thread.h"
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#include "ff_decoder.h"
+
+typedef struct decoder_cache_entry {
+    ff_decoder_t* decoder;
+    AVCodecParameters* codecpar;
+    char* codec_name;
+    AVDictionary* codec_opts;
+    int lowres;
+    bool fast;
+    bool reorder_pts;
+} decoder_cache_entry_t;
+
+struct ff_decoder_cache {
+    decoder_cache_entry_t* entries;
+    int entry_count;
+    int capacity;
+
+    mtx_t mutex;
+};
+
+static bool codec_parameters_match(const AVCodecParameters* a, const AVCodecParameters* b) {
+    if (a->codec_type != b->codec_type ||
+        a->codec_id != b->codec_id ||
+        a->codec_tag != b->codec_tag ||
+        a->format != b->format ||
+        a->profile != b->profile ||
+        a->extradata_size != b->extradata_size ||
+        (a->extradata_size > 0 && memcmp(a->extradata, b->extradata, (size_t)a->extradata_size) != 0)) {
+        return false;
+    }
+    switch (a->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+        return a->sample_rate == b->sample_rate &&
+               av_channel_layout_compare(&a->ch_layout, &b->ch_layout) == 0;
+    case AVMEDIA_TYPE_VIDEO:
+    case AVMEDIA_TYPE_SUBTITLE:
+        return a->width == b->width && a->height == b->height;
+    default:
+        return true;
+    }
+}
+
+static bool dictionaries_match(const AVDictionary* a, const AVDictionary* b) {
+    if (av_dict_count(a) != av_dict_count(b)) {
+        return false;
+    }
+    const AVDictionaryEntry* entry = NULL;
+    while ((entry = av_dict_iterate(a, entry)) != NULL) {
+        const AVDictionaryEntry* other = av_dict_get(b, entry->key, NULL, AV_DICT_MATCH_CASE);
+        if (other == NULL || strcmp(entry->value, other->value) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool key_match(const decoder_cache_entry_t* entry, const ff_decoder_cache_key_t* key) {
+    const bool names_match = entry->codec_name == NULL || key->codec_name == NULL ?
+        entry->codec_name == key->codec_name :
+        strcmp(entry->codec_name, key->codec_name) == 0;
+    return names_match &&
+           entry->lowres == key->lowres &&
+           entry->fast == key->fast &&
+           entry->reorder_pts == key->reorder_pts &&
+           dictionaries_match(entry->codec_opts, key->codec_opts) &&
+           codec_parameters_match(entry->codecpar, key->codecpar);
+}
+
+static void decoder_cache_entry_free(decoder_cache_entry_t* entry) {
+    avcodec_parameters_free(&entry->codecpar);
+    av_freep(&entry->codec_name);
+    av_dict_free(&entry->codec_opts);
+}
+
+static void decoder_cache_remove(ff_decoder_cache_t* cache, const int index) {
+    decoder_cache_entry_free(&cache->entries[index]);
+    memmove(
+        cache->entries + index,
+        cache->entries + index + 1,
+        (size_t)(cache->entry_count - index - 1) * sizeof(decoder_cache_entry_t)
+    );
+    --cache->entry_count;
+}
+
+ff_decoder_cache_t* ff_decoder_cache_create(const int capacity) {
+    ff_decoder_cache_t* cache = (ff_decoder_cache_t*)calloc(1, sizeof(ff_decoder_cache_t));
+    if (cache != NULL) {
+        cache->entries = (decoder_cache_entry_t*)calloc((size_t)capacity, sizeof(decoder_cache_entry_t));
+        if (cache->entries != NULL) {
+            if (mtx_init(&cache->mutex, mtx_plain) == thrd_success) {
+                cache->capacity = capacity;
+                return cache;
+            }
+            free(cache->entries);
+        }
+        free(cache);
+    }
+    return NULL;
+}
+
+void ff_decoder_cache_destroy(ff_decoder_cache_t* cache) {
+    for (int i = 0; i < cache->entry_count; ++i) {
+        ff_decoder_destroy(cache->entries[i].decoder);
+        decoder_cache_entry_free(&cache->entries[i]);
+    }
+    mtx_destroy(&cache->mutex);
+    free(cache->entries);
+    free(cache);
+}
+
+void ff_decoder_cache_put(ff_decoder_cache_t* cache, ff_decoder_t* decoder, const ff_decoder_cache_key_t* key) {
+    decoder_cache_entry_t entry = {
+        .decoder = decoder,
+        .codecpar = avcodec_parameters_alloc(),
+        .lowres = key->lowres,
+        .fast = key->fast,
+        .reorder_pts = key->reorder_pts
+    };
+    if (entry.codecpar == NULL || cache->capacity == 0 ||
+        avcodec_parameters_copy(entry.codecpar, key->codecpar) < 0 ||
+        (key->codec_name != NULL && (entry.codec_name = av_strdup(key->codec_name)) == NULL) ||
+        av_dict_copy(&entry.codec_opts, key->codec_opts, 0) < 0) {
+        decoder_cache_entry_free(&entry);
+        ff_decoder_destroy(decoder);
+        return;
+    }
+    mtx_lock(&cache->mutex);
+    if (cache->entry_count == cache->capacity) {
+        ff_decoder_destroy(cache->entries[0].decoder);
+        decoder_cache_remove(cache, 0);
+    }
+    cache->entries[cache->entry_count++] = entry;
+    mtx_unlock(&cache->mutex);
+}
+
+ff_decoder_t* ff_decoder_cache_take(ff_decoder_cache_t* cache, const ff_decoder_cache_key_t* key) {
+    ff_decoder_t* decoder = NULL;
+
+    mtx_lock(&cache->mutex);
+    for (int i = cache->entry_count - 1; i >= 0; --i) {
+        if (key_match(&cache->entries[i], key)) {
+            decoder = cache->entries[i].decoder;
+            decoder_cache_remove(cache, i);
+            break;
+        }
+    }
+    mtx_unlock(&cache->mutex);
+
+    return decoder;
+}
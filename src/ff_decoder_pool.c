@@ -0,0 +1,301 @@
+#include "ff_decoder_pool.h"
+
+#include <stdlib.h>
+
+#include <libavutil/macros.h>
+
+#ifdef HAVE_THREAD_H
+#include "thread.h"
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+enum {
+    DECODER_POOL_MAX_JOBS = 16,
+    DECODER_POOL_WAIT_NS = 10 * 1000 * 1000,
+};
+
+typedef enum decoder_job_state {
+    DECODER_JOB_FREE = 0,
+    DECODER_JOB_QUEUED,
+    DECODER_JOB_BUSY,
+    DECODER_JOB_DONE
+} decoder_job_state_t;
+
+typedef struct decoder_job {
+    AVPacket* packet;
+    AVFrame* frame;
+    decoder_job_state_t state;
+    bool drain;
+    int result;
+} decoder_job_t;
+
+typedef struct decoder_worker {
+    ff_decoder_pool_t* pool;
+    AVCodecContext* codec_context;
+    thrd_t thread;
+    bool thread_started;
+} decoder_worker_t;
+
+struct ff_decoder_pool {
+    decoder_job_t jobs[DECODER_POOL_MAX_JOBS];
+    int job_count;
+    int head;
+    int tail;
+    int dispatch;
+    int pending;
+
+    decoder_worker_t* workers;
+    int nb_workers;
+    bool exit;
+
+    enum AVDiscard skip_frame;
+    enum AVDiscard skip_loop_filter;
+
+    mtx_t mutex;
+    cnd_t work_cond;
+    cnd_t done_cond;
+};
+
+static int decoder_worker_thread(void* arg) {
+    decoder_worker_t* worker = arg;
+    ff_decoder_pool_t* pool = worker->pool;
+
+    mtx_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->exit && pool->jobs[pool->dispatch].state != DECODER_JOB_QUEUED) {
+            cnd_wait(&pool->work_cond, &pool->mutex);
+        }
+        if (pool->exit) {
+            break;
+        }
+        decoder_job_t* job = &pool->jobs[pool->dispatch];
+        pool->dispatch = (pool->dispatch + 1) % pool->job_count;
+        job->state = DECODER_JOB_BUSY;
+        worker->codec_context->skip_frame = pool->skip_frame;
+        worker->codec_context->skip_loop_filter = pool->skip_loop_filter;
+        mtx_unlock(&pool->mutex);
+
+        int ret = avcodec_send_packet(worker->codec_context, job->packet);
+        if (ret >= 0 && job->drain) {
+            ret = avcodec_send_packet(worker->codec_context, NULL);
+        }
+        if (ret >= 0) {
+            ret = avcodec_receive_frame(worker->codec_context, job->frame);
+        }
+        if (job->drain) {
+            avcodec_flush_buffers(worker->codec_context);
+        }
+        av_packet_unref(job->packet);
+
+        mtx_lock(&pool->mutex);
+        job->result = ret;
+        job->state = DECODER_JOB_DONE;
+        cnd_broadcast(&pool->done_cond);
+    }
+    mtx_unlock(&pool->mutex);
+
+    return 0;
+}
+
+static AVCodecContext* decoder_worker_context_create(const AVCodecContext* src) {
+    AVCodecContext* codec_context = avcodec_alloc_context3(src->codec);
+    if (codec_context != NULL) {
+        AVCodecParameters* codecpar = avcodec_parameters_alloc();
+        if (codecpar != NULL) {
+            int ret = avcodec_parameters_from_context(codecpar, src);
+            if (ret >= 0) {
+                ret = avcodec_parameters_to_context(codec_context, codecpar);
+            }
+            avcodec_parameters_free(&codecpar);
+            if (ret >= 0) {
+                codec_context->pkt_timebase = src->pkt_timebase;
+                codec_context->flags = src->flags;
+                codec_context->flags2 = src->flags2;
+                codec_context->lowres = src->lowres;
+                codec_context->skip_frame = src->skip_frame;
+                codec_context->skip_loop_filter = src->skip_loop_filter;
+                codec_context->thread_count = 1;
+                if (avcodec_open2(codec_context, src->codec, NULL) >= 0) {
+                    return codec_context;
+                }
+            }
+        }
+        avcodec_free_context(&codec_context);
+    }
+    return NULL;
+}
+
+static void decoder_pool_free(ff_decoder_pool_t* pool) {
+    mtx_lock(&pool->mutex);
+    pool->exit = true;
+    cnd_broadcast(&pool->work_cond);
+    mtx_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->nb_workers; ++i) {
+        decoder_worker_t* worker = &pool->workers[i];
+        if (worker->thread_started) {
+            thrd_join(worker->thread, NULL);
+        }
+        avcodec_free_context(&worker->codec_context);
+    }
+    free(pool->workers);
+    for (int i = 0; i < pool->job_count; ++i) {
+        av_packet_free(&pool->jobs[i].packet);
+        av_frame_free(&pool->jobs[i].frame);
+    }
+    cnd_destroy(&pool->done_cond);
+    cnd_destroy(&pool->work_cond);
+    mtx_destroy(&pool->mutex);
+    free(pool);
+}
+
+ff_decoder_pool_t* ff_decoder_pool_create(const AVCodecContext* codec_context, const int nb_workers) {
+    ff_decoder_pool_t* pool = (ff_decoder_pool_t*)calloc(1, sizeof(ff_decoder_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    if (mtx_init(&pool->mutex, mtx_plain) != thrd_success) {
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->work_cond) != thrd_success) {
+        mtx_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->done_cond) != thrd_success) {
+        cnd_destroy(&pool->work_cond);
+        mtx_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+    pool->workers = (decoder_worker_t*)calloc((size_t)nb_workers, sizeof(decoder_worker_t));
+    if (pool->workers == NULL) {
+        decoder_pool_free(pool);
+        return NULL;
+    }
+    pool->skip_frame = codec_context->skip_frame;
+    pool->skip_loop_filter = codec_context->skip_loop_filter;
+    pool->job_count = FFMIN(2 * nb_workers, DECODER_POOL_MAX_JOBS);
+    for (int i = 0; i < pool->job_count; ++i) {
+        decoder_job_t* job = &pool->jobs[i];
+        job->packet = av_packet_alloc();
+        job->frame = av_frame_alloc();
+        if (job->packet == NULL || job->frame == NULL) {
+            decoder_pool_free(pool);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < nb_workers; ++i) {
+        decoder_worker_t* worker = &pool->workers[pool->nb_workers++];
+        worker->pool = pool;
+        worker->codec_context = decoder_worker_context_create(codec_context);
+        if (worker->codec_context == NULL) {
+            decoder_pool_free(pool);
+            return NULL;
+        }
+        if (thrd_create(&worker->thread, decoder_worker_thread, worker) != thrd_success) {
+            decoder_pool_free(pool);
+            return NULL;
+        }
+        worker->thread_started = true;
+    }
+    return pool;
+}
+
+void ff_decoder_pool_destroy(ff_decoder_pool_t* pool) {
+    decoder_pool_free(pool);
+}
+
+bool ff_decoder_pool_can_submit(ff_decoder_pool_t* pool) {
+    mtx_lock(&pool->mutex);
+    const bool can_submit = pool->pending < pool->job_count;
+    mtx_unlock(&pool->mutex);
+
+    return can_submit;
+}
+
+int ff_decoder_pool_get_pending(ff_decoder_pool_t* pool) {
+    mtx_lock(&pool->mutex);
+    const int pending = pool->pending;
+    mtx_unlock(&pool->mutex);
+
+    return pending;
+}
+
+void ff_decoder_pool_submit(ff_decoder_pool_t* pool, AVPacket* packet, const bool drain) {
+    mtx_lock(&pool->mutex);
+    decoder_job_t* job = &pool->jobs[pool->tail];
+    av_packet_move_ref(job->packet, packet);
+    job->drain = drain;
+    job->state = DECODER_JOB_QUEUED;
+    pool->tail = (pool->tail + 1) % pool->job_count;
+    ++pool->pending;
+    cnd_signal(&pool->work_cond);
+    mtx_unlock(&pool->mutex);
+}
+
+int ff_decoder_pool_receive(ff_decoder_pool_t* pool, AVFrame* frame, const bool wait) {
+    int ret = AVERROR(EAGAIN);
+
+    mtx_lock(&pool->mutex);
+    decoder_job_t* job = &pool->jobs[pool->head];
+    if (wait && pool->pending > 0 && job->state != DECODER_JOB_DONE) {
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        ts.tv_nsec += DECODER_POOL_WAIT_NS;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        cnd_timedwait(&pool->done_cond, &pool->mutex, &ts);
+    }
+    if (pool->pending > 0 && job->state == DECODER_JOB_DONE) {
+        ret = job->result;
+        if (ret >= 0) {
+            av_frame_move_ref(frame, job->frame);
+        } else {
+            av_frame_unref(job->frame);
+        }
+        job->state = DECODER_JOB_FREE;
+        pool->head = (pool->head + 1) % pool->job_count;
+        --pool->pending;
+        if (ret == AVERROR(EAGAIN)) {
+            ret = AVERROR_INVALIDDATA;
+        }
+    }
+    mtx_unlock(&pool->mutex);
+
+    return ret;
+}
+
+void ff_decoder_pool_flush(ff_decoder_pool_t* pool) {
+    mtx_lock(&pool->mutex);
+    for (int i = 0; i < pool->job_count; ++i) {
+        while (pool->jobs[i].state == DECODER_JOB_BUSY) {
+            cnd_wait(&pool->done_cond, &pool->mutex);
+        }
+    }
+    for (int i = 0; i < pool->job_count; ++i) {
+        decoder_job_t* job = &pool->jobs[i];
+        av_packet_unref(job->packet);
+        av_frame_unref(job->frame);
+        job->state = DECODER_JOB_FREE;
+    }
+    for (int i = 0; i < pool->nb_workers; ++i) {
+        avcodec_flush_buffers(pool->workers[i].codec_context);
+    }
+    pool->head = 0;
+    pool->tail = 0;
+    pool->dispatch = 0;
+    pool->pending = 0;
+    mtx_unlock(&pool->mutex);
+}
+
+void ff_decoder_pool_set_discard(ff_decoder_pool_t* pool, const enum AVDiscard skip_frame, const enum AVDiscard skip_loop_filter) {
+    mtx_lock(&pool->mutex);
+    pool->skip_frame = skip_frame;
+    pool->skip_loop_filter = skip_loop_filter;
+    mtx_unlock(&pool->mutex);
+}
@@ -1,9 +1,11 @@
 #include "ff_frame_queue.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/macros.h>
+#include <libavutil/mem.h>
 
 #ifdef HAVE_THREAD_H
 #include "thread.h"
@@ -14,12 +16,20 @@
 #include "ff_frame.h"
 #include "ff_packet_queue.h"
 
+enum {
+    FF_FRAME_UPLOAD_NONE,
+    FF_FRAME_UPLOAD_BUSY,
+    FF_FRAME_UPLOAD_DONE,
+};
+
 enum {
     FF_FRAME_QUEUE_SIZE = FFMAX(FF_SAMPLE_QUEUE_SIZE, FFMAX(FF_VIDEO_PICTURE_QUEUE_SIZE, FF_SUBPICTURE_QUEUE_SIZE))
 };
 
 struct ff_frame_queue {
     ff_frame_t frames[FF_FRAME_QUEUE_SIZE];
+    // per-slot upload state, kept out of ff_frame_t since the header is used from C++
+    atomic_int upload_states[FF_FRAME_QUEUE_SIZE];
     int rindex;
     int windex;
     int size;
@@ -29,9 +39,22 @@ struct ff_frame_queue {
 
     mtx_t mutex;
     cnd_t cond;
+    // kept apart from cond so an upload waiter never takes a wakeup meant
+    // for the producer or the consumer
+    cnd_t upload_cond;
     ff_packet_queue_t* packet_queue;
 };
 
+static void frame_queue_unref_item(ff_frame_t* frame) {
+    av_frame_unref(frame->base);
+    avsubtitle_free(&frame->sub);
+    for (int i = 0; i < frame->nb_sub_rects; ++i) {
+        av_free(frame->sub_rects[i].data);
+    }
+    av_freep(&frame->sub_rects);
+    frame->nb_sub_rects = 0;
+}
+
 ff_frame_queue_t* ff_frame_queue_create(ff_packet_queue_t* packet_queue, const int max_size, const bool keep_last) {
     ff_frame_queue_t* queue = (ff_frame_queue_t*)calloc(1, sizeof(ff_frame_queue_t));
     if (queue != NULL) {
@@ -39,20 +62,24 @@ ff_frame_queue_t* ff_frame_queue_create(ff_packet_queue_t* packet_queue, const i
         if (ret == thrd_success) {
             ret = cnd_init(&queue->cond);
             if (ret == thrd_success) {
-                queue->max_size = FFMIN(max_size, FF_FRAME_QUEUE_SIZE);
-                for (int i = 0;; ++i) {
-                    if (i == queue->max_size) {
-                        queue->packet_queue = packet_queue;
-                        queue->keep_last = keep_last;
-
-                        return queue;
-                    }
-                    if ((queue->frames[i].base = av_frame_alloc()) == NULL) {
-                        for(int j = 0; j < i; ++j) {
-                            av_frame_free(&queue->frames[j].base);
+                ret = cnd_init(&queue->upload_cond);
+                if (ret == thrd_success) {
+                    queue->max_size = FFMIN(max_size, FF_FRAME_QUEUE_SIZE);
+                    for (int i = 0;; ++i) {
+                        if (i == queue->max_size) {
+                            queue->packet_queue = packet_queue;
+                            queue->keep_last = keep_last;
+
+                            return queue;
+                        }
+                        if ((queue->frames[i].base = av_frame_alloc()) == NULL) {
+                            for(int j = 0; j < i; ++j) {
+                                av_frame_free(&queue->frames[j].base);
+                            }
+                            break;
                         }
-                        break;
                     }
+                    cnd_destroy(&queue->upload_cond);
                 }
                 cnd_destroy(&queue->cond);
             }
@@ -66,11 +93,12 @@ ff_frame_queue_t* ff_frame_queue_create(ff_packet_queue_t* packet_queue, const i
 void ff_frame_queue_destroy(ff_frame_queue_t* queue) {
     for (int i = 0; i < queue->max_size; ++i) {
         ff_frame_t* frame = queue->frames + i;
-        av_frame_unref(frame->base);
+        frame_queue_unref_item(frame);
         av_frame_free(&frame->base);
     }
     mtx_destroy(&queue->mutex);
     cnd_destroy(&queue->cond);
+    cnd_destroy(&queue->upload_cond);
     free(queue);
 }
 
@@ -96,6 +124,16 @@ ff_frame_t* ff_frame_queue_peek_next(ff_frame_queue_t* queue) {
     return queue->frames + (queue->rindex + queue->rindex_shown + 1) % queue->max_size;
 }
 
+ff_frame_t* ff_frame_queue_peek_nth(ff_frame_queue_t* queue, const int n) {
+    mtx_lock(&queue->mutex);
+    const int remaining = queue->size - queue->rindex_shown;
+    mtx_unlock(&queue->mutex);
+    if (n < 0 || n >= remaining) {
+        return NULL;
+    }
+    return queue->frames + (queue->rindex + queue->rindex_shown + n) % queue->max_size;
+}
+
 ff_frame_t* ff_frame_queue_peek_last(ff_frame_queue_t* queue) {
     return queue->frames + queue->rindex;
 }
@@ -141,7 +179,9 @@ void ff_frame_queue_next(ff_frame_queue_t* queue) {
     if (queue->keep_last && queue->rindex_shown == 0) {
         queue->rindex_shown = 1;
     } else {
-        av_frame_unref(queue->frames[queue->rindex].base);
+        ff_frame_queue_wait_upload(queue, queue->frames + queue->rindex);
+        frame_queue_unref_item(queue->frames + queue->rindex);
+        atomic_store(&queue->upload_states[queue->rindex], FF_FRAME_UPLOAD_NONE);
         if (++queue->rindex == queue->max_size) {
             queue->rindex = 0;
         }
@@ -152,6 +192,34 @@ void ff_frame_queue_next(ff_frame_queue_t* queue) {
     }
 }
 
+static atomic_int* get_upload_state(ff_frame_queue_t* queue, const ff_frame_t* frame) {
+    return queue->upload_states + (frame - queue->frames);
+}
+
+bool ff_frame_queue_begin_upload(ff_frame_queue_t* queue, ff_frame_t* frame) {
+    int expected = FF_FRAME_UPLOAD_NONE;
+    return atomic_compare_exchange_strong(get_upload_state(queue, frame), &expected, FF_FRAME_UPLOAD_BUSY);
+}
+
+void ff_frame_queue_end_upload(ff_frame_queue_t* queue, ff_frame_t* frame, const bool uploaded) {
+    mtx_lock(&queue->mutex);
+    atomic_store(get_upload_state(queue, frame), uploaded ? FF_FRAME_UPLOAD_DONE : FF_FRAME_UPLOAD_NONE);
+    cnd_broadcast(&queue->upload_cond);
+    mtx_unlock(&queue->mutex);
+}
+
+bool ff_frame_queue_wait_upload(ff_frame_queue_t* queue, ff_frame_t* frame) {
+    atomic_int* state = get_upload_state(queue, frame);
+    if (atomic_load(state) == FF_FRAME_UPLOAD_BUSY) {
+        mtx_lock(&queue->mutex);
+        while (atomic_load(state) == FF_FRAME_UPLOAD_BUSY) {
+            cnd_wait(&queue->upload_cond, &queue->mutex);
+        }
+        mtx_unlock(&queue->mutex);
+    }
+    return atomic_load(state) == FF_FRAME_UPLOAD_DONE;
+}
+
 int ff_frame_queue_get_frames_remaining(const ff_frame_queue_t* queue) {
     return queue->size - queue->rindex_shown;
 }
@@ -0,0 +1,123 @@
+#include "ff_packet_inspect.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum nal_kind {
+    NAL_KIND_OTHER = 0,
+    NAL_KIND_REFERENCE,
+    NAL_KIND_NON_REFERENCE
+} nal_kind_t;
+
+static int get_nal_length_size(const AVCodecContext* codec_context) {
+    const uint8_t* extradata = codec_context->extradata;
+    const int extradata_size = codec_context->extradata_size;
+    switch (codec_context->codec_id) {
+    case AV_CODEC_ID_H264:
+        if (extradata_size >= 7 && extradata[0] == 1) {
+            return (extradata[4] & 3) + 1;
+        }
+        break;
+    case AV_CODEC_ID_HEVC:
+        if (extradata_size >= 23 && (extradata[0] || extradata[1] || extradata[2] > 1)) {
+            return (extradata[21] & 3) + 1;
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+// highest HEVC TemporalId from hvcC or an Annex B SPS, -1 when unknown
+static int get_max_temporal_id(const AVCodecContext* codec_context) {
+    const uint8_t* extradata = codec_context->extradata;
+    const int extradata_size = codec_context->extradata_size;
+    if (codec_context->codec_id != AV_CODEC_ID_HEVC) {
+        return 0;
+    }
+    if (get_nal_length_size(codec_context) > 0) {
+        const int nb_temporal_layers = (extradata[21] >> 3) & 7;
+        return nb_temporal_layers > 0 ? nb_temporal_layers - 1 : -1;
+    }
+    for (int pos = 0; pos + 5 < extradata_size; ++pos) {
+        if (extradata[pos] == 0 && extradata[pos + 1] == 0 && extradata[pos + 2] == 1 &&
+            ((extradata[pos + 3] >> 1) & 0x3f) == 33) {
+            return (extradata[pos + 5] >> 1) & 7;
+        }
+    }
+    return -1;
+}
+
+static nal_kind_t get_nal_kind(const enum AVCodecID codec_id, const uint8_t* nal, const size_t size, const int max_temporal_id) {
+    if (codec_id == AV_CODEC_ID_H264) {
+        const int type = nal[0] & 0x1f;
+        if (type != 1 && type != 5) {
+            return NAL_KIND_OTHER;
+        }
+        return (nal[0] >> 5) & 3 ? NAL_KIND_REFERENCE : NAL_KIND_NON_REFERENCE;
+    }
+    const int type = (nal[0] >> 1) & 0x3f;
+    if (type >= 32) {
+        return NAL_KIND_OTHER;
+    }
+    if (size < 2 || type > 14 || type % 2 != 0) {
+        return NAL_KIND_REFERENCE;
+    }
+    // sub-layer non-reference pictures may still be referenced from higher
+    // sub-layers, so only the top one can go
+    const int temporal_id = (nal[1] & 7) - 1;
+    return temporal_id == max_temporal_id ? NAL_KIND_NON_REFERENCE : NAL_KIND_REFERENCE;
+}
+
+static bool update_disposable(const nal_kind_t kind, bool* has_slice) {
+    if (kind == NAL_KIND_REFERENCE) {
+        return false;
+    }
+    if (kind == NAL_KIND_NON_REFERENCE) {
+        *has_slice = true;
+    }
+    return true;
+}
+
+bool ff_packet_is_disposable(const AVCodecContext* codec_context, const AVPacket* packet) {
+    if (packet->flags & AV_PKT_FLAG_DISPOSABLE) {
+        return true;
+    }
+    const enum AVCodecID codec_id = codec_context->codec_id;
+    if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC) {
+        return false;
+    }
+    const uint8_t* data = packet->data;
+    const size_t size = (size_t)packet->size;
+    bool has_slice = false;
+
+    const int max_temporal_id = get_max_temporal_id(codec_context);
+    const int nal_length_size = get_nal_length_size(codec_context);
+    if (nal_length_size > 0) {
+        size_t pos = 0;
+        while (pos + (size_t)nal_length_size < size) {
+            size_t nal_size = 0;
+            for (int i = 0; i < nal_length_size; ++i) {
+                nal_size = (nal_size << 8) | data[pos++];
+            }
+            if (nal_size == 0 || nal_size > size - pos) {
+                return false;
+            }
+            if (!update_disposable(get_nal_kind(codec_id, data + pos, nal_size, max_temporal_id), &has_slice)) {
+                return false;
+            }
+            pos += nal_size;
+        }
+        return has_slice;
+    }
+    for (size_t pos = 0; pos + 3 < size; ++pos) {
+        if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) {
+            pos += 3;
+            if (!update_disposable(get_nal_kind(codec_id, data + pos, size - pos, max_temporal_id), &has_slice)) {
+                return false;
+            }
+        }
+    }
+    return has_slice;
+}
@@ -117,6 +117,38 @@ void ff_packet_queue_flush(ff_packet_queue_t* queue) {
     mtx_unlock(&queue->mutex);
 }
 
+void ff_packet_queue_trim(ff_packet_queue_t* queue, const int64_t max_duration, const size_t max_size) {
+    packet_t pkt1;
+
+    mtx_lock(&queue->mutex);
+    while ((queue->duration > max_duration || queue->size > max_size) &&
+           av_fifo_read(queue->packets, &pkt1, 1) >= 0) {
+        --queue->packet_count;
+        queue->size -= (size_t)pkt1.base->size + sizeof(packet_t);
+        queue->duration -= pkt1.base->duration;
+        av_packet_free(&pkt1.base);
+    }
+    mtx_unlock(&queue->mutex);
+}
+
+void ff_packet_queue_drop_before(ff_packet_queue_t* queue, const int64_t timestamp) {
+    packet_t pkt1;
+
+    mtx_lock(&queue->mutex);
+    while (av_fifo_peek(queue->packets, &pkt1, 1, 0) >= 0) {
+        const int64_t pkt_ts = pkt1.base->pts == AV_NOPTS_VALUE ? pkt1.base->dts : pkt1.base->pts;
+        if (pkt_ts == AV_NOPTS_VALUE || pkt_ts + pkt1.base->duration > timestamp) {
+            break;
+        }
+        av_fifo_drain2(queue->packets, 1);
+        --queue->packet_count;
+        queue->size -= (size_t)pkt1.base->size + sizeof(packet_t);
+        queue->duration -= pkt1.base->duration;
+        av_packet_free(&pkt1.base);
+    }
+    mtx_unlock(&queue->mutex);
+}
+
 void ff_packet_queue_start(ff_packet_queue_t* queue) {
     mtx_lock(&queue->mutex);
     queue->aborted = false;
@@ -10,10 +10,13 @@
 #include <libavutil/avassert.h>
 #include <libavutil/avstring.h>
 #include <libavutil/bprint.h>
+#include <libavutil/cpu.h>
+#include <libavutil/fifo.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/time.h>
 #include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
 
 #ifdef HAVE_THREAD_H
 #include "thread.h"
@@ -21,10 +24,18 @@
 #include "tinycthread/tinycthread.h"
 #endif
 
+#include "ff_audio_gain.h"
+#include "ff_audio_pll.h"
+#include "ff_audio_ring.h"
 #include "ff_clock.h"
+#include "ff_command_queue.h"
 #include "ff_packet_queue.h"
+#include "ff_recorder.h"
 #include "ff_frame_queue.h"
 #include "ff_decoder.h"
+#include "ff_decoder_cache.h"
+#include "ff_timeshift.h"
+#include "ff_video_scaler.h"
 
 enum {
     MIN_FRAMES = 10,
@@ -32,7 +43,21 @@ enum {
     EXTERNAL_CLOCK_MAX_FRAMES = 10,
     SAMPLE_CORRECTION_PERCENT_MAX = 10,
     AUDIO_DIFF_AVG_NB = 20,
+    AUDIO_GAIN_RAMP_MS = 10,
+    AUDIO_RING_MS = 200,
+    AUDIO_RING_CHUNKS = 64,
+    AUDIO_RING_POLL_INTERVAL = 5000,
+    // consecutive conversion failures before the convert thread gives up
+    AUDIO_CONVERT_MAX_ERRORS = 16,
+    AUDIO_TRACK_MAX_SIZE = 1024 * 1024,
+    DECODER_CACHE_SIZE = 4,
+    VIDEO_FILTER_QUEUE_SIZE = 4,
+    PRESENT_IDLE_TIMEOUT_MS = 100,
+    CADENCE_AVG_NB = 16,
+    CADENCE_MAX_SLOTS = 5,
     MAX_QUEUE_SIZE = 15 * 1024 * 1024,
+    // packets moved from the time-shift buffer per demuxed packet while catching up
+    TIMESHIFT_FEED_MAX = 64,
 };
 
 #define AV_NOSYNC_THRESHOLD 10.0
@@ -42,6 +67,54 @@ enum {
 #define EXTERNAL_CLOCK_SPEED_MIN  0.900
 #define EXTERNAL_CLOCK_SPEED_MAX  1.010
 #define EXTERNAL_CLOCK_SPEED_STEP 0.001
+#define CADENCE_TOLERANCE 0.005
+
+typedef struct video_filter {
+    AVFilterGraph* graph;
+    AVFilterContext* filter_in;
+    AVFilterContext* filter_out;
+    ff_video_scaler_t* scaler;
+    AVFrame* converted_frame;
+    AVRational frame_rate;
+    enum AVPixelFormat bypass_format;
+
+    int last_w;
+    int last_h;
+    int last_serial;
+    enum AVPixelFormat last_format;
+} video_filter_t;
+
+typedef struct filter_command {
+    char* target;
+    char* command;
+    char* arg;
+} filter_command_t;
+
+typedef struct filter_update {
+    AVFifo* commands;
+    bool pending;
+    char* filters;
+} filter_update_t;
+
+typedef struct presenter {
+    thrd_t thread;
+    mtx_t mutex;
+    cnd_t cond;
+    bool wakeup;
+    bool exit;
+} presenter_t;
+
+typedef struct queued_command {
+    ff_player_command_t command;
+    ff_command_done_callback done;
+    void* opaque;
+} queued_command_t;
+
+typedef struct audio_track {
+    int stream_index;
+    ff_decoder_t* decoder;
+    ff_packet_queue_t* packet_queue;
+} audio_track_t;
 
 struct ff_player {
     thrd_t read_thread;
@@ -51,6 +124,13 @@ struct ff_player {
     atomic_bool abort_request;
     atomic_bool force_refresh;
     atomic_bool paused;
+    atomic_bool standby;
+    atomic_bool muted;
+    // opts.audio_volume as changed at runtime, read by the audio thread
+    atomic_int audio_volume;
+    // held by control commands and the video frame pickers around frame_timer,
+    // the clock pause state and step
+    mtx_t state_mutex;
     bool step;
 
     bool last_paused;
@@ -69,23 +149,31 @@ struct ff_player {
 
     ff_frame_queue_t* picture_queue;
     ff_frame_queue_t* sampler_queue;
+    ff_frame_queue_t* subpicture_queue;
+    ff_frame_queue_t* video_filter_queue;
 
     ff_decoder_t* audio_decoder;
     ff_decoder_t* video_decoder;
+    ff_decoder_t* subtitle_decoder;
+    ff_decoder_cache_t* decoder_cache;
 
     ff_av_sync_t av_sync_type;
 
     int audio_stream_index;
     int video_stream_index;
+    int subtitle_stream_index;
 
     int last_video_stream_index;
     int last_audio_stream_index;
+    int last_subtitle_stream_index;
 
     AVStream* audio_stream;
     AVStream* video_stream;
+    AVStream* subtitle_stream;
 
     ff_packet_queue_t* audio_packet_queue;
     ff_packet_queue_t* video_packet_queue;
+    ff_packet_queue_t* subtitle_packet_queue;
 
     double audio_clock_value;
     int audio_clock_serial;
@@ -96,30 +184,69 @@ struct ff_player {
     int audio_hw_buf_size;
     uint8_t* swr_buf;
     unsigned int swr_buf_size;
+    uint8_t** swr_planes;
+    unsigned int swr_planes_size;
+
+    ff_audio_pll_t audio_pll;
+    int64_t audio_device_latency;
+    int64_t audio_bytes_delivered;
+    int64_t audio_tail_bytes;
+    double audio_tail_pts;
+    int audio_tail_serial;
+    bool audio_position_reported;
 
     ff_audio_params_t audio_source;
     ff_audio_params_t audio_filter_source;
     ff_audio_params_t audio_target;
 
     SwrContext* swr_context;
+    ff_audio_gain_t audio_gain;
+
+    ff_audio_ring_t* audio_ring;
+    thrd_t audio_convert_thread;
+
+    audio_track_t* audio_tracks;
+    int nb_audio_tracks;
 
     double frame_timer;
+    int64_t display_refresh_period;
+    int64_t display_last_vsync;
+    double vsync_frame_duration;
+    double vsync_cadence;
+    double vsync_bias;
     double frame_last_returned_time;
-    double frame_last_filter_delay;
+    // microseconds, written by the filter stage and read by the decoding side
+    atomic_llong frame_last_filter_delay;
     double max_frame_duration;
+    presenter_t* presenter;
     bool eof;
 
-    char* filename;
+    ff_timeshift_t* timeshift;
+    bool timeshift_input_eof;
 
-    AVFilterContext* in_video_filter;
-    AVFilterContext* out_video_filter;
+    mtx_t recorder_mutex;
+    ff_recorder_t* recorder;
+    // read_thread owns the streams, so it creates the requested recorder
+    bool record_req;
+    char* record_path;
+    char* record_format;
+    int record_error;
+
+    char* filename;
 
     AVFilterContext* in_audio_filter;
     AVFilterContext* out_audio_filter;
 
     AVFilterGraph* audio_graph;
 
+    mtx_t filter_mutex;
+    filter_update_t video_filter_update;
+    filter_update_t audio_filter_update;
+
+    struct SwsContext* sub_convert_context;
+
     cnd_t continue_read_thread;
+    ff_command_queue_t* commands;
 
     ff_player_opts_t opts;
 };
@@ -174,12 +301,12 @@ static inline int compare_audio_formats(
 static void check_external_clock_speed(ff_player_t* player) {
     if (player->video_stream_index >= 0 && ff_packet_queue_get_packet_count(player->video_packet_queue) <= EXTERNAL_CLOCK_MIN_FRAMES ||
         player->audio_stream_index >= 0 && ff_packet_queue_get_packet_count(player->audio_packet_queue) <= EXTERNAL_CLOCK_MIN_FRAMES) {
-        ff_clock_set_speed(&player->external_clock, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, player->external_clock.speed - EXTERNAL_CLOCK_SPEED_STEP));
+        ff_clock_set_speed(&player->external_clock, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, ff_clock_get_speed(&player->external_clock) - EXTERNAL_CLOCK_SPEED_STEP));
     } else if ((player->video_stream_index < 0 || ff_packet_queue_get_packet_count(player->video_packet_queue) > EXTERNAL_CLOCK_MAX_FRAMES) &&
                 (player->audio_stream_index < 0 || ff_packet_queue_get_packet_count(player->audio_packet_queue) > EXTERNAL_CLOCK_MAX_FRAMES)) {
-        ff_clock_set_speed(&player->external_clock, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, player->external_clock.speed + EXTERNAL_CLOCK_SPEED_STEP));
+        ff_clock_set_speed(&player->external_clock, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, ff_clock_get_speed(&player->external_clock) + EXTERNAL_CLOCK_SPEED_STEP));
     } else {
-        const double speed = player->external_clock.speed;
+        const double speed = ff_clock_get_speed(&player->external_clock);
         if (speed != 1.0) {
             ff_clock_set_speed(&player->external_clock, speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
         }
@@ -205,32 +332,38 @@ static ff_av_sync_t get_master_sync_type(const ff_player_t* player) {
     return sync_type;
 }
 
-static double get_master_clock(const ff_player_t* player) {
+static double get_master_clock_at(const ff_player_t* player, const int64_t now) {
     double val;
     switch (get_master_sync_type(player)) {
     case FF_AV_SYNC_VIDEO_MASTER:
-        val = ff_clock_get(&player->video_clock);
+        val = ff_clock_get_at(&player->video_clock, now);
         break;
     case FF_AV_SYNC_AUDIO_MASTER:
-        val = ff_clock_get(&player->audio_clock);
+        val = ff_clock_get_at(&player->audio_clock, now);
         break;
     default:
-        val = ff_clock_get(&player->external_clock);
+        val = ff_clock_get_at(&player->external_clock, now);
         break;
     }
     return val;
 }
 
+static double get_master_clock(const ff_player_t* player) {
+    return get_master_clock_at(player, ff_clock_now());
+}
+
 static void update_video_pts(ff_player_t* player, const double pts, const int serial) {
-    ff_clock_set(&player->video_clock, pts, serial);
-    ff_clock_sync_to_slave(&player->external_clock, &player->video_clock, AV_NOSYNC_THRESHOLD);
+    const int64_t now = ff_clock_now();
+    ff_clock_set_at(&player->video_clock, pts, serial, now);
+    ff_clock_sync_to_slave_at(&player->external_clock, &player->video_clock, AV_NOSYNC_THRESHOLD, now);
 }
 
 static double compute_target_delay(const ff_player_t* player, double delay) {
     double diff = 0.0;
 
     if (get_master_sync_type(player) != FF_AV_SYNC_VIDEO_MASTER) {
-        diff = ff_clock_get(&player->video_clock) - get_master_clock(player);
+        const int64_t now = ff_clock_now();
+        diff = ff_clock_get_at(&player->video_clock, now) - get_master_clock_at(player, now);
         const double sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
         if (!isnan(diff) && fabs(diff) < player->max_frame_duration) {
             if (diff <= -sync_threshold) {
@@ -354,7 +487,11 @@ static bool packet_queues_init(ff_player_t* player) {
     if (player->video_packet_queue != NULL) {
         player->audio_packet_queue = ff_packet_queue_create();
         if (player->audio_packet_queue != NULL) {
-            return true;
+            player->subtitle_packet_queue = ff_packet_queue_create();
+            if (player->subtitle_packet_queue != NULL) {
+                return true;
+            }
+            ff_packet_queue_destroy(player->audio_packet_queue);
         }
         ff_packet_queue_destroy(player->video_packet_queue);
     }
@@ -364,6 +501,7 @@ static bool packet_queues_init(ff_player_t* player) {
 static void packet_queues_destroy(const ff_player_t* player) {
     ff_packet_queue_destroy(player->video_packet_queue);
     ff_packet_queue_destroy(player->audio_packet_queue);
+    ff_packet_queue_destroy(player->subtitle_packet_queue);
 }
 
 static bool frame_queues_init(ff_player_t* player) {
@@ -371,7 +509,11 @@ static bool frame_queues_init(ff_player_t* player) {
     if (player->picture_queue != NULL) {
         player->sampler_queue = ff_frame_queue_create(player->audio_packet_queue, FF_SAMPLE_QUEUE_SIZE, 1);
         if (player->sampler_queue != NULL) {
-            return true;
+            player->subpicture_queue = ff_frame_queue_create(player->subtitle_packet_queue, FF_SUBPICTURE_QUEUE_SIZE, false);
+            if (player->subpicture_queue != NULL) {
+                return true;
+            }
+            ff_frame_queue_destroy(player->sampler_queue);
         }
         ff_frame_queue_destroy(player->picture_queue);
     }
@@ -381,14 +523,110 @@ static bool frame_queues_init(ff_player_t* player) {
 static void frame_queues_destroy(const ff_player_t* player) {
     ff_frame_queue_destroy(player->picture_queue);
     ff_frame_queue_destroy(player->sampler_queue);
+    ff_frame_queue_destroy(player->subpicture_queue);
+}
+
+static const int32_t* get_display_matrix(const ff_player_t* player, const AVFrame* frame) {
+    const AVFrameSideData* frame_side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_DISPLAYMATRIX);
+    if (frame_side_data != NULL) {
+        return (int32_t*)frame_side_data->data;
+    }
+    const AVPacketSideData* packet_side_data = av_packet_side_data_get(
+        player->video_stream->codecpar->coded_side_data,
+        player->video_stream->codecpar->nb_coded_side_data,
+        AV_PKT_DATA_DISPLAYMATRIX
+    );
+    if (packet_side_data != NULL) {
+        return (int32_t*)packet_side_data->data;
+    }
+    return NULL;
+}
+
+static bool is_rotation_identity(const int32_t* display_matrix, const double theta) {
+    if (display_matrix == NULL) {
+        return true;
+    }
+    if (fabs(theta - 180) < 1.0) {
+        return display_matrix[0] >= 0 && display_matrix[4] >= 0;
+    }
+    return fabs(theta) <= 1.0 && display_matrix[4] >= 0;
+}
+
+static bool is_color_space_supported(const ff_video_stream_params_t* params, const enum AVColorSpace color_space) {
+    if (params->color_spaces == NULL || color_space == AVCOL_SPC_UNSPECIFIED) {
+        return true;
+    }
+    for (size_t i = 0; i < params->color_spaces_size && params->color_spaces[i] != AVCOL_SPC_UNSPECIFIED; ++i) {
+        if (params->color_spaces[i] == color_space) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static enum AVPixelFormat get_bypass_pixel_format(const ff_video_stream_params_t* params, const AVFrame* frame) {
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(frame->format);
+    if (descriptor == NULL || (descriptor->flags & AV_PIX_FMT_FLAG_HWACCEL) || frame->hw_frames_ctx != NULL) {
+        return AV_PIX_FMT_NONE;
+    }
+    if (!(descriptor->flags & AV_PIX_FMT_FLAG_RGB) && !is_color_space_supported(params, frame->colorspace)) {
+        return AV_PIX_FMT_NONE;
+    }
+    if (params->pix_fmts == NULL) {
+        return frame->format;
+    }
+    for (size_t i = 0; i < params->pix_fmts_size && params->pix_fmts[i] != AV_PIX_FMT_NONE; ++i) {
+        if (params->pix_fmts[i] == frame->format) {
+            return frame->format;
+        }
+    }
+    if (!sws_isSupportedInput(frame->format)) {
+        return AV_PIX_FMT_NONE;
+    }
+    const enum AVPixelFormat format = avcodec_find_best_pix_fmt_of_list(
+        params->pix_fmts,
+        frame->format,
+        (descriptor->flags & AV_PIX_FMT_FLAG_ALPHA) != 0,
+        NULL
+    );
+    if (format == AV_PIX_FMT_NONE || !sws_isSupportedOutput(format)) {
+        return AV_PIX_FMT_NONE;
+    }
+    return format;
 }
 
 static int configure_video_filters(
-    ff_player_t* player,
-    AVFilterGraph* graph,
-    const AVFrame *frame
+    const ff_player_t* player,
+    const char* filters,
+    const AVFrame *frame,
+    AVFilterGraph** graph_ptr,
+    AVFilterContext** in_filter,
+    AVFilterContext** out_filter,
+    enum AVPixelFormat* bypass_format
 ) {
     const ff_stream_params_t* params = &player->opts.video_stream_params;
+
+    const int32_t* display_matrix = NULL;
+    double theta = 0.0;
+    if (params->extended.video.autorotate) {
+        display_matrix = get_display_matrix(player, frame);
+        theta = get_rotation(display_matrix);
+    }
+    avfilter_graph_free(graph_ptr);
+    *in_filter = NULL;
+    *out_filter = NULL;
+    *bypass_format = AV_PIX_FMT_NONE;
+
+    if (filters == NULL && is_rotation_identity(display_matrix, theta)) {
+        *bypass_format = get_bypass_pixel_format(&params->extended.video, frame);
+        if (*bypass_format != AV_PIX_FMT_NONE) {
+            return 0;
+        }
+    }
+    AVFilterGraph* graph = *graph_ptr = avfilter_graph_alloc();
+    if (graph == NULL) {
+        return AVERROR(ENOMEM);
+    }
     graph->nb_threads = params->filter_nb_threads;
 
     AVBufferSrcParameters* buffer_src_parameters = av_buffersrc_parameters_alloc();
@@ -467,22 +705,6 @@ static int configure_video_filters(
     }
     AVFilterContext* last_filter = filter_out;
   if (params->extended.video.autorotate) {
-    const int32_t* display_matrix = NULL;
-    const AVFrameSideData* frame_side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_DISPLAYMATRIX);
-    if (frame_side_data != NULL) {
-        display_matrix = (int32_t *)frame_side_data->data;
-    }
-    if (display_matrix == NULL) {
-        const AVPacketSideData* packet_side_data = av_packet_side_data_get(
-            player->video_stream->codecpar->coded_side_data,
-            player->video_stream->codecpar->nb_coded_side_data,
-            AV_PKT_DATA_DISPLAYMATRIX
-        );
-        if (packet_side_data != NULL) {
-            display_matrix = (int32_t *)packet_side_data->data;
-        }
-    }
-    const double theta = get_rotation(display_matrix);
 #define INSERT_FILT(name, arg) do {                                          \
     AVFilterContext *filt_ctx;                                               \
     ret = avfilter_graph_create_filter(&filt_ctx,                            \
@@ -523,10 +745,10 @@ static int configure_video_filters(
     }
   }
 #undef INSERT_FILT
-    ret = configure_filtergraph(graph, params->filters, filter_src, last_filter);
+    ret = configure_filtergraph(graph, filters, filter_src, last_filter);
     if (ret >= 0) {
-        player->in_video_filter = filter_src;
-        player->out_video_filter = filter_out;
+        *in_filter = filter_src;
+        *out_filter = filter_out;
     }
 fail:
     av_freep(&buffer_src_parameters);
@@ -535,16 +757,23 @@ fail:
 }
 
 static int configure_audio_filters(
-    ff_player_t* player,
-    const bool force_output_format
+    const ff_player_t* player,
+    const char* filters,
+    const ff_audio_params_t* source,
+    const bool force_output_format,
+    AVFilterGraph** graph_ptr,
+    AVFilterContext** in_filter,
+    AVFilterContext** out_filter
 ) {
-    avfilter_graph_free(&player->audio_graph);
-    player->audio_graph = avfilter_graph_alloc();
-    if (player->audio_graph == NULL) {
+    avfilter_graph_free(graph_ptr);
+    *in_filter = NULL;
+    *out_filter = NULL;
+    AVFilterGraph* graph = *graph_ptr = avfilter_graph_alloc();
+    if (graph == NULL) {
         return AVERROR(ENOMEM);
     }
     const ff_stream_params_t* params = &player->opts.audio_stream_params;
-    player->audio_graph->nb_threads = params->filter_nb_threads;
+    graph->nb_threads = params->filter_nb_threads;
 
     AVBPrint bp;
     av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
@@ -563,9 +792,9 @@ static int configure_audio_filters(
             resample_swr_opts[resample_swr_opts_len - 1] = '\0';
         }
     }
-    av_opt_set(player->audio_graph, "aresample_swr_opts", resample_swr_opts, 0);
+    av_opt_set(graph, "aresample_swr_opts", resample_swr_opts, 0);
 
-    av_channel_layout_describe_bprint(&player->audio_filter_source.ch_layout, &bp);
+    av_channel_layout_describe_bprint(&source->ch_layout, &bp);
 
     char asrc_args[256];
     snprintf(
@@ -575,10 +804,10 @@ static int configure_audio_filters(
         "sample_fmt=%s:"
         "time_base=%d/%d:"
         "channel_layout=%s",
-        player->audio_filter_source.freq,
-        av_get_sample_fmt_name(player->audio_filter_source.fmt),
+        source->freq,
+        av_get_sample_fmt_name(source->fmt),
         1,
-        player->audio_filter_source.freq,
+        source->freq,
         bp.str
     );
     AVFilterContext* filter_src = NULL;
@@ -588,12 +817,19 @@ static int configure_audio_filters(
         "ffplay_abuffer",
         asrc_args,
         NULL,
-        player->audio_graph
+        graph
     );
     if (ret < 0) {
         goto end;
     }
-    const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+    const enum AVSampleFormat default_sample_fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+    const enum AVSampleFormat target_sample_fmts[] = { player->audio_target.fmt, AV_SAMPLE_FMT_NONE };
+    const enum AVSampleFormat* sample_fmts = default_sample_fmts;
+    if (force_output_format) {
+        sample_fmts = target_sample_fmts;
+    } else if (params->extended.audio.sample_fmts != NULL) {
+        sample_fmts = params->extended.audio.sample_fmts;
+    }
 
     AVFilterContext* filter_out = NULL;
     ret = avfilter_graph_create_filter(
@@ -602,7 +838,7 @@ static int configure_audio_filters(
         "ffplay_abuffersink",
         NULL,
         NULL,
-        player->audio_graph
+        graph
     );
     if (ret < 0 ||
         (ret = av_opt_set_int_list(filter_out, "sample_fmts", sample_fmts,  AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0 ||
@@ -620,19 +856,29 @@ static int configure_audio_filters(
             goto end;
         }
     }
-    ret = configure_filtergraph(player->audio_graph, params->filters, filter_src, filter_out);
+    ret = configure_filtergraph(graph, filters, filter_src, filter_out);
 end:
     if (ret >= 0) {
-        player->in_audio_filter  = filter_src;
-        player->out_audio_filter = filter_out;
+        *in_filter  = filter_src;
+        *out_filter = filter_out;
     } else {
-        avfilter_graph_free(&player->audio_graph);
+        avfilter_graph_free(graph_ptr);
     }
     av_bprint_finalize(&bp, NULL);
 
     return ret;
 }
 
+static void presenter_wake(presenter_t* presenter) {
+    if (presenter == NULL) {
+        return;
+    }
+    mtx_lock(&presenter->mutex);
+    presenter->wakeup = true;
+    cnd_signal(&presenter->cond);
+    mtx_unlock(&presenter->mutex);
+}
+
 static int queue_picture(
     const ff_player_t* player,
     AVFrame* src_frame,
@@ -669,6 +915,7 @@ static int queue_picture(
     }
     av_frame_move_ref(frame->base, src_frame);
     ff_frame_queue_push(player->picture_queue);
+    presenter_wake(player->presenter);
 
     return 0;
 }
@@ -689,8 +936,22 @@ static int get_video_frame(const ff_player_t* player, AVFrame *frame) {
             if (frame->pts != AV_NOPTS_VALUE) {
                 const double diff = dpts - get_master_clock(player);
                 if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
-                    diff - player->frame_last_filter_delay < 0 &&
-                    ff_decoder_get_packet_serial(player->video_decoder) == player->video_clock.serial &&
+                    ff_decoder_get_packet_serial(player->video_decoder) == ff_clock_get_serial(&player->video_clock)) {
+                    const ff_video_stream_params_t* params = &player->opts.video_stream_params.extended.video;
+                    if (params->adaptive_skip) {
+                        ff_decoder_update_skip_level(player->video_decoder, -diff);
+                    }
+                    if (params->drop_disposable) {
+                        if (diff < -AV_SYNC_THRESHOLD_MAX) {
+                            ff_decoder_set_drop_disposable(player->video_decoder, true);
+                        } else if (diff > -AV_SYNC_THRESHOLD_MIN) {
+                            ff_decoder_set_drop_disposable(player->video_decoder, false);
+                        }
+                    }
+                }
+                if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
+                    diff - (double)player->frame_last_filter_delay / 1000000.0 < 0 &&
+                    ff_decoder_get_packet_serial(player->video_decoder) == ff_clock_get_serial(&player->video_clock) &&
                     ff_packet_queue_get_packet_count(player->video_packet_queue)) {
                     av_frame_unref(frame);
                     ret = 0;
@@ -701,6 +962,215 @@ static int get_video_frame(const ff_player_t* player, AVFrame *frame) {
     return ret;
 }
 
+static float get_audio_gain(const ff_player_t* player) {
+    if (player->muted) {
+        return 0.0f;
+    }
+    if (player->opts.max_volume <= 0) {
+        return 1.0f;
+    }
+    return av_clipf((float)player->audio_volume / (float)player->opts.max_volume, 0.0f, 1.0f);
+}
+
+static void filter_command_release(filter_command_t* command) {
+    av_freep(&command->target);
+    av_freep(&command->command);
+    av_freep(&command->arg);
+}
+
+static bool filter_update_init(filter_update_t* update) {
+    update->commands = av_fifo_alloc2(1, sizeof(filter_command_t), AV_FIFO_FLAG_AUTO_GROW);
+    return update->commands != NULL;
+}
+
+static void filter_update_destroy(filter_update_t* update) {
+    if (update->commands != NULL) {
+        filter_command_t command;
+        while (av_fifo_read(update->commands, &command, 1) >= 0) {
+            filter_command_release(&command);
+        }
+        av_fifo_freep2(&update->commands);
+    }
+    av_freep(&update->filters);
+    update->pending = false;
+}
+
+static bool filter_updates_init(ff_player_t* player) {
+    if (mtx_init(&player->filter_mutex, mtx_plain) == thrd_success) {
+        if (filter_update_init(&player->video_filter_update)) {
+            if (filter_update_init(&player->audio_filter_update)) {
+                return true;
+            }
+            filter_update_destroy(&player->video_filter_update);
+        }
+        mtx_destroy(&player->filter_mutex);
+    }
+    return false;
+}
+
+static void filter_updates_destroy(ff_player_t* player) {
+    filter_update_destroy(&player->video_filter_update);
+    filter_update_destroy(&player->audio_filter_update);
+    mtx_destroy(&player->filter_mutex);
+}
+
+// moves the chain set by ff_player_set_*_filters into params and hands back
+// the one it replaces; false when nothing is pending
+static bool filter_update_swap(ff_player_t* player, filter_update_t* update, ff_stream_params_t* params, char** previous) {
+    mtx_lock(&player->filter_mutex);
+    const bool pending = update->pending;
+    if (pending) {
+        *previous = params->filters;
+        params->filters = update->filters;
+        update->filters = NULL;
+        update->pending = false;
+    }
+    mtx_unlock(&player->filter_mutex);
+    return pending;
+}
+
+// puts back the chain a failed update replaced
+static void filter_update_revert(ff_player_t* player, ff_stream_params_t* params, char** previous) {
+    av_log(NULL, AV_LOG_ERROR, "Could not configure filters '%s', keeping '%s'\n",
+           params->filters ? params->filters : "", *previous ? *previous : "");
+    mtx_lock(&player->filter_mutex);
+    av_free(params->filters);
+    params->filters = *previous;
+    *previous = NULL;
+    mtx_unlock(&player->filter_mutex);
+}
+
+static void run_filter_commands(ff_player_t* player, filter_update_t* update, AVFilterGraph* graph) {
+    for (;;) {
+        filter_command_t command;
+        mtx_lock(&player->filter_mutex);
+        const int ret = av_fifo_read(update->commands, &command, 1);
+        mtx_unlock(&player->filter_mutex);
+        if (ret < 0) {
+            break;
+        }
+        if (graph == NULL) {
+            av_log(NULL, AV_LOG_WARNING, "No filter graph for command '%s'\n", command.command);
+        } else {
+            char response[256] = "";
+            const int err = avfilter_graph_send_command(
+                graph,
+                command.target,
+                command.command,
+                command.arg,
+                response,
+                sizeof(response),
+                0
+            );
+            if (err < 0) {
+                av_log(NULL, AV_LOG_WARNING, "Filter command '%s' for '%s' failed: %s\n", command.command, command.target, av_err2str(err));
+            } else if (response[0] != '\0') {
+                av_log(NULL, AV_LOG_VERBOSE, "Filter command '%s': %s\n", command.command, response);
+            }
+        }
+        filter_command_release(&command);
+    }
+}
+
+static bool is_audio_filter_bypass(const ff_player_t* player, const AVFrame* frame) {
+    return player->opts.audio_stream_params.filters == NULL &&
+           frame->format == player->audio_target.fmt &&
+           frame->sample_rate == player->audio_target.freq &&
+           !av_channel_layout_compare(&frame->ch_layout, &player->audio_target.ch_layout);
+}
+
+// filters that keep no history from one frame to the next, so a graph made
+// only of these can carry on across a seek; aresample is listed as its
+// resampler taps span a few samples at most
+static const char* const stateless_filters[] = {
+    "buffer", "buffersink", "abuffer", "abuffersink",
+    "null", "anull", "copy", "format", "aformat", "scale", "aresample",
+    "transpose", "hflip", "vflip", "rotate", "crop", "pad", "setsar", "setdar",
+    "volume", "pan", "channelmap",
+};
+
+static bool is_filter_graph_stateless(const AVFilterGraph* graph) {
+    for (unsigned int i = 0; i < graph->nb_filters; ++i) {
+        const char* name = graph->filters[i]->filter->name;
+        bool found = false;
+        for (size_t j = 0; j < FF_ARRAY_ELEMS(stateless_filters) && !found; ++j) {
+            found = !strcmp(name, stateless_filters[j]);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ends the graph input and drops whatever it still holds; a buffersrc does
+// not accept frames after EOF, so the graph has to be rebuilt afterwards
+static void discard_filter_output(AVFilterContext* filter_in, AVFilterContext* filter_out) {
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+        return;
+    }
+    int ret = av_buffersrc_add_frame(filter_in, NULL);
+    while (ret >= 0) {
+        ret = av_buffersink_get_frame_flags(filter_out, frame, 0);
+        av_frame_unref(frame);
+    }
+    av_frame_free(&frame);
+}
+
+static int get_frame_serial(const AVFrame* frame, const int default_serial) {
+    const ff_frame_data_t* frame_data = frame->opaque_ref ? (ff_frame_data_t*)frame->opaque_ref->data : NULL;
+    return frame_data != NULL ? frame_data->serial : default_serial;
+}
+
+static bool output_audio_frame(const ff_player_t* player, AVFrame* frame, const AVRational time_base) {
+    const ff_frame_data_t* frame_data = frame->opaque_ref ? (ff_frame_data_t*)frame->opaque_ref->data : NULL;
+    ff_frame_t* audio_frame = ff_frame_queue_peek_writable(player->sampler_queue);
+    if (audio_frame == NULL) {
+        return false;
+    }
+    audio_frame->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : (double)frame->pts * av_q2d(time_base);
+    if (frame_data != NULL) {
+        audio_frame->pos = frame_data->pkt_pos;
+    } else {
+        audio_frame->pos = -1;
+    }
+    audio_frame->serial = ff_decoder_get_packet_serial(player->audio_decoder);
+    audio_frame->duration = av_q2d((AVRational){frame->nb_samples, frame->sample_rate});
+
+    av_frame_move_ref(audio_frame->base, frame);
+    ff_frame_queue_push(player->sampler_queue);
+
+    return true;
+}
+
+static int drain_audio_filters(ff_player_t* player, const int serial) {
+    if (player->in_audio_filter == NULL) {
+        return 0;
+    }
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    int ret = av_buffersrc_add_frame(player->in_audio_filter, NULL);
+    while (ret >= 0) {
+        ret = av_buffersink_get_frame_flags(player->out_audio_filter, frame, 0);
+        if (ret < 0) {
+            break;
+        }
+        if (get_frame_serial(frame, serial) != serial) {
+            av_frame_unref(frame);
+            continue;
+        }
+        if (!output_audio_frame(player, frame, av_buffersink_get_time_base(player->out_audio_filter))) {
+            ret = AVERROR_EXIT;
+        }
+    }
+    av_frame_free(&frame);
+
+    return ret == AVERROR_EOF || ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
 static int audio_thread(void* arg) {
     ff_player_t* player = arg;
 
@@ -708,6 +1178,8 @@ static int audio_thread(void* arg) {
     if (frame == NULL) {
         return AVERROR(ENOMEM);
     }
+    ff_stream_params_t* params = &player->opts.audio_stream_params;
+    char* previous_filters = NULL;
     int last_serial = -1;
     int ret = 0;
     do {
@@ -716,7 +1188,8 @@ static int audio_thread(void* arg) {
             break;
         }
         if (ret > 0) {
-            const int reconfigure =
+            const int serial = ff_decoder_get_packet_serial(player->audio_decoder);
+            int reconfigure =
                 compare_audio_formats(
                     player->audio_filter_source.fmt,
                     player->audio_filter_source.ch_layout.nb_channels,
@@ -725,7 +1198,23 @@ static int audio_thread(void* arg) {
                 ) ||
                 av_channel_layout_compare(&player->audio_filter_source.ch_layout, &frame->ch_layout) ||
                 player->audio_filter_source.freq != frame->sample_rate ||
-                ff_decoder_get_packet_serial(player->audio_decoder) != last_serial;
+                last_serial == -1;
+            // stateful filters must not carry history across a seek, any
+            // other graph is kept and only loses its stale output
+            if (serial != last_serial && player->in_audio_filter != NULL &&
+                !is_filter_graph_stateless(player->audio_graph)) {
+                discard_filter_output(player->in_audio_filter, player->out_audio_filter);
+                reconfigure = 1;
+            }
+            const bool updated = filter_update_swap(player, &player->audio_filter_update, params, &previous_filters);
+            if (updated) {
+                // the old graph hands over what it still holds before it is replaced
+                ret = drain_audio_filters(player, serial);
+                if (ret < 0) {
+                    break;
+                }
+                reconfigure = 1;
+            }
             if (reconfigure != 0) {
                 char buf1[1024], buf2[1024];
                 av_channel_layout_describe(&player->audio_filter_source.ch_layout, buf1, sizeof(buf1));
@@ -753,7 +1242,7 @@ static int audio_thread(void* arg) {
                        frame->ch_layout.nb_channels,
                        av_get_sample_fmt_name(frame->format),
                        buf2,
-                       ff_decoder_get_packet_serial(player->audio_decoder)
+                       serial
                 );
                 player->audio_filter_source.fmt = frame->format;
                 ret = av_channel_layout_copy(&player->audio_filter_source.ch_layout, &frame->ch_layout);
@@ -761,396 +1250,1680 @@ static int audio_thread(void* arg) {
                     break;
                 }
                 player->audio_filter_source.freq = frame->sample_rate;
-                last_serial = ff_decoder_get_packet_serial(player->audio_decoder);
-                ret = configure_audio_filters(player, true);
-                if (ret < 0) {
-                    break;
+                if (is_audio_filter_bypass(player, frame)) {
+                    avfilter_graph_free(&player->audio_graph);
+                    player->in_audio_filter = NULL;
+                    player->out_audio_filter = NULL;
+                } else {
+                    ret = configure_audio_filters(
+                        player,
+                        params->filters,
+                        &player->audio_filter_source,
+                        true,
+                        &player->audio_graph,
+                        &player->in_audio_filter,
+                        &player->out_audio_filter
+                    );
+                    if (ret < 0 && updated) {
+                        filter_update_revert(player, params, &previous_filters);
+                        ret = configure_audio_filters(
+                            player,
+                            params->filters,
+                            &player->audio_filter_source,
+                            true,
+                            &player->audio_graph,
+                            &player->in_audio_filter,
+                            &player->out_audio_filter
+                        );
+                    }
+                    if (ret < 0) {
+                        break;
+                    }
+                }
+            }
+            av_freep(&previous_filters);
+            last_serial = serial;
+            run_filter_commands(player, &player->audio_filter_update, player->audio_graph);
+            if (player->in_audio_filter == NULL) {
+                if (!output_audio_frame(player, frame, (AVRational){1, frame->sample_rate})) {
+                    goto end;
                 }
+                continue;
             }
             if ((ret = av_buffersrc_add_frame(player->in_audio_filter, frame)) < 0) {
                 break;
             }
             while ((ret = av_buffersink_get_frame_flags(player->out_audio_filter, frame, 0)) >= 0) {
-                const AVRational time_base = av_buffersink_get_time_base(player->out_audio_filter);
-
-                const ff_frame_data_t* frame_data = frame->opaque_ref ? (ff_frame_data_t*)frame->opaque_ref->data : NULL;
-                ff_frame_t* audio_frame = ff_frame_queue_peek_writable(player->sampler_queue);
-                if (audio_frame == NULL) {
-                    goto end;
+                if (get_frame_serial(frame, serial) != serial) {
+                    av_frame_unref(frame);
+                    continue;
                 }
-                audio_frame->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : (double)frame->pts * av_q2d(time_base);
-                if (frame_data != NULL) {
-                    audio_frame->pos = frame_data->pkt_pos;
-                } else {
-                    audio_frame->pos = -1;
+                if (!output_audio_frame(player, frame, av_buffersink_get_time_base(player->out_audio_filter))) {
+                    goto end;
                 }
-                audio_frame->serial = ff_decoder_get_packet_serial(player->audio_decoder);
-                audio_frame->duration = av_q2d((AVRational){frame->nb_samples, frame->sample_rate});
-
-                av_frame_move_ref(audio_frame->base, frame);
-                ff_frame_queue_push(player->sampler_queue);
                 if (ff_packet_queue_get_serial(player->audio_packet_queue) != ff_decoder_get_packet_serial(player->audio_decoder)) {
                     break;
                 }
             }
             if (ret == AVERROR_EOF) {
-                ff_decoder_set_finished(player->audio_decoder);
+                ff_decoder_set_finished(player->audio_decoder, serial);
             }
         }
     } while (ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
 end:
+    av_free(previous_filters);
     avfilter_graph_free(&player->audio_graph);
     av_frame_free(&frame);
 
     return ret;
 }
 
-static int video_thread(void* arg) {
-    AVFrame* frame = av_frame_alloc();
-    if (frame == NULL) {
+static int output_video_frame(
+    const ff_player_t* player,
+    AVFrame* frame,
+    const AVRational time_base,
+    const AVRational frame_rate,
+    const int serial
+) {
+    const ff_frame_data_t* frame_data = frame->opaque_ref ? (ff_frame_data_t*)frame->opaque_ref->data : NULL;
+
+    double duration = 0.0;
+    if (frame_rate.num != 0 && frame_rate.den != 0) {
+        const AVRational frame_rate_reversed = {frame_rate.den, frame_rate.num};
+        duration = av_q2d(frame_rate_reversed);
+    }
+    double pts = NAN;
+    if (frame->pts != AV_NOPTS_VALUE) {
+        pts = (double)frame->pts * av_q2d(time_base);
+    }
+    int64_t pos = -1;
+    if (frame_data != NULL) {
+        pos = frame_data->pkt_pos;
+    }
+    const int ret = queue_picture(
+        player,
+        frame,
+        pts,
+        duration,
+        pos,
+        serial
+    );
+    av_frame_unref(frame);
+
+    return ret;
+}
+
+static int video_filter_init(const ff_player_t* player, video_filter_t* filter) {
+    memset(filter, 0, sizeof(video_filter_t));
+    filter->converted_frame = av_frame_alloc();
+    if (filter->converted_frame == NULL) {
         return AVERROR(ENOMEM);
     }
-    ff_player_t* player = arg;
-    AVRational frame_rate = av_guess_frame_rate(player->format_context, player->video_stream, NULL);
+    filter->frame_rate = av_guess_frame_rate(player->format_context, player->video_stream, NULL);
+    filter->last_serial = -1;
+    filter->last_format = -2;
+    filter->bypass_format = AV_PIX_FMT_NONE;
 
-    AVFilterGraph* graph = NULL;
-    AVFilterContext* filter_out = NULL;
-    AVFilterContext* filter_in = NULL;
+    return 0;
+}
 
-    int last_w = 0;
-    int last_h = 0;
-    int last_serial = -1;
+static void video_filter_uninit(video_filter_t* filter) {
+    if (filter->scaler != NULL) {
+        ff_video_scaler_destroy(filter->scaler);
+    }
+    avfilter_graph_free(&filter->graph);
+    av_frame_free(&filter->converted_frame);
+}
 
-    enum AVPixelFormat last_format = -2;
+static bool is_video_filter_changed(const video_filter_t* filter, const AVFrame* frame) {
+    return filter->last_w != frame->width
+        || filter->last_h != frame->height
+        || filter->last_format != frame->format;
+}
 
-    for (;;) {
-        int ret = get_video_frame(player, frame);
-        if (ret < 0) {
-            break;
-        }
-        if (ret == 0) {
-            continue;
-        }
-        if (last_w != frame->width
-            || last_h != frame->height
-            || last_format != frame->format
-            || last_serial != ff_decoder_get_packet_serial(player->video_decoder)) {
-            av_log(
-                NULL,
-            AV_LOG_DEBUG,
-               "Video frame changed from "
-               "size:%dx%d "
-               "format:%s "
-               "serial:%d to "
-               "size:%dx%d "
-               "format:%s "
-               "serial:%d\n",
-               last_w, last_h,
-               (const char*)av_x_if_null(av_get_pix_fmt_name(last_format), "none"),
-               last_serial,
-               frame->width, frame->height,
-               (const char*)av_x_if_null(av_get_pix_fmt_name(frame->format), "none"),
-               ff_decoder_get_packet_serial(player->video_decoder)
+static int video_filter_configured(ff_player_t* player, video_filter_t* filter, const AVFrame* frame) {
+    filter->last_w = frame->width;
+    filter->last_h = frame->height;
+    filter->last_format = frame->format;
+    if (filter->filter_out != NULL) {
+        filter->frame_rate = av_buffersink_get_frame_rate(filter->filter_out);
+    } else {
+        filter->frame_rate = av_guess_frame_rate(player->format_context, player->video_stream, NULL);
+        if (filter->bypass_format != frame->format && filter->scaler == NULL) {
+            const ff_stream_params_t* params = &player->opts.video_stream_params;
+            filter->scaler = ff_video_scaler_create(
+                params->extended.video.sws_opts,
+                params->filter_nb_threads > 0 ? params->filter_nb_threads : av_cpu_count()
             );
-            avfilter_graph_free(&graph);
-            graph = avfilter_graph_alloc();
-            if (!graph) {
-                ret = AVERROR(ENOMEM);
-                break;
+            if (filter->scaler == NULL) {
+                return AVERROR(ENOMEM);
             }
-            ret = configure_video_filters(player, graph, frame);
-            if (ret < 0) {
-                break;
-            }
-            filter_in  = player->in_video_filter;
-            filter_out = player->out_video_filter;
-            last_w = frame->width;
-            last_h = frame->height;
-            last_format = frame->format;
-            last_serial = ff_decoder_get_packet_serial(player->video_decoder);
-            frame_rate = av_buffersink_get_frame_rate(filter_out);
         }
-        ret = av_buffersrc_add_frame(filter_in, frame);
+    }
+    return 0;
+}
+
+static int drain_video_filters(ff_player_t* player, video_filter_t* filter, const int serial) {
+    if (filter->filter_in == NULL) {
+        return 0;
+    }
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    int ret = av_buffersrc_add_frame(filter->filter_in, NULL);
+    while (ret >= 0) {
+        ret = av_buffersink_get_frame_flags(filter->filter_out, frame, 0);
         if (ret < 0) {
             break;
         }
-        while (ret >= 0) {
-            player->frame_last_returned_time = (double)av_gettime_relative() / 1000000.0;
-
-            ret = av_buffersink_get_frame_flags(filter_out, frame, 0);
-            if (ret < 0) {
-                if (ret == AVERROR_EOF) {
-                    ff_decoder_set_finished(player->video_decoder);
-                }
-                ret = 0;
-                break;
-            }
-            const ff_frame_data_t* frame_data = frame->opaque_ref ? (ff_frame_data_t*)frame->opaque_ref->data : NULL;
-
-            player->frame_last_filter_delay = (double)av_gettime_relative() / 1000000.0 - player->frame_last_returned_time;
-            if (fabs(player->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0) {
-                player->frame_last_filter_delay = 0;
-            }
-            const AVRational time_base = av_buffersink_get_time_base(filter_out);
-            double duration = 0.0;
-            if (frame_rate.num != 0 && frame_rate.den != 0) {
-                const AVRational frame_rate_reversed = {frame_rate.den, frame_rate.num};
-                duration = av_q2d(frame_rate_reversed);
-            }
-            double pts = NAN;
-            if (frame->pts != AV_NOPTS_VALUE) {
-                pts = (double)frame->pts * av_q2d(time_base);
-            }
-            int64_t pos = -1;
-            if (frame_data != NULL) {
-                pos = frame_data->pkt_pos;
-            }
-            ret = queue_picture(
-                player,
-                frame,
-                pts,
-                duration,
-                pos,
-                ff_decoder_get_packet_serial(player->video_decoder)
-            );
+        if (get_frame_serial(frame, serial) != serial) {
             av_frame_unref(frame);
-            if (ff_packet_queue_get_serial(player->video_packet_queue) != ff_decoder_get_packet_serial(player->video_decoder)) {
-                break;
-            }
-        }
-        if (ret < 0) {
-            break;
+            continue;
         }
+        ret = output_video_frame(player, frame, av_buffersink_get_time_base(filter->filter_out), filter->frame_rate, serial);
     }
-    avfilter_graph_free(&graph);
     av_frame_free(&frame);
-    return 0;
+
+    return ret == AVERROR_EOF || ret == AVERROR(EAGAIN) ? 0 : ret;
 }
 
-static int stream_has_enough_packets(const AVStream* stream, const int stream_id, const ff_packet_queue_t* queue) {
-    return stream_id < 0 ||
-           ff_packet_queue_get_aborted(queue) ||
-           (stream->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
-           ff_packet_queue_get_packet_count(queue) > MIN_FRAMES && (ff_packet_queue_get_duration(queue) == 0 || av_q2d(stream->time_base) * (double)ff_packet_queue_get_duration(queue) > 1);
+static int filter_video_frame(ff_player_t* player, video_filter_t* filter, AVFrame* frame, const int serial) {
+    ff_stream_params_t* params = &player->opts.video_stream_params;
+    char* previous_filters = NULL;
+    const bool updated = filter_update_swap(player, &player->video_filter_update, params, &previous_filters);
+    int ret = 0;
+    if (updated) {
+        // the old graph hands over what it still holds before it is replaced
+        ret = drain_video_filters(player, filter, serial);
+        if (ret < 0) {
+            av_free(previous_filters);
+            return ret;
+        }
+        filter->last_format = -2;
+    }
+    // stateful filters must not carry history across a seek, any other
+    // graph is kept and only loses its stale output
+    if (serial != filter->last_serial && filter->filter_in != NULL &&
+        !is_filter_graph_stateless(filter->graph)) {
+        discard_filter_output(filter->filter_in, filter->filter_out);
+        filter->last_format = -2;
+    }
+    if (is_video_filter_changed(filter, frame)) {
+        av_log(
+            NULL,
+        AV_LOG_DEBUG,
+           "Video frame changed from "
+           "size:%dx%d "
+           "format:%s "
+           "serial:%d to "
+           "size:%dx%d "
+           "format:%s "
+           "serial:%d\n",
+           filter->last_w, filter->last_h,
+           (const char*)av_x_if_null(av_get_pix_fmt_name(filter->last_format), "none"),
+           filter->last_serial,
+           frame->width, frame->height,
+           (const char*)av_x_if_null(av_get_pix_fmt_name(frame->format), "none"),
+           serial
+        );
+        ret = configure_video_filters(
+            player,
+            params->filters,
+            frame,
+            &filter->graph,
+            &filter->filter_in,
+            &filter->filter_out,
+            &filter->bypass_format
+        );
+        if (ret < 0 && updated) {
+            filter_update_revert(player, params, &previous_filters);
+            ret = configure_video_filters(
+                player,
+                params->filters,
+                frame,
+                &filter->graph,
+                &filter->filter_in,
+                &filter->filter_out,
+                &filter->bypass_format
+            );
+        }
+        av_freep(&previous_filters);
+        if (ret < 0) {
+            return ret;
+        }
+        ret = video_filter_configured(player, filter, frame);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    run_filter_commands(player, &player->video_filter_update, filter->graph);
+    filter->last_serial = serial;
+    if (filter->filter_in == NULL) {
+        player->frame_last_filter_delay = 0;
+        if (filter->bypass_format != frame->format) {
+            ret = ff_video_scaler_convert(filter->scaler, filter->converted_frame, frame, filter->bypass_format);
+            av_frame_unref(frame);
+            if (ret < 0) {
+                return ret;
+            }
+            av_frame_move_ref(frame, filter->converted_frame);
+        }
+        return output_video_frame(player, frame, player->video_stream->time_base, filter->frame_rate, serial);
+    }
+    ret = av_buffersrc_add_frame(filter->filter_in, frame);
+    if (ret < 0) {
+        return ret;
+    }
+    while (ret >= 0) {
+        player->frame_last_returned_time = (double)av_gettime_relative() / 1000000.0;
+
+        ret = av_buffersink_get_frame_flags(filter->filter_out, frame, 0);
+        if (ret < 0) {
+            if (ret == AVERROR_EOF) {
+                ff_decoder_set_finished(player->video_decoder, serial);
+            }
+            ret = 0;
+            break;
+        }
+        if (get_frame_serial(frame, serial) != serial) {
+            av_frame_unref(frame);
+            continue;
+        }
+        double filter_delay = (double)av_gettime_relative() / 1000000.0 - player->frame_last_returned_time;
+        if (fabs(filter_delay) > AV_NOSYNC_THRESHOLD / 10.0) {
+            filter_delay = 0;
+        }
+        player->frame_last_filter_delay = (long long)(filter_delay * 1000000.0);
+        ret = output_video_frame(player, frame, av_buffersink_get_time_base(filter->filter_out), filter->frame_rate, serial);
+        if (ff_packet_queue_get_serial(player->video_packet_queue) != serial) {
+            break;
+        }
+    }
+    return ret;
 }
 
-static int stream_open(ff_player_t* player, const int stream_index, const ff_stream_params_t* params) {
-    const AVFormatContext* format_context = player->format_context;
-    if (stream_index < 0 || stream_index >= format_context->nb_streams) {
-        return AVERROR(EINVAL);
+static int video_filter_thread(void* arg) {
+    ff_player_t* player = arg;
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+        return AVERROR(ENOMEM);
     }
-    AVCodecContext* codec_context = avcodec_alloc_context3(NULL);
-    if (codec_context == NULL) {
+    video_filter_t* filter = &(video_filter_t){0};
+    int ret = video_filter_init(player, filter);
+    if (ret < 0) {
+        av_frame_free(&frame);
+        return ret;
+    }
+    for (;;) {
+        ff_frame_t* item = ff_frame_queue_peek_readable(player->video_filter_queue);
+        if (item == NULL) {
+            break;
+        }
+        const int serial = item->serial;
+        av_frame_move_ref(frame, item->base);
+        ff_frame_queue_next(player->video_filter_queue);
+        if (ret < 0 || serial != ff_packet_queue_get_serial(player->video_packet_queue)) {
+            // a failed stage keeps draining so the decoding side never blocks on it
+            av_frame_unref(frame);
+            continue;
+        }
+        ret = filter_video_frame(player, filter, frame, serial);
+    }
+    video_filter_uninit(filter);
+    av_frame_free(&frame);
+
+    return 0;
+}
+
+static int video_decode_thread(ff_player_t* player) {
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
         return AVERROR(ENOMEM);
     }
-    AVStream* stream = format_context->streams[stream_index];
+    player->video_filter_queue = ff_frame_queue_create(player->video_packet_queue, VIDEO_FILTER_QUEUE_SIZE, false);
+    if (player->video_filter_queue == NULL) {
+        av_frame_free(&frame);
+        return AVERROR(ENOMEM);
+    }
+    thrd_t filter_thread;
+    if (thrd_create(&filter_thread, video_filter_thread, player) != thrd_success) {
+        ff_frame_queue_destroy(player->video_filter_queue);
+        player->video_filter_queue = NULL;
+        av_frame_free(&frame);
+        return AVERROR(ENOMEM);
+    }
+    for (;;) {
+        const int ret = get_video_frame(player, frame);
+        if (ret < 0) {
+            break;
+        }
+        if (ret == 0) {
+            continue;
+        }
+        ff_frame_t* item = ff_frame_queue_peek_writable(player->video_filter_queue);
+        if (item == NULL) {
+            av_frame_unref(frame);
+            break;
+        }
+        item->serial = ff_decoder_get_packet_serial(player->video_decoder);
+        av_frame_move_ref(item->base, frame);
+        ff_frame_queue_push(player->video_filter_queue);
+    }
+    if (!ff_packet_queue_get_aborted(player->video_packet_queue)) {
+        ff_packet_queue_abort(player->video_packet_queue);
+    }
+    ff_frame_queue_signal(player->video_filter_queue);
+    thrd_join(filter_thread, NULL);
 
-    int ret = avcodec_parameters_to_context(codec_context, stream->codecpar);
-    if (ret >= 0) {
-        codec_context->pkt_timebase = stream->time_base;
+    ff_frame_queue_destroy(player->video_filter_queue);
+    player->video_filter_queue = NULL;
+    av_frame_free(&frame);
 
-        const char *forced_codec_name = NULL;
-        const AVCodec* codec = avcodec_find_decoder(codec_context->codec_id);
-        switch(codec_context->codec_type) {
-        case AVMEDIA_TYPE_AUDIO:
-            player->last_audio_stream_index = stream_index;
-            forced_codec_name = params->codec_name;
+    return 0;
+}
+
+static int video_thread(void* arg) {
+    ff_player_t* player = arg;
+    if (player->opts.video_stream_params.extended.video.threaded_filters) {
+        return video_decode_thread(player);
+    }
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    video_filter_t* filter = &(video_filter_t){0};
+    int ret = video_filter_init(player, filter);
+    if (ret < 0) {
+        av_frame_free(&frame);
+        return ret;
+    }
+    for (;;) {
+        ret = get_video_frame(player, frame);
+        if (ret < 0) {
             break;
-        case AVMEDIA_TYPE_VIDEO:
-            player->last_video_stream_index = stream_index;
-            forced_codec_name = params->codec_name;
+        }
+        if (ret == 0) {
+            continue;
+        }
+        ret = filter_video_frame(player, filter, frame, ff_decoder_get_packet_serial(player->video_decoder));
+        if (ret < 0) {
             break;
-        default:
+        }
+    }
+    video_filter_uninit(filter);
+    av_frame_free(&frame);
+    return 0;
+}
+
+static void get_subtitle_canvas_size(const ff_player_t* player, const ff_frame_t* sp, int* width, int* height) {
+    *width = sp->width;
+    *height = sp->height;
+    if ((*width == 0 || *height == 0) && player->video_stream != NULL) {
+        *width = player->video_stream->codecpar->width;
+        *height = player->video_stream->codecpar->height;
+    }
+    if (*width == 0 || *height == 0) {
+        for (unsigned int i = 0; i < sp->sub.num_rects; ++i) {
+            const AVSubtitleRect* rect = sp->sub.rects[i];
+            *width = FFMAX(*width, rect->x + rect->w);
+            *height = FFMAX(*height, rect->y + rect->h);
+        }
+    }
+}
+
+// converts the bitmaps at the subtitle's own resolution, so that an overlay
+// stays valid whatever size the host draws it at
+static int render_subtitle(ff_player_t* player, ff_frame_t* sp) {
+    int canvas_width;
+    int canvas_height;
+    get_subtitle_canvas_size(player, sp, &canvas_width, &canvas_height);
+    if (canvas_width <= 0 || canvas_height <= 0) {
+        return 0;
+    }
+    sp->width = canvas_width;
+    sp->height = canvas_height;
+
+    sp->sub_rects = (ff_subtitle_rect_t*)av_calloc(sp->sub.num_rects, sizeof(ff_subtitle_rect_t));
+    if (sp->sub_rects == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    for (unsigned int i = 0; i < sp->sub.num_rects; ++i) {
+        const AVSubtitleRect* rect = sp->sub.rects[i];
+        if (rect->type != SUBTITLE_BITMAP) {
+            continue;
+        }
+        const int x = av_clip(rect->x, 0, canvas_width);
+        const int y = av_clip(rect->y, 0, canvas_height);
+        const int w = av_clip(rect->w, 0, canvas_width - x);
+        const int h = av_clip(rect->h, 0, canvas_height - y);
+        if (w == 0 || h == 0) {
+            continue;
+        }
+        ff_subtitle_rect_t* sub_rect = sp->sub_rects + sp->nb_sub_rects;
+        sub_rect->x = x;
+        sub_rect->y = y;
+        sub_rect->width = w;
+        sub_rect->height = h;
+        player->sub_convert_context = sws_getCachedContext(
+            player->sub_convert_context,
+            w, h, AV_PIX_FMT_PAL8,
+            w, h, AV_PIX_FMT_BGRA,
+            SWS_BICUBIC, NULL, NULL, NULL
+        );
+        if (player->sub_convert_context == NULL) {
+            av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+            return AVERROR(EINVAL);
+        }
+        sub_rect->linesize = sub_rect->width * 4;
+        sub_rect->data = (uint8_t*)av_malloc((size_t)sub_rect->linesize * sub_rect->height);
+        if (sub_rect->data == NULL) {
+            return AVERROR(ENOMEM);
+        }
+        const uint8_t* src[4] = { rect->data[0] + (y - rect->y) * rect->linesize[0] + (x - rect->x), rect->data[1], NULL, NULL };
+        sws_scale(
+            player->sub_convert_context,
+            src,
+            rect->linesize,
+            0,
+            h,
+            &sub_rect->data,
+            &sub_rect->linesize
+        );
+        ++sp->nb_sub_rects;
+    }
+    return 0;
+}
+
+static int subtitle_thread(void* arg) {
+    ff_player_t* player = arg;
+
+    for (;;) {
+        ff_frame_t* sp = ff_frame_queue_peek_writable(player->subpicture_queue);
+        if (sp == NULL) {
+            return 0;
+        }
+        const int got_subtitle = ff_decoder_decode_subtitle(player->subtitle_decoder, &sp->sub);
+        if (got_subtitle < 0) {
             break;
         }
-        if (forced_codec_name != NULL) {
-            codec = avcodec_find_decoder_by_name(forced_codec_name);
+        if (got_subtitle && sp->sub.format == 0) {
+            sp->pts = sp->sub.pts != AV_NOPTS_VALUE ? (double)sp->sub.pts / AV_TIME_BASE : 0.0;
+            sp->serial = ff_decoder_get_packet_serial(player->subtitle_decoder);
+            sp->width = ff_decoder_get_codec_context(player->subtitle_decoder)->width;
+            sp->height = ff_decoder_get_codec_context(player->subtitle_decoder)->height;
+            sp->uploaded = false;
+
+            if (render_subtitle(player, sp) < 0) {
+                av_log(NULL, AV_LOG_WARNING, "Could not render subtitle at %0.3f\n", sp->pts);
+            }
+            ff_frame_queue_push(player->subpicture_queue);
+        } else if (got_subtitle) {
+            avsubtitle_free(&sp->sub);
         }
-        if (codec == NULL) {
-            if (forced_codec_name != NULL) {
-                av_log(
-                    NULL,
-                    AV_LOG_WARNING,
-                    "No codec could be found with name '%s'\n",
-                    forced_codec_name
-                );
+    }
+    return 0;
+}
+
+static int synchronize_audio(ff_player_t* player, const int sample_count) {
+    int wanted_sample_count = sample_count;
+
+    if (get_master_sync_type(player) != FF_AV_SYNC_AUDIO_MASTER) {
+        const double diff = ff_clock_get(&player->audio_clock) - get_master_clock(player);
+
+        if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
+            player->audio_diff_cum = diff + player->audio_diff_avg_coef * player->audio_diff_cum;
+            if (player->audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
+                ++player->audio_diff_avg_count;
             } else {
-                av_log(
-                    NULL,
-                    AV_LOG_WARNING,
-                    "No decoder could be found for codec %s\n",
-                    avcodec_get_name(codec_context->codec_id)
-                );
-            }
-            ret = AVERROR(EINVAL);
-        } else {
-            int stream_lowres = params->lowres;
-            codec_context->codec_id = codec->id;
-            if (stream_lowres > codec->max_lowres) {
-                av_log(
-                    codec_context,
-                    AV_LOG_WARNING,
-                    "The maximum value for lowres supported by the decoder is %d\n",
-                        codec->max_lowres
-                );
-                stream_lowres = codec->max_lowres;
-            }
-            codec_context->lowres = stream_lowres;
+                const double avg_diff = player->audio_diff_cum * (1.0 - player->audio_diff_avg_coef);
 
-            if (params->fast) {
-                codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
-            }
-            AVDictionary *opts = NULL;
-            ret = av_dict_copy(&opts, params->codec_opts, 0);
-            if (ret >= 0) {
-                // if (!av_dict_get(opts, "threads", NULL, 0)) {
-                //     av_dict_set(&opts, "threads", "auto", 0);
-                // }
-                if (stream_lowres) {
-                    av_dict_set_int(&opts, "lowres", stream_lowres, 0);
-                }
-                av_dict_set(&opts, "flags", "+copy_opaque", AV_DICT_MULTIKEY);
-                ret = avcodec_open2(codec_context, codec, &opts);
-                av_dict_free(&opts);
-                if (ret >= 0) {
-                    player->eof = false;
-                    stream->discard = AVDISCARD_DEFAULT;
-                    switch (codec_context->codec_type) {
-                    case AVMEDIA_TYPE_AUDIO:
-                        player->audio_filter_source.freq = codec_context->sample_rate;
-                        ret = av_channel_layout_copy(&player->audio_filter_source.ch_layout, &codec_context->ch_layout);
-                        if (ret < 0) {
-                            break;
-                        }
-                        player->audio_filter_source.fmt = codec_context->sample_fmt;
-                        ret = configure_audio_filters(player, false);
-                        if (ret >= 0) {
-                            const AVFilterContext* sink = player->out_audio_filter;
-                            const int sample_rate = av_buffersink_get_sample_rate(sink);
-
-                            AVChannelLayout* ch_layout = &(AVChannelLayout){0};
-                            ret = av_buffersink_get_ch_layout(sink, ch_layout);
-                            if (ret >= 0) {
-                                if (params->extended.audio.meta_cb != NULL) {
-                                    ret = params->extended.audio.meta_cb(
-                                        player->opts.opaque,
-                                        ch_layout,
-                                        sample_rate,
-                                        &player->audio_target
-                                    );
-                                }
-                                av_channel_layout_uninit(ch_layout);
-                                if (ret >= 0) {
-                                    player->audio_decoder = ff_decoder_create(codec_context, player->audio_packet_queue, &player->continue_read_thread, false);
-                                    if (player->audio_decoder == NULL) {
-                                        ret = AVERROR(ENOMEM);
-                                        break;
-                                    }
-                                    if (player->format_context->iformat->flags & AVFMT_NOTIMESTAMPS) {
-                                        ff_decoder_set_start_pts(player->audio_decoder, player->audio_stream->start_time, player->audio_stream->time_base);
-                                    }
-                                    ret = ff_decoder_start(player->audio_decoder, audio_thread, player);
-                                    if (ret >= 0) {
-                                        player->audio_hw_buf_size = ret;
-                                        player->audio_source = player->audio_target;
-
-                                        player->audio_diff_avg_coef  = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
-                                        player->audio_diff_avg_count = 0;
-                                        player->audio_diff_threshold = (double)player->audio_hw_buf_size / player->audio_target.bytes_per_sec;
-
-                                        player->audio_stream_index = stream_index;
-                                        player->audio_stream = format_context->streams[stream_index];
-                                    } else {
-                                        ff_decoder_destroy(player->audio_decoder);
-                                        player->audio_decoder = NULL;
-                                    }
-                                    return ret;
-                                }
-                            }
-                            avfilter_graph_free(&player->audio_graph);
-                        }
-                        break;
-                    case AVMEDIA_TYPE_VIDEO:
-                        player->video_decoder = ff_decoder_create(codec_context, player->video_packet_queue, &player->continue_read_thread, params->extended.video.reorder_pts);
-                        if (player->video_decoder == NULL) {
-                            ret = AVERROR(ENOMEM);
-                            break;
-                        }
-                        ret = ff_decoder_start(player->video_decoder, video_thread, player);
-                        if (ret >= 0) {
-                            player->video_stream_index = stream_index;
-                            player->video_stream = format_context->streams[stream_index];
-                            player->queue_attachments_req = true;
-                        } else {
-                            ff_decoder_destroy(player->video_decoder);
-                            player->video_decoder = NULL;
-                        }
-                        return ret;
-                    default:
-                        break;
-                    }
+                if (fabs(avg_diff) >= player->audio_diff_threshold) {
+                    wanted_sample_count = sample_count + (int)(diff * player->audio_source.freq);
+                    const int min_nb_samples = ((sample_count * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+                    const int max_nb_samples = ((sample_count * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+                    wanted_sample_count = av_clip(wanted_sample_count, min_nb_samples, max_nb_samples);
                 }
+                av_log(NULL, AV_LOG_TRACE, "diff=%f adiff=%f sample_diff=%d apts=%0.3f %f\n",
+                        diff, avg_diff, wanted_sample_count - sample_count,
+                        player->audio_clock_value, player->audio_diff_threshold);
             }
+        } else {
+            player->audio_diff_avg_count = 0;
+            player->audio_diff_cum = 0;
+        }
+    }
+    return wanted_sample_count;
+}
+
+static uint8_t* convert_audio_frame(ff_player_t* player, ff_audio_gain_t* gain, int* size, double* pts, int* serial) {
+    ff_frame_t* frame;
+
+    do {
+        frame = ff_frame_queue_peek_readable(player->sampler_queue);
+        if (frame == NULL) {
+            return NULL;
         }
+        ff_frame_queue_next(player->sampler_queue);
+    } while (frame->serial != ff_packet_queue_get_serial(player->audio_packet_queue));
+
+    const int data_size = av_samples_get_buffer_size(
+        NULL,
+        frame->base->ch_layout.nb_channels,
+        frame->base->nb_samples,
+        frame->base->format,
+        1
+    );
+    const int wanted_nb_samples = synchronize_audio(player, frame->base->nb_samples);
+
+    if (frame->base->format != player->audio_source.fmt ||
+        av_channel_layout_compare(&frame->base->ch_layout, &player->audio_source.ch_layout) ||
+        frame->base->sample_rate != player->audio_source.freq ||
+        (wanted_nb_samples != frame->base->nb_samples && !player->swr_context)) {
+        swr_free(&player->swr_context);
+        const int ret = swr_alloc_set_opts2(
+            &player->swr_context,
+            &player->audio_target.ch_layout,
+            player->audio_target.fmt,
+            player->audio_target.freq,
+            &frame->base->ch_layout,
+            frame->base->format,
+            frame->base->sample_rate,
+            0,
+            NULL
+        );
+        if (ret < 0 || swr_init(player->swr_context) < 0) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
+                    frame->base->sample_rate, av_get_sample_fmt_name(frame->base->format), frame->base->ch_layout.nb_channels,
+                    player->audio_target.freq, av_get_sample_fmt_name(player->audio_target.fmt), player->audio_target.ch_layout.nb_channels);
+            swr_free(&player->swr_context);
+            return NULL;
+        }
+        if (av_channel_layout_copy(&player->audio_source.ch_layout, &frame->base->ch_layout) < 0) {
+            return NULL;
+        }
+        player->audio_source.freq = frame->base->sample_rate;
+        player->audio_source.fmt = frame->base->format;
+    }
+    int resampled_data_size;
+    uint8_t* audio_buf;
+    const int nb_channels = player->audio_target.ch_layout.nb_channels;
+    if (player->swr_context != NULL) {
+        const uint8_t** in = (const uint8_t**)frame->base->extended_data;
+        const int out_count = wanted_nb_samples * player->audio_target.freq / frame->base->sample_rate + 256;
+        const int out_size = av_samples_get_buffer_size(NULL, nb_channels, out_count, player->audio_target.fmt, 1);
+        if (out_size < 0) {
+            av_log(NULL, AV_LOG_ERROR, "av_samples_get_buffer_size() failed\n");
+            return NULL;
+        }
+        if (wanted_nb_samples != frame->base->nb_samples) {
+            if (swr_set_compensation(player->swr_context, (wanted_nb_samples - frame->base->nb_samples) * player->audio_target.freq / frame->base->sample_rate,
+                                        wanted_nb_samples * player->audio_target.freq / frame->base->sample_rate) < 0) {
+                av_log(NULL, AV_LOG_ERROR, "swr_set_compensation() failed\n");
+                return NULL;
+            }
+        }
+        av_fast_malloc(&player->swr_buf, &player->swr_buf_size, out_size);
+        if (player->swr_buf == NULL) {
+            return NULL;
+        }
+        av_fast_malloc(&player->swr_planes, &player->swr_planes_size, nb_channels * sizeof(uint8_t*));
+        if (player->swr_planes == NULL) {
+            return NULL;
+        }
+        av_samples_fill_arrays(player->swr_planes, NULL, player->swr_buf, nb_channels, out_count, player->audio_target.fmt, 1);
+        const int len2 = swr_convert(player->swr_context, player->swr_planes, out_count, in, frame->base->nb_samples);
+        if (len2 < 0) {
+            av_log(NULL, AV_LOG_ERROR, "swr_convert() failed\n");
+            return NULL;
+        }
+        if (len2 == out_count) {
+            av_log(NULL, AV_LOG_WARNING, "audio buffer is probably too small\n");
+            if (swr_init(player->swr_context) < 0) {
+                swr_free(&player->swr_context);
+            }
+        }
+        ff_audio_gain_apply(
+            gain,
+            player->swr_buf,
+            (const uint8_t* const*)player->swr_planes,
+            player->audio_target.fmt,
+            nb_channels,
+            len2
+        );
+        audio_buf = player->swr_buf;
+        resampled_data_size = len2 * nb_channels * av_get_bytes_per_sample(player->audio_target.fmt);
+    } else if ((av_sample_fmt_is_planar(frame->base->format) && frame->base->ch_layout.nb_channels > 1) ||
+               !ff_audio_gain_is_unity(gain)) {
+        av_fast_malloc(&player->swr_buf, &player->swr_buf_size, data_size);
+        if (player->swr_buf == NULL) {
+            return NULL;
+        }
+        ff_audio_gain_apply(
+            gain,
+            player->swr_buf,
+            (const uint8_t* const*)frame->base->extended_data,
+            frame->base->format,
+            frame->base->ch_layout.nb_channels,
+            frame->base->nb_samples
+        );
+        audio_buf = player->swr_buf;
+        resampled_data_size = data_size;
+    } else {
+        audio_buf = frame->base->data[0];
+        resampled_data_size = data_size;
+    }
+    if (!isnan(frame->pts)) {
+        *pts = frame->pts + (double)frame->base->nb_samples / frame->base->sample_rate;
+    } else {
+        *pts = NAN;
+    }
+    *serial = frame->serial;
+    *size = resampled_data_size;
+
+    return audio_buf;
+}
+
+static void audio_ring_close(ff_player_t* player) {
+    if (player->audio_ring != NULL) {
+        ff_audio_ring_destroy(player->audio_ring);
+        player->audio_ring = NULL;
+    }
+}
+
+static int audio_convert_thread(void* arg) {
+    ff_player_t* player = arg;
+    ff_audio_gain_t unity_gain;
+    ff_audio_gain_init(&unity_gain, 1.0f, 0);
+
+    int errors = 0;
+    while (!ff_packet_queue_get_aborted(player->audio_packet_queue)) {
+        int size;
+        double pts;
+        int serial;
+        const uint8_t* audio_buf = convert_audio_frame(player, &unity_gain, &size, &pts, &serial);
+        if (audio_buf == NULL) {
+            if (ff_packet_queue_get_aborted(player->audio_packet_queue)) {
+                break;
+            }
+            // a broken converter would otherwise drop every frame as fast as it is decoded
+            if (++errors >= AUDIO_CONVERT_MAX_ERRORS) {
+                av_log(NULL, AV_LOG_ERROR, "Audio conversion keeps failing, stopping audio output\n");
+                if (player->opts.on_error_cb != NULL) {
+                    player->opts.on_error_cb(player->opts.opaque, AVERROR_EXTERNAL);
+                }
+                return AVERROR_EXTERNAL;
+            }
+            av_usleep(AUDIO_RING_POLL_INTERVAL);
+            continue;
+        }
+        errors = 0;
+        int written = 0;
+        while (written < size && !ff_packet_queue_get_aborted(player->audio_packet_queue)) {
+            size_t len = ff_audio_ring_get_free(player->audio_ring);
+            len = FFMIN(len, (size_t)(size - written));
+            len -= len % player->audio_target.frame_size;
+            if (len == 0) {
+                av_usleep(AUDIO_RING_POLL_INTERVAL);
+                continue;
+            }
+            const double chunk_pts = pts - (double)(size - written - (int)len) / player->audio_target.bytes_per_sec;
+            if (ff_audio_ring_write(player->audio_ring, audio_buf + written, len, chunk_pts, serial) >= 0) {
+                written += (int)len;
+            }
+        }
+    }
+    return 0;
+}
+
+static int stream_has_enough_packets(const AVStream* stream, const int stream_id, const ff_packet_queue_t* queue) {
+    return stream_id < 0 ||
+           ff_packet_queue_get_aborted(queue) ||
+           (stream->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
+           ff_packet_queue_get_packet_count(queue) > MIN_FRAMES && (ff_packet_queue_get_duration(queue) == 0 || av_q2d(stream->time_base) * (double)ff_packet_queue_get_duration(queue) > 1);
+}
+
+static int codec_context_open(AVCodecContext** codec_context_ptr, const AVStream* stream, const ff_stream_params_t* params) {
+    AVCodecContext* codec_context = avcodec_alloc_context3(NULL);
+    if (codec_context == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    int ret = avcodec_parameters_to_context(codec_context, stream->codecpar);
+    if (ret >= 0) {
+        codec_context->pkt_timebase = stream->time_base;
+
+        const char* forced_codec_name = params->codec_name;
+        const AVCodec* codec = avcodec_find_decoder(codec_context->codec_id);
+        if (forced_codec_name != NULL) {
+            codec = avcodec_find_decoder_by_name(forced_codec_name);
+        }
+        if (codec == NULL) {
+            if (forced_codec_name != NULL) {
+                av_log(
+                    NULL,
+                    AV_LOG_WARNING,
+                    "No codec could be found with name '%s'\n",
+                    forced_codec_name
+                );
+            } else {
+                av_log(
+                    NULL,
+                    AV_LOG_WARNING,
+                    "No decoder could be found for codec %s\n",
+                    avcodec_get_name(codec_context->codec_id)
+                );
+            }
+            ret = AVERROR(EINVAL);
+        } else {
+            int stream_lowres = params->lowres;
+            codec_context->codec_id = codec->id;
+            if (stream_lowres > codec->max_lowres) {
+                av_log(
+                    codec_context,
+                    AV_LOG_WARNING,
+                    "The maximum value for lowres supported by the decoder is %d\n",
+                        codec->max_lowres
+                );
+                stream_lowres = codec->max_lowres;
+            }
+            codec_context->lowres = stream_lowres;
+
+            if (params->fast) {
+                codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+            }
+            AVDictionary *opts = NULL;
+            ret = av_dict_copy(&opts, params->codec_opts, 0);
+            if (ret >= 0) {
+                // if (!av_dict_get(opts, "threads", NULL, 0)) {
+                //     av_dict_set(&opts, "threads", "auto", 0);
+                // }
+                if (stream_lowres) {
+                    av_dict_set_int(&opts, "lowres", stream_lowres, 0);
+                }
+                av_dict_set(&opts, "flags", "+copy_opaque", AV_DICT_MULTIKEY);
+                ret = avcodec_open2(codec_context, codec, &opts);
+                av_dict_free(&opts);
+                if (ret >= 0) {
+                    *codec_context_ptr = codec_context;
+                    return ret;
+                }
+            }
+        }
+    }
+    avcodec_free_context(&codec_context);
+
+    return ret;
+}
+
+static const ff_decoder_cache_key_t* get_decoder_cache_key(const ff_player_t* player, const AVStream* stream, ff_decoder_cache_key_t* key) {
+    const ff_stream_params_t* params = &player->opts.subtitle_stream_params;
+    bool reorder_pts = false;
+    if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+        params = &player->opts.audio_stream_params;
+    } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        params = &player->opts.video_stream_params;
+        reorder_pts = params->extended.video.reorder_pts;
+    }
+    *key = (ff_decoder_cache_key_t){
+        .codecpar = stream->codecpar,
+        .codec_name = params->codec_name,
+        .codec_opts = params->codec_opts,
+        .lowres = params->lowres,
+        .fast = params->fast,
+        .reorder_pts = reorder_pts
+    };
+    return key;
+}
+
+// fills in the sizes a meta callback left unset; the ring and the gain work
+// in whole sample frames
+static int complete_audio_target(ff_audio_params_t* target) {
+    if (target->frame_size <= 0) {
+        target->frame_size = av_samples_get_buffer_size(NULL, target->ch_layout.nb_channels, 1, target->fmt, 1);
+    }
+    if (target->bytes_per_sec <= 0) {
+        target->bytes_per_sec = av_samples_get_buffer_size(NULL, target->ch_layout.nb_channels, target->freq, target->fmt, 1);
+    }
+    if (target->frame_size <= 0 || target->bytes_per_sec <= 0) {
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int stream_open(ff_player_t* player, const int stream_index, const ff_stream_params_t* params) {
+    const AVFormatContext* format_context = player->format_context;
+    if (stream_index < 0 || stream_index >= format_context->nb_streams) {
+        return AVERROR(EINVAL);
+    }
+    AVStream* stream = format_context->streams[stream_index];
+    ff_packet_queue_t* packet_queue;
+    bool reorder_pts = false;
+    switch (stream->codecpar->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+        player->last_audio_stream_index = stream_index;
+        packet_queue = player->audio_packet_queue;
+        break;
+    case AVMEDIA_TYPE_VIDEO:
+        player->last_video_stream_index = stream_index;
+        packet_queue = player->video_packet_queue;
+        reorder_pts = params->extended.video.reorder_pts;
+        break;
+    case AVMEDIA_TYPE_SUBTITLE:
+        player->last_subtitle_stream_index = stream_index;
+        packet_queue = player->subtitle_packet_queue;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    int ret = 0;
+    ff_decoder_t* decoder = ff_decoder_cache_take(player->decoder_cache, get_decoder_cache_key(player, stream, &(ff_decoder_cache_key_t){0}));
+    if (decoder != NULL) {
+        ff_decoder_rebind(decoder, packet_queue);
+    } else {
+        AVCodecContext* new_codec_context = NULL;
+        ret = codec_context_open(&new_codec_context, stream, params);
+        if (ret < 0) {
+            return ret;
+        }
+        decoder = ff_decoder_create(new_codec_context, packet_queue, &player->continue_read_thread, reorder_pts);
+        if (decoder == NULL) {
+            avcodec_free_context(&new_codec_context);
+            return AVERROR(ENOMEM);
+        }
+    }
+    const AVCodecContext* codec_context = ff_decoder_get_codec_context(decoder);
+    player->eof = false;
+    stream->discard = AVDISCARD_DEFAULT;
+    switch (codec_context->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+        player->audio_filter_source.freq = codec_context->sample_rate;
+        ret = av_channel_layout_copy(&player->audio_filter_source.ch_layout, &codec_context->ch_layout);
+        if (ret < 0) {
+            break;
+        }
+        player->audio_filter_source.fmt = codec_context->sample_fmt;
+        mtx_lock(&player->filter_mutex);
+        ret = configure_audio_filters(
+            player,
+            params->filters,
+            &player->audio_filter_source,
+            false,
+            &player->audio_graph,
+            &player->in_audio_filter,
+            &player->out_audio_filter
+        );
+        mtx_unlock(&player->filter_mutex);
+        if (ret >= 0) {
+            const AVFilterContext* sink = player->out_audio_filter;
+            const int sample_rate = av_buffersink_get_sample_rate(sink);
+
+            AVChannelLayout* ch_layout = &(AVChannelLayout){0};
+            ret = av_buffersink_get_ch_layout(sink, ch_layout);
+            if (ret >= 0) {
+                player->audio_target.fmt = av_buffersink_get_format(sink);
+                if (params->extended.audio.meta_cb != NULL) {
+                    ret = params->extended.audio.meta_cb(
+                        player->opts.opaque,
+                        ch_layout,
+                        sample_rate,
+                        &player->audio_target
+                    );
+                }
+                av_channel_layout_uninit(ch_layout);
+                if (ret >= 0 && player->opts.pull_audio) {
+                    if (av_sample_fmt_is_planar(player->audio_target.fmt)) {
+                        av_log(NULL, AV_LOG_ERROR, "Pulled audio requires a packed sample format\n");
+                        ret = AVERROR(EINVAL);
+                    } else if ((ret = complete_audio_target(&player->audio_target)) < 0) {
+                        av_log(NULL, AV_LOG_ERROR, "Pulled audio requires a valid output format\n");
+                    } else {
+                        player->audio_ring = ff_audio_ring_create((size_t)player->audio_target.bytes_per_sec * AUDIO_RING_MS / 1000, AUDIO_RING_CHUNKS);
+                        if (player->audio_ring == NULL) {
+                            ret = AVERROR(ENOMEM);
+                        }
+                    }
+                }
+                if (ret >= 0) {
+                    player->audio_decoder = decoder;
+                    if (player->format_context->iformat->flags & AVFMT_NOTIMESTAMPS) {
+                        ff_decoder_set_start_pts(player->audio_decoder, stream->start_time, stream->time_base);
+                    }
+                    ret = ff_decoder_start(player->audio_decoder, audio_thread, player);
+                    if (ret >= 0) {
+                        player->audio_hw_buf_size = ret;
+                        player->audio_source = player->audio_target;
+                        ff_audio_gain_init(&player->audio_gain, get_audio_gain(player), player->audio_target.freq * AUDIO_GAIN_RAMP_MS / 1000);
+
+                        player->audio_diff_avg_coef  = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
+                        player->audio_diff_avg_count = 0;
+                        player->audio_diff_threshold = (double)player->audio_hw_buf_size / player->audio_target.bytes_per_sec;
+
+                        ff_audio_pll_reset(&player->audio_pll);
+                        player->audio_bytes_delivered = 0;
+                        player->audio_tail_bytes = 0;
+                        player->audio_tail_pts = NAN;
+                        player->audio_position_reported = false;
+
+                        player->audio_stream_index = stream_index;
+                        player->audio_stream = format_context->streams[stream_index];
+
+                        if (player->audio_ring != NULL &&
+                            thrd_create(&player->audio_convert_thread, audio_convert_thread, player) != thrd_success) {
+                            ff_decoder_abort(player->audio_decoder, player->sampler_queue);
+                            ret = AVERROR(ENOMEM);
+                        }
+                    }
+                    if (ret < 0) {
+                        ff_decoder_destroy(player->audio_decoder);
+                        player->audio_decoder = NULL;
+                        player->audio_stream_index = -1;
+                        player->audio_stream = NULL;
+                        audio_ring_close(player);
+                    }
+                    return ret;
+                }
+                audio_ring_close(player);
+            }
+            avfilter_graph_free(&player->audio_graph);
+        }
+        break;
+    case AVMEDIA_TYPE_VIDEO:
+        if (ff_decoder_set_parallel(decoder, params->extended.video.parallel_decode) < 0) {
+            av_log(NULL, AV_LOG_WARNING, "Could not create parallel video decoders\n");
+        }
+        player->video_decoder = decoder;
+        ret = ff_decoder_start(player->video_decoder, video_thread, player);
+        if (ret >= 0) {
+            player->video_stream_index = stream_index;
+            player->video_stream = format_context->streams[stream_index];
+            player->queue_attachments_req = true;
+        } else {
+            ff_decoder_destroy(player->video_decoder);
+            player->video_decoder = NULL;
+        }
+        return ret;
+    case AVMEDIA_TYPE_SUBTITLE:
+        player->subtitle_decoder = decoder;
+        ret = ff_decoder_start(player->subtitle_decoder, subtitle_thread, player);
+        if (ret >= 0) {
+            player->subtitle_stream_index = stream_index;
+            player->subtitle_stream = format_context->streams[stream_index];
+        } else {
+            ff_decoder_destroy(player->subtitle_decoder);
+            player->subtitle_decoder = NULL;
+        }
+        return ret;
+    default:
+        break;
+    }
+    ff_decoder_destroy(decoder);
+
+    return ret;
+}
+
+static void stream_close(ff_player_t* player, const int stream_index) {
+    const AVFormatContext* format_context = player->format_context;
+    if (stream_index < 0 || stream_index >= format_context->nb_streams) {
+        return;
+    }
+    AVStream* stream = format_context->streams[stream_index];
+    switch (stream->codecpar->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+        ff_decoder_abort(player->audio_decoder, player->sampler_queue);
+        if (player->audio_ring != NULL) {
+            thrd_join(player->audio_convert_thread, NULL);
+            audio_ring_close(player);
+        }
+        ff_decoder_cache_put(player->decoder_cache, player->audio_decoder, get_decoder_cache_key(player, stream, &(ff_decoder_cache_key_t){0}));
+        player->audio_decoder = NULL;
+        swr_free(&player->swr_context);
+        av_freep(&player->swr_buf);
+        player->swr_buf_size = 0;
+        av_freep(&player->swr_planes);
+        player->swr_planes_size = 0;
+
+        player->audio_stream = NULL;
+        player->audio_stream_index = -1;
+        break;
+    case AVMEDIA_TYPE_VIDEO:
+        ff_decoder_abort(player->video_decoder, player->picture_queue);
+        ff_decoder_cache_put(player->decoder_cache, player->video_decoder, get_decoder_cache_key(player, stream, &(ff_decoder_cache_key_t){0}));
+        player->video_decoder = NULL;
+
+        player->video_stream = NULL;
+        player->video_stream_index = -1;
+        break;
+    case AVMEDIA_TYPE_SUBTITLE:
+        ff_decoder_abort(player->subtitle_decoder, player->subpicture_queue);
+        ff_decoder_cache_put(player->decoder_cache, player->subtitle_decoder, get_decoder_cache_key(player, stream, &(ff_decoder_cache_key_t){0}));
+        player->subtitle_decoder = NULL;
+        sws_freeContext(player->sub_convert_context);
+        player->sub_convert_context = NULL;
+
+        player->subtitle_stream = NULL;
+        player->subtitle_stream_index = -1;
+        break;
+    default:
+        break;
+    }
+    stream->discard = AVDISCARD_ALL;
+}
+
+static audio_track_t* find_audio_track(const ff_player_t* player, const int stream_index) {
+    for (int i = 0; i < player->nb_audio_tracks; ++i) {
+        if (player->audio_tracks[i].stream_index == stream_index) {
+            return &player->audio_tracks[i];
+        }
+    }
+    return NULL;
+}
+
+static void audio_track_prepare(ff_player_t* player, audio_track_t* track) {
+    AVStream* stream = player->format_context->streams[track->stream_index];
+    track->decoder = ff_decoder_cache_take(player->decoder_cache, get_decoder_cache_key(player, stream, &(ff_decoder_cache_key_t){0}));
+    if (track->decoder == NULL) {
+        AVCodecContext* codec_context = NULL;
+        if (codec_context_open(&codec_context, stream, &player->opts.audio_stream_params) >= 0) {
+            track->decoder = ff_decoder_create(codec_context, player->audio_packet_queue, &player->continue_read_thread, false);
+            if (track->decoder == NULL) {
+                avcodec_free_context(&codec_context);
+            }
+        }
+    }
+    stream->discard = track->decoder != NULL ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+}
+
+static void audio_tracks_destroy(ff_player_t* player) {
+    for (int i = 0; i < player->nb_audio_tracks; ++i) {
+        audio_track_t* track = &player->audio_tracks[i];
+        if (track->packet_queue != NULL) {
+            ff_packet_queue_destroy(track->packet_queue);
+        }
+        if (track->decoder != NULL) {
+            ff_decoder_destroy(track->decoder);
+        }
+    }
+    av_freep(&player->audio_tracks);
+    player->nb_audio_tracks = 0;
+}
+
+static int audio_tracks_init(ff_player_t* player) {
+    const AVFormatContext* format_context = player->format_context;
+    int nb_audio_tracks = 0;
+    for (int i = 0; i < format_context->nb_streams; ++i) {
+        if (format_context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            ++nb_audio_tracks;
+        }
+    }
+    player->audio_tracks = av_calloc(nb_audio_tracks, sizeof(audio_track_t));
+    if (player->audio_tracks == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < format_context->nb_streams; ++i) {
+        if (format_context->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+            continue;
+        }
+        audio_track_t* track = &player->audio_tracks[player->nb_audio_tracks++];
+        track->stream_index = i;
+        track->packet_queue = ff_packet_queue_create();
+        if (track->packet_queue == NULL) {
+            audio_tracks_destroy(player);
+            return AVERROR(ENOMEM);
+        }
+        ff_packet_queue_start(track->packet_queue);
+        if (i != player->audio_stream_index) {
+            audio_track_prepare(player, track);
+        }
+    }
+    return 0;
+}
+
+static void audio_tracks_flush(const ff_player_t* player) {
+    for (int i = 0; i < player->nb_audio_tracks; ++i) {
+        ff_packet_queue_flush(player->audio_tracks[i].packet_queue);
+    }
+}
+
+static int audio_track_put(const ff_player_t* player, AVPacket* packet) {
+    const audio_track_t* track = find_audio_track(player, packet->stream_index);
+    if (track == NULL || track->decoder == NULL) {
+        return AVERROR(EINVAL);
+    }
+    const AVStream* stream = player->format_context->streams[track->stream_index];
+    const int ret = ff_packet_queue_put(track->packet_queue, packet);
+    if (ret >= 0) {
+        // the demuxer runs ahead of playback, so a switch resumes at the audio
+        // clock and needs everything from there on, not just the newest packets
+        const double clock = ff_clock_get(&player->audio_clock);
+        int64_t max_duration = av_rescale_q(player->opts.audio_prebuffer_duration, AV_TIME_BASE_Q, stream->time_base);
+        if (!isnan(clock)) {
+            ff_packet_queue_drop_before(track->packet_queue, (int64_t)(clock / av_q2d(stream->time_base)));
+            max_duration = INT64_MAX;
+        }
+        ff_packet_queue_trim(track->packet_queue, max_duration, AUDIO_TRACK_MAX_SIZE);
+    }
+    return ret;
+}
+
+static int audio_track_switch(ff_player_t* player, const int stream_index) {
+    audio_track_t* track = find_audio_track(player, stream_index);
+    audio_track_t* old_track = find_audio_track(player, player->audio_stream_index);
+    if (track == NULL || track->decoder == NULL || old_track == NULL) {
+        return AVERROR(EINVAL);
+    }
+    AVPacket* packet = av_packet_alloc();
+    if (packet == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    ff_decoder_t* decoder = track->decoder;
+    track->decoder = NULL;
+
+    const double position = ff_clock_get(&player->audio_clock);
+    ff_decoder_abort(player->audio_decoder, player->sampler_queue);
+    if (player->audio_ring != NULL) {
+        thrd_join(player->audio_convert_thread, NULL);
+    }
+    old_track->decoder = player->audio_decoder;
+    ff_decoder_rebind(decoder, player->audio_packet_queue);
+    player->audio_decoder = decoder;
+
+    AVStream* stream = player->format_context->streams[stream_index];
+    if (player->format_context->iformat->flags & AVFMT_NOTIMESTAMPS) {
+        ff_decoder_set_start_pts(decoder, stream->start_time, stream->time_base);
+    }
+    player->last_audio_stream_index = stream_index;
+    player->audio_stream_index = stream_index;
+    player->audio_stream = stream;
+
+    int ret = ff_decoder_start(decoder, audio_thread, player);
+    if (ret >= 0) {
+        while (ff_packet_queue_get(track->packet_queue, packet, 0, NULL) > 0) {
+            const int64_t pkt_ts = packet->pts == AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            if (!isnan(position) && pkt_ts != AV_NOPTS_VALUE &&
+                (double)(pkt_ts + packet->duration) * av_q2d(stream->time_base) < position) {
+                av_packet_unref(packet);
+            } else {
+                ff_packet_queue_put(player->audio_packet_queue, packet);
+            }
+        }
+        if (player->eof) {
+            ff_packet_queue_put_nullpacket(player->audio_packet_queue, packet, stream_index);
+        }
+        if (player->audio_ring != NULL &&
+            thrd_create(&player->audio_convert_thread, audio_convert_thread, player) != thrd_success) {
+            ff_decoder_abort(decoder, player->sampler_queue);
+            ret = AVERROR(ENOMEM);
+        }
+    }
+    if (ret < 0) {
+        ff_decoder_destroy(player->audio_decoder);
+        player->audio_decoder = NULL;
+        player->audio_stream_index = -1;
+        player->audio_stream = NULL;
+        audio_ring_close(player);
+    }
+    av_packet_free(&packet);
+    return ret;
+}
+
+static void stream_seek(ff_player_t* player, const int64_t pos, const int64_t rel, const bool by_bytes) {
+    if (!player->seek_req) {
+        player->seek_pos = pos;
+        player->seek_rel = rel;
+        player->seek_flags &= ~AVSEEK_FLAG_BYTE;
+        if (by_bytes) {
+            player->seek_flags |= AVSEEK_FLAG_BYTE;
+        }
+        player->seek_req = true;
+        cnd_signal(&player->continue_read_thread);
+    }
+}
+
+static void stream_toggle_pause(ff_player_t* player) {
+    if (player->paused) {
+        ff_clock_state_t video_clock;
+        ff_clock_read(&player->video_clock, &video_clock);
+        player->frame_timer += (double)(ff_clock_now() - video_clock.last_updated) / 1000000000.0;
+        if (player->read_pause_return != AVERROR(ENOSYS)) {
+            ff_clock_set_paused(&player->video_clock, false);
+        }
+        ff_clock_set(&player->video_clock, ff_clock_get(&player->video_clock), ff_clock_get_serial(&player->video_clock));
+    }
+    ff_clock_set(&player->external_clock, ff_clock_get(&player->external_clock), ff_clock_get_serial(&player->external_clock));
+    player->paused = !player->paused;
+    ff_clock_set_paused(&player->audio_clock, player->paused);
+    ff_clock_set_paused(&player->video_clock, player->paused);
+    ff_clock_set_paused(&player->external_clock, player->paused);
+}
+
+static int toggle_pause(ff_player_t* player) {
+    stream_toggle_pause(player);
+    player->step = false;
+    presenter_wake(player->presenter);
+    return player->paused;
+}
+
+// standby holds the clocks paused without pausing the demuxer, so the queues
+// fill up; leaving it always resumes playback
+static int set_standby(ff_player_t* player, const bool standby) {
+    if (player->standby == standby) {
+        return 0;
+    }
+    if (player->paused != standby) {
+        stream_toggle_pause(player);
+    }
+    player->step = false;
+    player->standby = standby;
+    if (!standby) {
+        player->force_refresh = true;
+    }
+    presenter_wake(player->presenter);
+    return 0;
+}
+
+static int update_volume(ff_player_t* player, const int max_volume, const int sign, const double step) {
+    int volume = atomic_load(&player->audio_volume);
+    int res_volume;
+    do {
+        const double volume_level = volume ? (20 * log(volume / (double)max_volume) / log(10)) : -1000.0;
+        const long int new_volume = lrint(max_volume * pow(10.0, (volume_level + sign * step) / 20.0));
+        if (volume == new_volume) {
+            res_volume = volume + sign;
+        } else {
+            res_volume = (int)new_volume;
+        }
+        res_volume = av_clip(res_volume, 0, max_volume);
+    } while (!atomic_compare_exchange_weak(&player->audio_volume, &volume, res_volume));
+    return res_volume;
+}
+
+static int toggle_mute(ff_player_t* player) {
+    bool muted = atomic_load(&player->muted);
+    while (!atomic_compare_exchange_weak(&player->muted, &muted, !muted)) {
+    }
+    return !muted;
+}
+
+static int step_to_next_frame(ff_player_t *player) {
+    if (player->paused) {
+        stream_toggle_pause(player);
+    }
+    player->step = true;
+    presenter_wake(player->presenter);
+    return 0;
+}
+
+static int cycle_channel(ff_player_t* player, const enum AVMediaType media_type) {
+    int start_index;
+    int old_index;
+    const ff_stream_params_t* params = NULL;
+    if (media_type == AVMEDIA_TYPE_VIDEO) {
+        start_index = player->last_video_stream_index;
+        old_index = player->video_stream_index;
+        params = &player->opts.video_stream_params;
+    } else if (media_type == AVMEDIA_TYPE_AUDIO) {
+        start_index = player->last_audio_stream_index;
+        old_index = player->audio_stream_index;
+        params = &player->opts.audio_stream_params;
+    } else if (media_type == AVMEDIA_TYPE_SUBTITLE) {
+        start_index = player->last_subtitle_stream_index;
+        old_index = player->subtitle_stream_index;
+        params = &player->opts.subtitle_stream_params;
+    } else {
+        return AVERROR(EINVAL);
+    }
+    int stream_index = start_index;
+    unsigned int stream_count = player->format_context->nb_streams;
+
+    const AVProgram* program = NULL;
+    AVFormatContext* format_context = player->format_context;
+
+    if (media_type != AVMEDIA_TYPE_VIDEO && player->video_stream_index != -1) {
+        program = av_find_program_from_stream(format_context, NULL, player->video_stream_index);
+        if (program != NULL) {
+            stream_count = program->nb_stream_indexes;
+            for (start_index = 0; start_index < stream_count; start_index++) {
+                if (program->stream_index[start_index] == stream_index) {
+                    break;
+                }
+            }
+            if (start_index == stream_count) {
+                start_index = -1;
+            }
+            stream_index = start_index;
+        }
+    }
+    for (;;) {
+        if (++stream_index >= stream_count) {
+            if (media_type == AVMEDIA_TYPE_SUBTITLE) {
+                stream_index = -1;
+                goto the_end;
+            }
+            if (start_index == -1) {
+                return 0;
+            }
+            stream_index = 0;
+        }
+        if (stream_index == start_index) {
+            return 0;
+        }
+        int stream_index_pick;
+        if (program != NULL) {
+            stream_index_pick = (int)program->stream_index[stream_index];
+        } else {
+            stream_index_pick = stream_index;
+        }
+        const AVStream* stream = player->format_context->streams[stream_index_pick];
+        if (stream->codecpar->codec_type == media_type) {
+            switch (media_type) {
+            case AVMEDIA_TYPE_AUDIO:
+                if (stream->codecpar->sample_rate != 0 &&
+                    stream->codecpar->ch_layout.nb_channels != 0) {
+                    goto the_end;
+                }
+                break;
+            case AVMEDIA_TYPE_VIDEO:
+            case AVMEDIA_TYPE_SUBTITLE:
+                goto the_end;
+            default:
+                break;
+            }
+        }
+    }
+the_end:
+    if (program != NULL && stream_index != -1) {
+        stream_index = (int)program->stream_index[stream_index];
+    }
+    av_log(
+        NULL,
+        AV_LOG_INFO,
+        "Switch %s stream from #%d to #%d\n",
+        av_get_media_type_string(media_type),
+        old_index,
+        stream_index
+    );
+    if (media_type == AVMEDIA_TYPE_AUDIO && player->audio_tracks != NULL) {
+        if (stream_index >= 0 && audio_track_switch(player, stream_index) >= 0) {
+            return 0;
+        }
+        old_index = player->audio_stream_index;
+    }
+    stream_close(player, old_index);
+    return stream_index >= 0 ? stream_open(player, stream_index, params) : 0;
+}
+
+static int seek_chapter(ff_player_t* player, const int incr) {
+    const int64_t pos = (int64_t)(get_master_clock(player) * (double)AV_TIME_BASE);
+    if (!player->format_context->nb_chapters) {
+        return 0;
+    }
+    int i = 0;
+    for (; i < player->format_context->nb_chapters; i++) {
+        const AVChapter* chapter = player->format_context->chapters[i];
+        if (av_compare_ts(pos, AV_TIME_BASE_Q, chapter->start, chapter->time_base) < 0) {
+            i--;
+            break;
+        }
+    }
+    i += incr;
+    i = FFMAX(i, 0);
+    if (i >= player->format_context->nb_chapters) {
+        return 0;
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Seeking to chapter %d.\n", i);
+    stream_seek(
+        player,
+        av_rescale_q(player->format_context->chapters[i]->start, player->format_context->chapters[i]->time_base,
+        AV_TIME_BASE_Q),
+        0,
+    false
+    );
+    return 0;
+}
+
+static int seek(ff_player_t* player, double incr) {
+    double pos;
+    if (player->opts.seek_by_bytes) {
+        pos = -1;
+        if (pos < 0 && player->video_stream_index >= 0) {
+            pos = (double)ff_frame_queue_get_last_pos(player->picture_queue);
+        }
+        if (pos < 0 && player->audio_stream_index >= 0) {
+            pos = (double)ff_frame_queue_get_last_pos(player->sampler_queue);
+        }
+        if (pos < 0) {
+            pos = (double)avio_tell(player->format_context->pb);
+        }
+        if (player->format_context->bit_rate) {
+            incr *= (double)player->format_context->bit_rate / 8.0;
+        } else {
+            incr *= 180000.0;
+        }
+        pos += incr;
+    } else {
+        pos = get_master_clock(player);
+        if (isnan(pos)) {
+            pos = (double)player->seek_pos / AV_TIME_BASE;
+        }
+        pos += incr;
+        const double tmp_pos = (double)player->format_context->start_time / AV_TIME_BASE;
+        if (player->format_context->start_time != AV_NOPTS_VALUE && pos < tmp_pos) {
+            pos = tmp_pos;
+        }
+        pos *= AV_TIME_BASE;
+        incr *= AV_TIME_BASE;
+    }
+    stream_seek(player, (int64_t)pos, (int64_t)incr, player->opts.seek_by_bytes);
+    return 0;
+}
+
+static int run_command(ff_player_t* player, const ff_player_command_t* command) {
+    switch (command->type) {
+    case FF_PLAYER_COMMAND_TOGGLE_PAUSE:
+        return toggle_pause(player);
+    case FF_PLAYER_COMMAND_TOGGLE_MUTE:
+        return toggle_mute(player);
+    case FF_PLAYER_COMMAND_UPDATE_VOLUME:
+        return update_volume(player, command->args.volume.max_volume, command->args.volume.sign, command->args.volume.step);
+    case FF_PLAYER_COMMAND_STEP_TO_NEXT_FRAME:
+        return step_to_next_frame(player);
+    case FF_PLAYER_COMMAND_CYCLE_CHANNEL:
+        return cycle_channel(player, command->args.media_type);
+    case FF_PLAYER_COMMAND_SEEK_CHAPTER:
+        return seek_chapter(player, command->args.chapter_incr);
+    case FF_PLAYER_COMMAND_SEEK:
+        return seek(player, command->args.seek_incr);
+    case FF_PLAYER_COMMAND_SET_STANDBY:
+        return set_standby(player, command->args.standby);
+    default:
+        return AVERROR(EINVAL);
+    }
+}
+
+// gain changes only swap atomics the audio thread reads, so they skip the
+// queue and are not held up by a blocking av_read_frame
+static bool is_gain_command(const ff_player_command_type_t type) {
+    return type == FF_PLAYER_COMMAND_TOGGLE_MUTE ||
+           type == FF_PLAYER_COMMAND_UPDATE_VOLUME;
+}
+
+// these change the state the video frame pickers read under state_mutex
+static bool is_playback_command(const ff_player_command_type_t type) {
+    return type == FF_PLAYER_COMMAND_TOGGLE_PAUSE ||
+           type == FF_PLAYER_COMMAND_STEP_TO_NEXT_FRAME ||
+           type == FF_PLAYER_COMMAND_SET_STANDBY;
+}
+
+// stops after a seek so that later commands see the position it lands on
+static void run_commands(ff_player_t* player) {
+    queued_command_t queued;
+    while (!player->seek_req && ff_command_queue_pop(player->commands, &queued)) {
+        const bool locked = is_playback_command(queued.command.type);
+        if (locked) {
+            mtx_lock(&player->state_mutex);
+        }
+        const int ret = run_command(player, &queued.command);
+        if (locked) {
+            mtx_unlock(&player->state_mutex);
+        }
+        if (queued.done != NULL) {
+            queued.done(queued.opaque, ret);
+        }
+    }
+}
+
+static void cancel_commands(ff_player_t* player) {
+    queued_command_t queued;
+    while (ff_command_queue_pop(player->commands, &queued)) {
+        if (queued.done != NULL) {
+            queued.done(queued.opaque, AVERROR_EXIT);
+        }
+    }
+}
+
+static void clear_recording_request(ff_player_t* player) {
+    player->record_req = false;
+    av_freep(&player->record_path);
+    av_freep(&player->record_format);
+}
+
+static void start_requested_recording(ff_player_t* player, const AVFormatContext* format_context) {
+    mtx_lock(&player->recorder_mutex);
+    if (player->record_req) {
+        const int stream_indices[] = {
+            player->video_stream_index,
+            player->audio_stream_index,
+            player->subtitle_stream_index
+        };
+        player->recorder = ff_recorder_create(
+            player->record_path,
+            player->record_format,
+            format_context,
+            stream_indices,
+            FF_ARRAY_ELEMS(stream_indices)
+        );
+        if (player->recorder == NULL) {
+            player->record_error = AVERROR(EINVAL);
+        }
+        clear_recording_request(player);
+    }
+    mtx_unlock(&player->recorder_mutex);
+}
+
+static void queue_packet(ff_player_t* player, const AVFormatContext* format_context, AVPacket* packet) {
+    const int64_t stream_start_time = format_context->streams[packet->stream_index]->start_time;
+    const int64_t pkt_ts = packet->pts == AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    const bool pkt_in_play_range = player->opts.duration == AV_NOPTS_VALUE ||
+            (double)(pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
+            av_q2d(format_context->streams[packet->stream_index]->time_base) -
+            (double)(player->opts.start_time != AV_NOPTS_VALUE ? player->opts.start_time : 0) / 1000000
+            <= ((double)player->opts.duration / 1000000);
+    if (pkt_in_play_range) {
+        mtx_lock(&player->recorder_mutex);
+        if (player->recorder != NULL) {
+            ff_recorder_write(player->recorder, packet);
+        }
+        mtx_unlock(&player->recorder_mutex);
+    }
+    if (packet->stream_index == player->audio_stream_index && pkt_in_play_range) {
+        ff_packet_queue_put(player->audio_packet_queue, packet);
+    } else if (packet->stream_index == player->video_stream_index && pkt_in_play_range
+               && !(player->video_stream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+        ff_packet_queue_put(player->video_packet_queue, packet);
+    } else if (packet->stream_index == player->subtitle_stream_index && pkt_in_play_range) {
+        ff_packet_queue_put(player->subtitle_packet_queue, packet);
+    } else if (!pkt_in_play_range || audio_track_put(player, packet) < 0) {
+        av_packet_unref(packet);
+    }
+}
+
+static void flush_packet_queues(ff_player_t* player) {
+    if (player->audio_stream_index >= 0) {
+        ff_packet_queue_flush(player->audio_packet_queue);
+    }
+    if (player->video_stream_index >= 0) {
+        ff_packet_queue_flush(player->video_packet_queue);
     }
-    avcodec_free_context(&codec_context);
+    if (player->subtitle_stream_index >= 0) {
+        ff_packet_queue_flush(player->subtitle_packet_queue);
+    }
+    audio_tracks_flush(player);
+}
 
-    return ret;
+static void queue_eof(ff_player_t* player, AVPacket* packet) {
+    if (player->video_stream_index >= 0) {
+        ff_packet_queue_put_nullpacket(player->video_packet_queue, packet, player->video_stream_index);
+    }
+    if (player->audio_stream_index >= 0) {
+        ff_packet_queue_put_nullpacket(player->audio_packet_queue, packet, player->audio_stream_index);
+    }
+    if (player->subtitle_stream_index >= 0) {
+        ff_packet_queue_put_nullpacket(player->subtitle_packet_queue, packet, player->subtitle_stream_index);
+    }
+    player->eof = true;
 }
 
-static void stream_close(ff_player_t* player, const int stream_index) {
-    const AVFormatContext* format_context = player->format_context;
-    if (stream_index < 0 || stream_index >= format_context->nb_streams) {
+static void timeshift_open(ff_player_t* player) {
+    if (player->opts.timeshift_size <= 0 || !player->realtime) {
         return;
     }
-    AVStream* stream = format_context->streams[stream_index];
-    switch (stream->codecpar->codec_type) {
-    case AVMEDIA_TYPE_AUDIO:
-        ff_decoder_abort(player->audio_decoder, player->sampler_queue);
-        ff_decoder_destroy(player->audio_decoder);
-        swr_free(&player->swr_context);
-        av_freep(&player->swr_buf);
-        player->swr_buf_size = 0;
-
-        player->audio_stream = NULL;
-        player->audio_stream_index = -1;
-        break;
-    case AVMEDIA_TYPE_VIDEO:
-        ff_decoder_abort(player->video_decoder, player->picture_queue);
-        ff_decoder_destroy(player->video_decoder);
-
-        player->video_stream = NULL;
-        player->video_stream_index = -1;
-        break;
-    default:
-        break;
+    player->timeshift = ff_timeshift_create(player->opts.timeshift_path, player->opts.timeshift_size);
+    if (player->timeshift == NULL) {
+        av_log(NULL, AV_LOG_WARNING, "Could not create time-shift buffer, playing live only\n");
     }
-    stream->discard = AVDISCARD_ALL;
+    player->timeshift_input_eof = false;
 }
 
-static void stream_seek(ff_player_t* player, const int64_t pos, const int64_t rel, const bool by_bytes) {
-    if (!player->seek_req) {
-        player->seek_pos = pos;
-        player->seek_rel = rel;
-        player->seek_flags &= ~AVSEEK_FLAG_BYTE;
-        if (by_bytes) {
-            player->seek_flags |= AVSEEK_FLAG_BYTE;
+// keeps demuxing the live input into the time-shift buffer whether or not
+// playback consumes it, and refills the packet queues from the read position
+static int timeshift_step(ff_player_t* player, AVFormatContext* format_context, AVPacket* packet, const bool queues_full) {
+    int ret = 0;
+    if (!player->timeshift_input_eof) {
+        ret = av_read_frame(format_context, packet);
+        if (ret >= 0) {
+            const AVStream* stream = format_context->streams[packet->stream_index];
+            const int sync_stream_index = player->video_stream_index >= 0 ? player->video_stream_index : player->audio_stream_index;
+            const int64_t pkt_ts = packet->pts == AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            const int64_t time = pkt_ts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(pkt_ts, stream->time_base, AV_TIME_BASE_Q);
+            ret = ff_timeshift_write(
+                player->timeshift,
+                packet,
+                time,
+                packet->stream_index == sync_stream_index && (packet->flags & AV_PKT_FLAG_KEY)
+            );
+            av_packet_unref(packet);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_WARNING, "Dropped packet from time-shift buffer, %s\n", av_err2str(ret));
+            }
+        } else if (ret == AVERROR_EOF || avio_feof(format_context->pb)) {
+            player->timeshift_input_eof = true;
+        } else if (format_context->pb != NULL && format_context->pb->error != 0) {
+            return format_context->pb->error;
         }
-        player->seek_req = true;
-        cnd_signal(&player->continue_read_thread);
     }
-}
-
-static void stream_toggle_pause(ff_player_t* player) {
-    if (player->paused) {
-        player->frame_timer += (double)av_gettime_relative() / 1000000.0 - player->video_clock.last_updated;
-        if (player->read_pause_return != AVERROR(ENOSYS)) {
-            player->video_clock.paused = 0;
+    bool fed = false;
+    for (int i = 0; !queues_full && i < TIMESHIFT_FEED_MAX; ++i) {
+        bool discontinuity;
+        ret = ff_timeshift_read(player->timeshift, packet, &discontinuity);
+        if (ret < 0) {
+            if (ret != AVERROR(EAGAIN)) {
+                return ret;
+            }
+            break;
         }
-        ff_clock_set(&player->video_clock, ff_clock_get(&player->video_clock), player->video_clock.serial);
+        if (discontinuity) {
+            av_log(NULL, AV_LOG_WARNING, "Time-shift buffer overran the play position\n");
+            flush_packet_queues(player);
+        }
+        player->eof = false;
+        queue_packet(player, format_context, packet);
+        fed = true;
     }
-    ff_clock_set(&player->external_clock, ff_clock_get(&player->external_clock), player->external_clock.serial);
-    player->paused = player->audio_clock.paused = player->video_clock.paused = player->external_clock.paused = !player->paused;
+    if (!fed && player->timeshift_input_eof && !player->eof) {
+        queue_eof(player, packet);
+    }
+    return fed || !player->timeshift_input_eof ? 0 : AVERROR(EAGAIN);
 }
 
 static int read_thread(void *arg) {
@@ -1241,6 +3014,7 @@ static int read_thread(void *arg) {
         }
     }
     player->realtime = is_realtime(format_context);
+    timeshift_open(player);
 
     for (int i = 0; i < format_context->nb_streams; ++i) {
         format_context->streams[i]->discard = AVDISCARD_ALL;
@@ -1249,6 +3023,16 @@ static int read_thread(void *arg) {
     if (!player->opts.audio_disable) {
         stream_indices[AVMEDIA_TYPE_AUDIO] = av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, stream_indices[AVMEDIA_TYPE_AUDIO], stream_indices[AVMEDIA_TYPE_VIDEO], NULL, 0);
     }
+    if (!player->opts.subtitle_disable) {
+        stream_indices[AVMEDIA_TYPE_SUBTITLE] = av_find_best_stream(
+            format_context,
+            AVMEDIA_TYPE_SUBTITLE,
+            stream_indices[AVMEDIA_TYPE_SUBTITLE],
+            stream_indices[AVMEDIA_TYPE_AUDIO] >= 0 ? stream_indices[AVMEDIA_TYPE_AUDIO] : stream_indices[AVMEDIA_TYPE_VIDEO],
+            NULL,
+            0
+        );
+    }
     if (stream_indices[AVMEDIA_TYPE_VIDEO] >= 0) {
         AVStream* stream = format_context->streams[stream_indices[AVMEDIA_TYPE_VIDEO]];
         const AVCodecParameters* codec_parameters = stream->codecpar;
@@ -1273,6 +3057,13 @@ static int read_thread(void *arg) {
             goto pkt_end;
         }
     }
+    if (stream_indices[AVMEDIA_TYPE_SUBTITLE] >= 0) {
+        stream_open(player, stream_indices[AVMEDIA_TYPE_SUBTITLE], &player->opts.subtitle_stream_params);
+    }
+    if (player->opts.audio_prebuffer_duration > 0 && player->audio_stream_index >= 0 &&
+        audio_tracks_init(player) < 0) {
+        av_log(NULL, AV_LOG_WARNING, "Could not prebuffer alternate audio streams\n");
+    }
     if (player->video_stream_index < 0 && player->audio_stream_index < 0) {
         av_log(NULL, AV_LOG_FATAL, "Failed to open file '%s' or configure filtergraph\n",
                player->filename);
@@ -1280,7 +3071,9 @@ static int read_thread(void *arg) {
         goto pkt_end;
     }
     while (!player->abort_request) {
-        if (player->paused != player->last_paused) {
+        run_commands(player);
+        start_requested_recording(player, format_context);
+        if (!player->standby && player->timeshift == NULL && player->paused != player->last_paused) {
             player->last_paused = player->paused;
             if (player->paused) {
                 player->read_pause_return = av_read_pause(format_context);
@@ -1293,16 +3086,15 @@ static int read_thread(void *arg) {
             const int64_t seek_min = player->seek_rel > 0 ? seek_target - player->seek_rel + 2: INT64_MIN;
             const int64_t seek_max = player->seek_rel < 0 ? seek_target - player->seek_rel - 2: INT64_MAX;
 
-            ret = avformat_seek_file(player->format_context, -1, seek_min, seek_target, seek_max, player->seek_flags);
+            if (player->timeshift != NULL) {
+                ret = player->seek_flags & AVSEEK_FLAG_BYTE ? AVERROR(ENOSYS) : ff_timeshift_seek(player->timeshift, seek_target);
+            } else {
+                ret = avformat_seek_file(player->format_context, -1, seek_min, seek_target, seek_max, player->seek_flags);
+            }
             if (ret < 0) {
                 av_log(NULL, AV_LOG_ERROR, "%s: error while seeking, %s\n", player->format_context->url, av_err2str(ret));
             } else {
-                if (player->audio_stream_index >= 0) {
-                    ff_packet_queue_flush(player->audio_packet_queue);
-                }
-                if (player->video_stream_index >= 0) {
-                    ff_packet_queue_flush(player->video_packet_queue);
-                }
+                flush_packet_queues(player);
                 if (player->seek_flags & AVSEEK_FLAG_BYTE) {
                    ff_clock_set(&player->external_clock, NAN, 0);
                 } else {
@@ -1312,9 +3104,11 @@ static int read_thread(void *arg) {
             player->seek_req = false;
             player->queue_attachments_req = true;
             player->eof = false;
+            mtx_lock(&player->state_mutex);
             if (player->paused) {
-                ff_player_step_to_next_frame(player);
+                step_to_next_frame(player);
             }
+            mtx_unlock(&player->state_mutex);
         }
         if (player->queue_attachments_req) {
             if (player->video_stream && player->video_stream->disposition & AV_DISPOSITION_ATTACHED_PIC) {
@@ -1326,10 +3120,13 @@ static int read_thread(void *arg) {
             }
             player->queue_attachments_req = false;
         }
-        if ((ff_packet_queue_get_size(player->audio_packet_queue) + ff_packet_queue_get_size(player->video_packet_queue) > MAX_QUEUE_SIZE
+        const bool queues_full =
+            ff_packet_queue_get_size(player->audio_packet_queue) + ff_packet_queue_get_size(player->video_packet_queue) +
+             ff_packet_queue_get_size(player->subtitle_packet_queue) > MAX_QUEUE_SIZE
             || (stream_has_enough_packets(player->audio_stream, player->audio_stream_index, player->audio_packet_queue) &&
-                stream_has_enough_packets(player->video_stream, player->video_stream_index, player->video_packet_queue)))) {
-
+                stream_has_enough_packets(player->video_stream, player->video_stream_index, player->video_packet_queue) &&
+                stream_has_enough_packets(player->subtitle_stream, player->subtitle_stream_index, player->subtitle_packet_queue));
+        if (queues_full && player->timeshift == NULL) {
             mtx_lock(wait_mutex);
             struct timespec ts = { .tv_nsec =  10 * 1000 * 1000 };
             cnd_timedwait(&player->continue_read_thread, wait_mutex, &ts);
@@ -1346,16 +3143,22 @@ static int read_thread(void *arg) {
                 break;
             }
         }
+        if (player->timeshift != NULL) {
+            ret = timeshift_step(player, format_context, packet, queues_full);
+            if (ret == AVERROR(EAGAIN)) {
+                mtx_lock(wait_mutex);
+                struct timespec ts = { .tv_nsec =  10 * 1000 * 1000 };
+                cnd_timedwait(&player->continue_read_thread, wait_mutex, &ts);
+                mtx_unlock(wait_mutex);
+            } else if (ret < 0) {
+                break;
+            }
+            continue;
+        }
         ret = av_read_frame(format_context, packet);
         if (ret < 0) {
             if ((ret == AVERROR_EOF || avio_feof(format_context->pb)) && !player->eof) {
-                if (player->video_stream_index >= 0) {
-                    ff_packet_queue_put_nullpacket(player->video_packet_queue, packet, player->video_stream_index);
-                }
-                if (player->audio_stream_index >= 0) {
-                    ff_packet_queue_put_nullpacket(player->audio_packet_queue, packet, player->audio_stream_index);
-                }
-                player->eof = true;
+                queue_eof(player, packet);
             }
             if (format_context->pb != NULL && format_context->pb->error != 0) {
                 ret = format_context->pb->error;
@@ -1368,22 +3171,7 @@ static int read_thread(void *arg) {
             continue;
         }
         player->eof = false;
-
-        const int64_t stream_start_time = format_context->streams[packet->stream_index]->start_time;
-        const int64_t pkt_ts = packet->pts == AV_NOPTS_VALUE ? packet->dts : packet->pts;
-        const bool pkt_in_play_range = player->opts.duration == AV_NOPTS_VALUE ||
-                (double)(pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
-                av_q2d(format_context->streams[packet->stream_index]->time_base) -
-                (double)(player->opts.start_time != AV_NOPTS_VALUE ? player->opts.start_time : 0) / 1000000
-                <= ((double)player->opts.duration / 1000000);
-        if (packet->stream_index == player->audio_stream_index && pkt_in_play_range) {
-            ff_packet_queue_put(player->audio_packet_queue, packet);
-        } else if (packet->stream_index == player->video_stream_index && pkt_in_play_range
-                   && !(player->video_stream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
-            ff_packet_queue_put(player->video_packet_queue, packet);
-        } else {
-            av_packet_unref(packet);
-        }
+        queue_packet(player, format_context, packet);
     }
 pkt_end:
     av_packet_free(&packet);
@@ -1395,46 +3183,29 @@ mtx_end:
     return ret;
 }
 
-static int synchronize_audio(ff_player_t* player, const int sample_count) {
-    int wanted_sample_count = sample_count;
-
-    if (get_master_sync_type(player) != FF_AV_SYNC_AUDIO_MASTER) {
-        const double diff = ff_clock_get(&player->audio_clock) - get_master_clock(player);
-
-        if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
-            player->audio_diff_cum = diff + player->audio_diff_avg_coef * player->audio_diff_cum;
-            if (player->audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
-                ++player->audio_diff_avg_count;
-            } else {
-                const double avg_diff = player->audio_diff_cum * (1.0 - player->audio_diff_avg_coef);
-
-                if (fabs(avg_diff) >= player->audio_diff_threshold) {
-                    wanted_sample_count = sample_count + (int)(diff * player->audio_source.freq);
-                    const int min_nb_samples = ((sample_count * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                    const int max_nb_samples = ((sample_count * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                    wanted_sample_count = av_clip(wanted_sample_count, min_nb_samples, max_nb_samples);
-                }
-                av_log(NULL, AV_LOG_TRACE, "diff=%f adiff=%f sample_diff=%d apts=%0.3f %f\n",
-                        diff, avg_diff, wanted_sample_count - sample_count,
-                        player->audio_clock_value, player->audio_diff_threshold);
-            }
-        } else {
-            player->audio_diff_avg_count = 0;
-            player->audio_diff_cum = 0;
-        }
-    }
-    return wanted_sample_count;
-}
-
 int ff_audio_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params_t* src) {
     int ret = base_stream_parameters_copy(dist, src);
     if (ret >= 0) {
         ret = av_dict_copy(&dist->extended.audio.swr_opts, src->extended.audio.swr_opts, 0);
         if (ret >= 0) {
-            dist->filter_nb_threads = src->filter_nb_threads;
-            dist->extended.audio.meta_cb = src->extended.audio.meta_cb;
+            if (src->extended.audio.sample_fmts != NULL) {
+                dist->extended.audio.sample_fmts = (enum AVSampleFormat*)malloc(src->extended.audio.sample_fmts_size * sizeof(enum AVSampleFormat));
+                if (dist->extended.audio.sample_fmts == NULL) {
+                    ret = AVERROR(ENOMEM);
+                } else {
+                    for (size_t i = 0; i < src->extended.audio.sample_fmts_size; i++) {
+                        dist->extended.audio.sample_fmts[i] = src->extended.audio.sample_fmts[i];
+                    }
+                    dist->extended.audio.sample_fmts_size = src->extended.audio.sample_fmts_size;
+                }
+            }
+            if (ret >= 0) {
+                dist->filter_nb_threads = src->filter_nb_threads;
+                dist->extended.audio.meta_cb = src->extended.audio.meta_cb;
 
-            return 0;
+                return 0;
+            }
+            av_dict_free(&dist->extended.audio.swr_opts);
         }
         base_stream_parameters_destroy(dist);
     }
@@ -1443,6 +3214,7 @@ int ff_audio_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params
 
 void ff_audio_stream_params_destroy(ff_stream_params_t* params) {
     av_dict_free(&params->extended.audio.swr_opts);
+    free(params->extended.audio.sample_fmts);
     base_stream_parameters_destroy(params);
 }
 
@@ -1461,8 +3233,14 @@ int ff_video_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params
                     for (int i = 0; i < src->extended.video.color_spaces_size; i++) {
                         dist->extended.video.color_spaces[i] = src->extended.video.color_spaces[i];
                     }
+                    dist->extended.video.pix_fmts_size = src->extended.video.pix_fmts_size;
+                    dist->extended.video.color_spaces_size = src->extended.video.color_spaces_size;
                     dist->extended.video.autorotate = src->extended.video.autorotate;
                     dist->extended.video.reorder_pts = src->extended.video.reorder_pts;
+                    dist->extended.video.adaptive_skip = src->extended.video.adaptive_skip;
+                    dist->extended.video.drop_disposable = src->extended.video.drop_disposable;
+                    dist->extended.video.parallel_decode = src->extended.video.parallel_decode;
+                    dist->extended.video.threaded_filters = src->extended.video.threaded_filters;
 
                     dist->extended.video.meta_cb = src->extended.video.meta_cb;
 
@@ -1484,6 +3262,14 @@ void ff_video_stream_params_destroy(ff_stream_params_t* params) {
     base_stream_parameters_destroy(params);
 }
 
+int ff_subtitle_stream_params_copy(ff_stream_params_t* dist, const ff_stream_params_t* src) {
+    return base_stream_parameters_copy(dist, src);
+}
+
+void ff_subtitle_stream_params_destroy(ff_stream_params_t* params) {
+    base_stream_parameters_destroy(params);
+}
+
 int ff_player_opts_copy(ff_player_opts_t* dst, const ff_player_opts_t* src) {
     int ret = av_dict_copy(&dst->format_opts, src->format_opts, 0);
     if (ret >= 0) {
@@ -1493,21 +3279,38 @@ int ff_player_opts_copy(ff_player_opts_t* dst, const ff_player_opts_t* src) {
             if (ret >= 0) {
                 ret = ff_audio_stream_params_copy(&dst->audio_stream_params, &src->audio_stream_params);
                 if (ret >= 0) {
-                    dst->audio_disable = src->audio_disable;
-                    dst->seek_by_bytes = src->seek_by_bytes;
-
-                    dst->start_time = src->start_time;
-                    dst->duration = src->duration;
-                    dst->genpts = src->genpts;
-                    dst->run_sync = src->run_sync;
-
-                    dst->loop = src->loop;
-                    dst->opaque = src->opaque;
-                    dst->audio_volume = src->audio_volume;
-
-                    dst->find_stream_info = src->find_stream_info;
-
-                    return 0;
+                    ret = ff_subtitle_stream_params_copy(&dst->subtitle_stream_params, &src->subtitle_stream_params);
+                    if (ret >= 0 && src->timeshift_path != NULL && (dst->timeshift_path = av_strdup(src->timeshift_path)) == NULL) {
+                        ff_subtitle_stream_params_destroy(&dst->subtitle_stream_params);
+                        ret = AVERROR(ENOMEM);
+                    }
+                    if (ret >= 0) {
+                        dst->audio_disable = src->audio_disable;
+                        dst->subtitle_disable = src->subtitle_disable;
+                        dst->seek_by_bytes = src->seek_by_bytes;
+
+                        dst->start_time = src->start_time;
+                        dst->duration = src->duration;
+                        dst->genpts = src->genpts;
+                        dst->run_sync = src->run_sync;
+
+                        dst->loop = src->loop;
+                        dst->opaque = src->opaque;
+                        dst->on_error_cb = src->on_error_cb;
+                        dst->video_frame_cb = src->video_frame_cb;
+                        dst->audio_volume = src->audio_volume;
+                        dst->max_volume = src->max_volume;
+                        dst->pull_audio = src->pull_audio;
+                        dst->audio_prebuffer_duration = src->audio_prebuffer_duration;
+                        dst->smooth_audio_clock = src->smooth_audio_clock;
+                        dst->standby = src->standby;
+                        dst->timeshift_size = src->timeshift_size;
+
+                        dst->find_stream_info = src->find_stream_info;
+
+                        return 0;
+                    }
+                    ff_audio_stream_params_destroy(&dst->audio_stream_params);
                 }
                 ff_video_stream_params_destroy(&dst->video_stream_params);
             }
@@ -1521,8 +3324,10 @@ int ff_player_opts_copy(ff_player_opts_t* dst, const ff_player_opts_t* src) {
 void ff_player_opts_destroy(ff_player_opts_t* opts) {
     av_dict_free(&opts->format_opts);
     av_dict_free(&opts->stream_opts);
+    av_freep(&opts->timeshift_path);
     ff_video_stream_params_destroy(&opts->video_stream_params);
     ff_audio_stream_params_destroy(&opts->audio_stream_params);
+    ff_subtitle_stream_params_destroy(&opts->subtitle_stream_params);
     memset(opts, 0, sizeof(ff_player_opts_t));
 }
 
@@ -1534,6 +3339,9 @@ ff_player_t* ff_player_create(void) {
     return player;
 }
 
+static bool presenter_start(ff_player_t* player);
+static void presenter_stop(ff_player_t* player);
+
 int ff_player_open(
     ff_player_t* player,
     const char* filename,
@@ -1548,24 +3356,53 @@ int ff_player_open(
             if (packet_queues_init(player)) {
                 if (frame_queues_init(player)) {
                     if (cnd_init(&player->continue_read_thread) == thrd_success) {
-                        player->last_video_stream_index = player->video_stream_index = -1;
-                        player->last_audio_stream_index = player->audio_stream_index = -1;
-
-                        player->io_context = io_context;
-                        player->input_format = input_format;
-
-                        ff_clock_init(&player->video_clock, ff_packet_queue_get_serial_ptr(player->video_packet_queue));
-                        ff_clock_init(&player->audio_clock, ff_packet_queue_get_serial_ptr(player->audio_packet_queue));
-                        ff_clock_init(&player->external_clock, &player->external_clock.serial);
-
-                        player->audio_clock_serial = -1;
-                        player->av_sync_type = FF_AV_SYNC_AUDIO_MASTER;
-                        if (player->opts.run_sync) {
-                          return read_thread(player);
-                        }
-                        if (thrd_create(&player->read_thread, read_thread, player) == thrd_success) {
-                            return 0;
+                        player->decoder_cache = ff_decoder_cache_create(DECODER_CACHE_SIZE);
+                        if (player->decoder_cache != NULL) {
+                            if (filter_updates_init(player)) {
+                                player->commands = ff_command_queue_create(sizeof(queued_command_t));
+                                if (player->commands != NULL) {
+                                    if (mtx_init(&player->recorder_mutex, mtx_plain) == thrd_success) {
+                                        if (mtx_init(&player->state_mutex, mtx_plain) == thrd_success) {
+                                            player->last_video_stream_index = player->video_stream_index = -1;
+                                            player->last_audio_stream_index = player->audio_stream_index = -1;
+                                            player->last_subtitle_stream_index = player->subtitle_stream_index = -1;
+
+                                            player->io_context = io_context;
+                                            player->input_format = input_format;
+
+                                            ff_clock_init(&player->video_clock, ff_packet_queue_get_serial_ptr(player->video_packet_queue));
+                                            ff_clock_init(&player->audio_clock, ff_packet_queue_get_serial_ptr(player->audio_packet_queue));
+                                            ff_clock_init(&player->external_clock, NULL);
+
+                                            player->audio_clock_serial = -1;
+                                            player->audio_device_latency = -1;
+                                            player->vsync_frame_duration = NAN;
+                                            player->audio_tail_pts = NAN;
+                                            player->audio_volume = player->opts.audio_volume;
+                                            player->av_sync_type = FF_AV_SYNC_AUDIO_MASTER;
+                                            if (player->opts.standby) {
+                                                set_standby(player, true);
+                                            }
+                                            if (presenter_start(player)) {
+                                                if (player->opts.run_sync) {
+                                                  return read_thread(player);
+                                                }
+                                                if (thrd_create(&player->read_thread, read_thread, player) == thrd_success) {
+                                                    return 0;
+                                                }
+                                                presenter_stop(player);
+                                            }
+                                            mtx_destroy(&player->state_mutex);
+                                        }
+                                        mtx_destroy(&player->recorder_mutex);
+                                    }
+                                    ff_command_queue_destroy(player->commands);
+                                }
+                                filter_updates_destroy(player);
+                            }
+                            ff_decoder_cache_destroy(player->decoder_cache);
                         }
+                        cnd_destroy(&player->continue_read_thread);
                     }
                     frame_queues_destroy(player);
                 }
@@ -1588,16 +3425,31 @@ void ff_player_close(ff_player_t* player) {
         ff_player_abort(player);
         thrd_join(player->read_thread, NULL);
     }
+    presenter_stop(player);
+    cancel_commands(player);
+    ff_player_stop_recording(player);
     if (player->audio_stream_index >= 0) {
         stream_close(player, player->audio_stream_index);
     }
     if (player->video_stream_index >= 0) {
         stream_close(player, player->video_stream_index);
     }
+    if (player->subtitle_stream_index >= 0) {
+        stream_close(player, player->subtitle_stream_index);
+    }
+    audio_tracks_destroy(player);
     avformat_close_input(&player->format_context);
+    if (player->timeshift != NULL) {
+        ff_timeshift_destroy(player->timeshift);
+    }
 
     packet_queues_destroy(player);
     frame_queues_destroy(player);
+    ff_decoder_cache_destroy(player->decoder_cache);
+    filter_updates_destroy(player);
+    ff_command_queue_destroy(player->commands);
+    mtx_destroy(&player->state_mutex);
+    mtx_destroy(&player->recorder_mutex);
 
     cnd_destroy(&player->continue_read_thread);
     ff_player_opts_destroy(&player->opts);
@@ -1610,7 +3462,47 @@ void ff_player_destroy(ff_player_t* player) {
     free(player);
 }
 
-ff_frame_t* ff_player_acquire_video_frame(ff_player_t* player, double* remaining_time) {
+// shifts the vsync sample point so that frame starts of a detected cadence
+// fall midway between vsyncs instead of jittering across one
+static double get_cadence_bias(ff_player_t* player, const double start, const double duration, const double period) {
+    if (duration > 0.0) {
+        player->vsync_frame_duration = isnan(player->vsync_frame_duration)
+            ? duration
+            : player->vsync_frame_duration + (duration - player->vsync_frame_duration) / CADENCE_AVG_NB;
+    }
+    player->vsync_cadence = 0.0;
+    if (isnan(player->vsync_frame_duration)) {
+        return 0.0;
+    }
+    const double ratio = player->vsync_frame_duration / period;
+    for (int slots = 1; slots <= CADENCE_MAX_SLOTS; ++slots) {
+        const double cycle = round(ratio * slots);
+        if (cycle >= 1.0 && fabs(ratio * slots - cycle) < CADENCE_TOLERANCE * cycle) {
+            player->vsync_cadence = cycle / slots;
+            const double last_vsync = (double)player->display_last_vsync / 1000000.0;
+            const double phase = fmod(fmod(start - last_vsync, period) + period, period) / period;
+            const double slot = 1.0 / slots;
+            const double step = slot * period;
+            // unwrap against the previous bias so that a phase sitting on a
+            // slot edge does not flip between both ends
+            double bias = (fmod(phase, slot) - slot / 2) * period;
+            if (bias - player->vsync_bias > step / 2) {
+                bias -= step;
+            } else if (player->vsync_bias - bias > step / 2) {
+                bias += step;
+            }
+            if (fabs(bias) > step * 0.75) {
+                bias -= copysign(step, bias);
+            }
+            player->vsync_bias = bias;
+            return bias;
+        }
+    }
+    player->vsync_bias = 0.0;
+    return 0.0;
+}
+
+static ff_frame_t* acquire_video_frame(ff_player_t* player, const double vsync, double* remaining_time, ff_present_info_t* info) {
     if (!player->paused &&
         get_master_sync_type(player) == FF_AV_SYNC_EXTERNAL_CLOCK &&
         player->realtime) {
@@ -1628,7 +3520,7 @@ retry:
             }
 
             if (last_frame->serial != frame->serial) {
-                player->frame_timer = (double)av_gettime_relative() / 1000000.0;
+                player->frame_timer = isnan(vsync) ? (double)av_gettime_relative() / 1000000.0 : vsync;
             }
             if (player->paused) {
                 goto display;
@@ -1636,7 +3528,11 @@ retry:
             const double last_duration = frame_duration(player, last_frame, frame);
             const double delay = compute_target_delay(player, last_duration);
 
-            const double time = (double)av_gettime_relative()/1000000.0;
+            double time = (double)av_gettime_relative()/1000000.0;
+            if (!isnan(vsync)) {
+                const double period = (double)player->display_refresh_period / 1000000.0;
+                time = vsync + get_cadence_bias(player, player->frame_timer + delay, last_duration, period);
+            }
             if (time < player->frame_timer + delay) {
                 if (remaining_time != NULL) {
                    *remaining_time = FFMIN(player->frame_timer + delay - time, *remaining_time);
@@ -1659,6 +3555,9 @@ retry:
                 const double duration = frame_duration(player, frame, next_frame);
                 if(!player->step && (get_master_sync_type(player) != FF_AV_SYNC_VIDEO_MASTER) && time > player->frame_timer + duration) {
                     ff_frame_queue_next(player->picture_queue);
+                    if (info != NULL) {
+                        info->dropped++;
+                    }
                     goto retry;
                 }
             }
@@ -1670,6 +3569,11 @@ retry:
             }
         }
 display:
+        if (info != NULL && ff_frame_queue_rindex_shown(player->picture_queue)) {
+            info->repeat = !player->force_refresh;
+            player->force_refresh = false;
+            return ff_frame_queue_peek_last(player->picture_queue);
+        }
         if (player->force_refresh && ff_frame_queue_rindex_shown(player->picture_queue)) {
             return ff_frame_queue_peek_last(player->picture_queue);
         }
@@ -1678,283 +3582,388 @@ display:
     return NULL;
 }
 
-uint8_t* ff_player_acquire_audio_buf(ff_player_t* player, int* size) {
-    if (player->paused) {
-        return NULL;
-    }
-    ff_frame_t* frame;
-
-    do {
-        frame = ff_frame_queue_peek_readable(player->sampler_queue);
-        if (frame == NULL) {
-            return NULL;
-        }
-        ff_frame_queue_next(player->sampler_queue);
-    } while (frame->serial != ff_packet_queue_get_serial(player->audio_packet_queue));
-
-    const int data_size = av_samples_get_buffer_size(
-        NULL,
-        frame->base->ch_layout.nb_channels,
-        frame->base->nb_samples,
-        frame->base->format,
-        1
-    );
-    const int wanted_nb_samples = synchronize_audio(player, frame->base->nb_samples);
-
-    if (frame->base->format != player->audio_source.fmt ||
-        av_channel_layout_compare(&frame->base->ch_layout, &player->audio_source.ch_layout) ||
-        frame->base->sample_rate != player->audio_source.freq ||
-        (wanted_nb_samples != frame->base->nb_samples && !player->swr_context)) {
-        swr_free(&player->swr_context);
-        const int ret = swr_alloc_set_opts2(
-            &player->swr_context,
-            &player->audio_target.ch_layout,
-            player->audio_target.fmt,
-            player->audio_target.freq,
-            &frame->base->ch_layout,
-            frame->base->format,
-            frame->base->sample_rate,
-            0,
-            NULL
-        );
-        if (ret < 0 || swr_init(player->swr_context) < 0) {
-            av_log(NULL, AV_LOG_ERROR,
-                   "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
-                    frame->base->sample_rate, av_get_sample_fmt_name(frame->base->format), frame->base->ch_layout.nb_channels,
-                    player->audio_target.freq, av_get_sample_fmt_name(player->audio_target.fmt), player->audio_target.ch_layout.nb_channels);
-            swr_free(&player->swr_context);
-            return NULL;
-        }
-        if (av_channel_layout_copy(&player->audio_source.ch_layout, &frame->base->ch_layout) < 0) {
-            return NULL;
-        }
-        player->audio_source.freq = frame->base->sample_rate;
-        player->audio_source.fmt = frame->base->format;
-    }
-    int resampled_data_size;
-    uint8_t* audio_buf;
-    if (player->swr_context != NULL) {
-        const uint8_t** in = (const uint8_t**)frame->base->extended_data;
-        uint8_t **out = &player->swr_buf;
-        const int out_count = wanted_nb_samples * player->audio_target.freq / frame->base->sample_rate + 256;
-        const int out_size = av_samples_get_buffer_size(NULL, player->audio_target.ch_layout.nb_channels, out_count, player->audio_target.fmt, 0);
-        if (out_size < 0) {
-            av_log(NULL, AV_LOG_ERROR, "av_samples_get_buffer_size() failed\n");
-            return NULL;
-        }
-        if (wanted_nb_samples != frame->base->nb_samples) {
-            if (swr_set_compensation(player->swr_context, (wanted_nb_samples - frame->base->nb_samples) * player->audio_target.freq / frame->base->sample_rate,
-                                        wanted_nb_samples * player->audio_target.freq / frame->base->sample_rate) < 0) {
-                av_log(NULL, AV_LOG_ERROR, "swr_set_compensation() failed\n");
-                return NULL;
+static int present_thread(void* arg) {
+    ff_player_t* player = arg;
+    presenter_t* presenter = player->presenter;
+    for (;;) {
+        double remaining_time = PRESENT_IDLE_TIMEOUT_MS / 1000.0;
+        if (!player->standby && (!player->paused || player->force_refresh)) {
+            ff_present_info_t info = {0};
+            mtx_lock(&player->state_mutex);
+            ff_frame_t* frame = acquire_video_frame(player, NAN, &remaining_time, &info);
+            mtx_unlock(&player->state_mutex);
+            if (frame != NULL && !info.repeat) {
+                info.target_vsync = av_gettime_relative();
+                player->opts.video_frame_cb(player->opts.opaque, frame, &info);
+                // the next deadline is only known once this frame is shown
+                remaining_time = 0.0;
             }
         }
-        av_fast_malloc(&player->swr_buf, &player->swr_buf_size, out_size);
-        if (player->swr_buf == NULL) {
-            return NULL;
+        mtx_lock(&presenter->mutex);
+        if (!presenter->wakeup && !presenter->exit && remaining_time > 0.0) {
+            const int64_t timeout = (int64_t)(remaining_time * 1000000000.0);
+            struct timespec ts;
+            timespec_get(&ts, TIME_UTC);
+            ts.tv_sec += timeout / 1000000000;
+            ts.tv_nsec += timeout % 1000000000;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            cnd_timedwait(&presenter->cond, &presenter->mutex, &ts);
         }
-        const int len2 = swr_convert(player->swr_context, out, out_count, in, frame->base->nb_samples);
-        if (len2 < 0) {
-            av_log(NULL, AV_LOG_ERROR, "swr_convert() failed\n");
-            return NULL;
+        presenter->wakeup = false;
+        const bool exit = presenter->exit;
+        mtx_unlock(&presenter->mutex);
+        if (exit) {
+            break;
         }
-        if (len2 == out_count) {
-            av_log(NULL, AV_LOG_WARNING, "audio buffer is probably too small\n");
-            if (swr_init(player->swr_context) < 0) {
-                swr_free(&player->swr_context);
+    }
+    return 0;
+}
+
+static bool presenter_start(ff_player_t* player) {
+    if (player->opts.video_frame_cb == NULL) {
+        return true;
+    }
+    presenter_t* presenter = (presenter_t*)calloc(1, sizeof(presenter_t));
+    if (presenter != NULL) {
+        if (mtx_init(&presenter->mutex, mtx_plain) == thrd_success) {
+            if (cnd_init(&presenter->cond) == thrd_success) {
+                player->presenter = presenter;
+                if (thrd_create(&presenter->thread, present_thread, player) == thrd_success) {
+                    return true;
+                }
+                player->presenter = NULL;
+                cnd_destroy(&presenter->cond);
             }
+            mtx_destroy(&presenter->mutex);
         }
-        audio_buf = player->swr_buf;
-        resampled_data_size = len2 * player->audio_target.ch_layout.nb_channels * av_get_bytes_per_sample(player->audio_target.fmt);
-    } else {
-        audio_buf = frame->base->data[0];
-        resampled_data_size = data_size;
+        free(presenter);
     }
-    if (!isnan(frame->pts)) {
-        player->audio_clock_value = frame->pts + (double)frame->base->nb_samples / frame->base->sample_rate;
-    } else {
-        player->audio_clock_value = NAN;
+    return false;
+}
+
+static void presenter_stop(ff_player_t* player) {
+    presenter_t* presenter = player->presenter;
+    if (presenter == NULL) {
+        return;
     }
-    player->audio_clock_serial = frame->serial;
-    *size = resampled_data_size;
+    mtx_lock(&presenter->mutex);
+    presenter->exit = true;
+    cnd_signal(&presenter->cond);
+    mtx_unlock(&presenter->mutex);
+    thrd_join(presenter->thread, NULL);
+
+    cnd_destroy(&presenter->cond);
+    mtx_destroy(&presenter->mutex);
+    free(presenter);
+    player->presenter = NULL;
+}
+
+ff_frame_t* ff_player_acquire_video_frame(ff_player_t* player, double* remaining_time) {
+    mtx_lock(&player->state_mutex);
+    ff_frame_t* frame = acquire_video_frame(player, NAN, remaining_time, NULL);
+    mtx_unlock(&player->state_mutex);
+    return frame;
+}
 
-    return audio_buf;
+ff_frame_t* ff_player_acquire_video_frame_at_vsync(ff_player_t* player, ff_present_info_t* info) {
+    const int64_t now = av_gettime_relative();
+    const int64_t period = player->display_refresh_period;
+    int64_t target = now;
+    if (period > 0) {
+        target = player->display_last_vsync;
+        if (now >= target) {
+            target += ((now - target) / period + 1) * period;
+        }
+    }
+    memset(info, 0, sizeof(ff_present_info_t));
+    info->target_vsync = target;
+
+    mtx_lock(&player->state_mutex);
+    ff_frame_t* frame = acquire_video_frame(player, period > 0 ? (double)target / 1000000.0 : NAN, NULL, info);
+    mtx_unlock(&player->state_mutex);
+    info->cadence = player->vsync_cadence;
+    return frame;
 }
 
-void ff_player_sync_audio(ff_player_t* player, const int64_t write_start_time, const int written) {
-    if (!isnan(player->audio_clock_value)) {
-        ff_clock_set_at(&player->audio_clock, player->audio_clock_value - (double)(2 * player->audio_hw_buf_size + written) / player->audio_target.bytes_per_sec, player->audio_clock_serial, (double)write_start_time / 1000000.0);
-        ff_clock_sync_to_slave(&player->external_clock, &player->audio_clock, AV_NOSYNC_THRESHOLD);
+int ff_player_peek_video_frames(ff_player_t* player, ff_frame_lookahead_t* frames, const int max_frames) {
+    if (player->video_stream == NULL) {
+        return 0;
+    }
+    const int serial = ff_packet_queue_get_serial(player->video_packet_queue);
+    const ff_frame_t* previous = NULL;
+    if (ff_frame_queue_rindex_shown(player->picture_queue)) {
+        previous = ff_frame_queue_peek_last(player->picture_queue);
     }
+    mtx_lock(&player->state_mutex);
+    const bool scheduled = previous != NULL && !player->paused;
+    double present_time = player->frame_timer;
+    mtx_unlock(&player->state_mutex);
+    int count = 0;
+    for (int i = 0; count < max_frames; ++i) {
+        ff_frame_t* frame = ff_frame_queue_peek_nth(player->picture_queue, i);
+        if (frame == NULL) {
+            break;
+        }
+        if (frame->serial != serial) {
+            continue;
+        }
+        if (scheduled) {
+            const double duration = frame_duration(player, previous, frame);
+            present_time += count == 0 ? compute_target_delay(player, duration) : duration;
+        }
+        frames[count].frame = frame;
+        frames[count].present_time = scheduled ? (int64_t)(present_time * 1000000.0) : AV_NOPTS_VALUE;
+        previous = frame;
+        ++count;
+    }
+    return count;
 }
 
-void ff_player_toggle_pause(ff_player_t* player) {
-    stream_toggle_pause(player);
-    player->step = false;
+bool ff_player_begin_video_upload(ff_player_t* player, ff_frame_t* frame) {
+    return ff_frame_queue_begin_upload(player->picture_queue, frame);
 }
 
-void ff_player_update_volume(ff_player_t* player, const int max_volume, const int sign, const double step) {
-    const double volume_level = player->opts.audio_volume ? (20 * log(player->opts.audio_volume / (double)max_volume) / log(10)) : -1000.0;
-    const long int new_volume = lrint(max_volume * pow(10.0, (volume_level + sign * step) / 20.0));
-    int res_volume;
-    if (player->opts.audio_volume == new_volume) {
-        res_volume = player->opts.audio_volume + sign;
-    } else {
-        res_volume = (int)new_volume;
-    }
-    player->opts.audio_volume = av_clip(res_volume, 0, max_volume);
+void ff_player_end_video_upload(ff_player_t* player, ff_frame_t* frame, const bool uploaded) {
+    ff_frame_queue_end_upload(player->picture_queue, frame, uploaded);
 }
 
-void ff_player_step_to_next_frame(ff_player_t *player) {
-    if (player->paused) {
-        stream_toggle_pause(player);
-    }
-    player->step = true;
+bool ff_player_wait_video_upload(ff_player_t* player, ff_frame_t* frame) {
+    return ff_frame_queue_wait_upload(player->picture_queue, frame);
 }
 
-void ff_player_cycle_channel(ff_player_t* player, const enum AVMediaType media_type) {
-    int start_index;
-    int old_index;
-    const ff_stream_params_t* params = NULL;
-    if (media_type == AVMEDIA_TYPE_VIDEO) {
-        start_index = player->last_video_stream_index;
-        old_index = player->video_stream_index;
-        params = &player->opts.video_stream_params;
-    } else if (media_type == AVMEDIA_TYPE_AUDIO) {
-        start_index = player->last_audio_stream_index;
-        old_index = player->audio_stream_index;
-        params = &player->opts.audio_stream_params;
-    } else {
-        return;
+void ff_player_set_display_timing(ff_player_t* player, const int64_t refresh_period, const int64_t last_vsync) {
+    if (refresh_period != player->display_refresh_period) {
+        player->vsync_frame_duration = NAN;
+        player->vsync_cadence = 0.0;
+        player->vsync_bias = 0.0;
     }
-    int stream_index = start_index;
-    unsigned int stream_count = player->format_context->nb_streams;
-
-    const AVProgram* program = NULL;
-    AVFormatContext* format_context = player->format_context;
+    player->display_refresh_period = refresh_period;
+    player->display_last_vsync = last_vsync;
+}
 
-    if (media_type != AVMEDIA_TYPE_VIDEO && player->video_stream_index != -1) {
-        program = av_find_program_from_stream(format_context, NULL, player->video_stream_index);
-        if (program != NULL) {
-            stream_count = program->nb_stream_indexes;
-            for (start_index = 0; start_index < stream_count; start_index++) {
-                if (program->stream_index[start_index] == stream_index) {
-                    break;
-                }
-            }
-            if (start_index == stream_count) {
-                start_index = -1;
-            }
-            stream_index = start_index;
-        }
+ff_frame_t* ff_player_acquire_subtitle(ff_player_t* player) {
+    if (player->subtitle_stream == NULL) {
+        return NULL;
     }
-    for (;;) {
-        if (++stream_index >= stream_count) {
-            if (start_index == -1) {
-                return;
-            }
-            stream_index = 0;
-        }
-        if (stream_index == start_index) {
-            return;
+    const double pts = player->video_stream != NULL ? ff_clock_get_pts(&player->video_clock) : get_master_clock(player);
+    const int serial = ff_packet_queue_get_serial(player->subtitle_packet_queue);
+
+    while (ff_frame_queue_get_frames_remaining(player->subpicture_queue) > 0) {
+        const ff_frame_t* sp = ff_frame_queue_peek(player->subpicture_queue);
+        const ff_frame_t* sp2 = NULL;
+        if (ff_frame_queue_get_frames_remaining(player->subpicture_queue) > 1) {
+            sp2 = ff_frame_queue_peek_next(player->subpicture_queue);
         }
-        int stream_index_pick;
-        if (program != NULL) {
-            stream_index_pick = (int)program->stream_index[stream_index];
+        if (sp->serial != serial ||
+            pts > sp->pts + (double)sp->sub.end_display_time / 1000 ||
+            (sp2 != NULL && pts > sp2->pts + (double)sp2->sub.start_display_time / 1000)) {
+            ff_frame_queue_next(player->subpicture_queue);
         } else {
-            stream_index_pick = stream_index;
+            break;
         }
-        const AVStream* stream = player->format_context->streams[stream_index_pick];
-        if (stream->codecpar->codec_type == media_type) {
-            switch (media_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                if (stream->codecpar->sample_rate != 0 &&
-                    stream->codecpar->ch_layout.nb_channels != 0) {
-                }
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-            case AVMEDIA_TYPE_SUBTITLE:
-            default:
-                break;
-            }
+    }
+    if (ff_frame_queue_get_frames_remaining(player->subpicture_queue) > 0) {
+        ff_frame_t* sp = ff_frame_queue_peek(player->subpicture_queue);
+        if (pts >= sp->pts + (double)sp->sub.start_display_time / 1000) {
+            return sp;
         }
     }
-    if (program != NULL && stream_index != -1) {
-        stream_index = (int)program->stream_index[stream_index];
+    return NULL;
+}
+
+static void set_audio_clock(ff_player_t* player, double pts, const int serial, const int64_t now) {
+    if (player->opts.smooth_audio_clock) {
+        pts = ff_audio_pll_update(&player->audio_pll, pts, serial, now);
     }
-    av_log(
-        NULL,
-        AV_LOG_INFO,
-        "Switch %s stream from #%d to #%d\n",
-        av_get_media_type_string(media_type),
-        old_index,
-        stream_index
-    );
-    stream_close(player, old_index);
-    stream_open(player, stream_index, params);
+    ff_clock_set_at(&player->audio_clock, pts, serial, now);
+    ff_clock_sync_to_slave_at(&player->external_clock, &player->audio_clock, AV_NOSYNC_THRESHOLD, now);
 }
 
-void ff_player_seek_chapter(ff_player_t* player, const int incr) {
-    const int64_t pos = (int64_t)(get_master_clock(player) * (double)AV_TIME_BASE);
-    if (!player->format_context->nb_chapters) {
+// pts is the end of the data handed to the device so far, bytes its offset
+// in the delivered stream
+static void update_audio_tail(ff_player_t* player, const double pts, const int serial, const int64_t bytes, const int64_t now) {
+    player->audio_tail_pts = pts;
+    player->audio_tail_serial = serial;
+    player->audio_tail_bytes = bytes;
+    if (player->audio_position_reported) {
         return;
     }
-    int i = 0;
-    for (; i < player->format_context->nb_chapters; i++) {
-        const AVChapter* chapter = player->format_context->chapters[i];
-        if (av_compare_ts(pos, AV_TIME_BASE_Q, chapter->start, chapter->time_base) < 0) {
-            i--;
-            break;
+    double latency = (double)(2 * player->audio_hw_buf_size) / player->audio_target.bytes_per_sec;
+    if (player->audio_device_latency >= 0) {
+        latency = (double)player->audio_device_latency / 1000000000.0;
+    }
+    set_audio_clock(player, pts - latency, serial, now);
+}
+
+uint8_t* ff_player_acquire_audio_buf(ff_player_t* player, int* size) {
+    if (player->paused || player->opts.pull_audio) {
+        return NULL;
+    }
+    ff_audio_gain_set(&player->audio_gain, get_audio_gain(player));
+
+    uint8_t* buf = convert_audio_frame(player, &player->audio_gain, size, &player->audio_clock_value, &player->audio_clock_serial);
+    if (buf != NULL) {
+        player->audio_bytes_delivered += *size;
+    }
+    return buf;
+}
+
+int ff_player_read_audio(ff_player_t* player, uint8_t* dst, const int nbytes, const int64_t now) {
+    const int silence = player->audio_target.fmt == AV_SAMPLE_FMT_U8 ? 0x80 : 0;
+    if (player->audio_ring == NULL || player->paused) {
+        memset(dst, silence, nbytes);
+        return 0;
+    }
+    const int serial = ff_packet_queue_get_serial(player->audio_packet_queue);
+    const int bytes_per_sec = player->audio_target.bytes_per_sec;
+    double pts = NAN;
+    int pts_serial = -1;
+    int read = 0;
+
+    ff_audio_ring_chunk_t chunk;
+    size_t pending;
+    while (read < nbytes && ff_audio_ring_peek(player->audio_ring, &chunk, &pending)) {
+        if (chunk.serial != serial) {
+            ff_audio_ring_read(player->audio_ring, NULL, pending);
+            continue;
         }
+        const size_t len = FFMIN(pending, (size_t)(nbytes - read));
+        ff_audio_ring_read(player->audio_ring, dst + read, len);
+        read += (int)len;
+        pts = chunk.pts - (double)(pending - len) / bytes_per_sec;
+        pts_serial = chunk.serial;
     }
-    i += incr;
-    i = FFMAX(i, 0);
-    if (i >= player->format_context->nb_chapters) {
+    if (read > 0) {
+        ff_audio_gain_set(&player->audio_gain, get_audio_gain(player));
+        ff_audio_gain_apply(
+            &player->audio_gain,
+            dst,
+            (const uint8_t* const*)&dst,
+            player->audio_target.fmt,
+            player->audio_target.ch_layout.nb_channels,
+            read / player->audio_target.frame_size
+        );
+    }
+    memset(dst + read, silence, nbytes - read);
+
+    if (!isnan(pts)) {
+        update_audio_tail(player, pts, pts_serial, player->audio_bytes_delivered + read, now * 1000);
+    }
+    player->audio_bytes_delivered += nbytes;
+    return read;
+}
+
+void ff_player_sync_audio(ff_player_t* player, const int64_t write_start_time, const int written) {
+    if (!isnan(player->audio_clock_value)) {
+        update_audio_tail(
+            player,
+            player->audio_clock_value - (double)written / player->audio_target.bytes_per_sec,
+            player->audio_clock_serial,
+            player->audio_bytes_delivered - written,
+            write_start_time * 1000
+        );
+    }
+}
+
+void ff_player_report_audio_latency(ff_player_t* player, const int64_t latency) {
+    player->audio_device_latency = latency >= 0 ? latency * 1000 : -1;
+}
+
+void ff_player_report_audio_position(ff_player_t* player, const int64_t frames_played, const int64_t time) {
+    if (isnan(player->audio_tail_pts) || player->audio_target.frame_size <= 0) {
         return;
     }
-    av_log(NULL, AV_LOG_VERBOSE, "Seeking to chapter %d.\n", i);
-    stream_seek(
+    const int64_t queued = FFMAX(player->audio_tail_bytes - frames_played * player->audio_target.frame_size, 0);
+    player->audio_position_reported = true;
+    set_audio_clock(
         player,
-        av_rescale_q(player->format_context->chapters[i]->start, player->format_context->chapters[i]->time_base,
-        AV_TIME_BASE_Q),
-        0,
-    false
+        player->audio_tail_pts - (double)queued / player->audio_target.bytes_per_sec,
+        player->audio_tail_serial,
+        time * 1000
     );
 }
 
-void ff_player_seek(ff_player_t* player, double incr) {
-    double pos;
-    if (player->opts.seek_by_bytes) {
-        pos = -1;
-        if (pos < 0 && player->video_stream_index >= 0) {
-            pos = (double)ff_frame_queue_get_last_pos(player->picture_queue);
-        }
-        if (pos < 0 && player->audio_stream_index >= 0) {
-            pos = (double)ff_frame_queue_get_last_pos(player->sampler_queue);
-        }
-        if (pos < 0) {
-            pos = (double)avio_tell(player->format_context->pb);
-        }
-        if (player->format_context->bit_rate) {
-            incr *= (double)player->format_context->bit_rate / 8.0;
-        } else {
-            incr *= 180000.0;
-        }
-        pos += incr;
-    } else {
-        pos = get_master_clock(player);
-        if (isnan(pos)) {
-            pos = (double)player->seek_pos / AV_TIME_BASE;
-        }
-        pos += incr;
-        const double tmp_pos = (double)player->format_context->start_time / AV_TIME_BASE;
-        if (player->format_context->start_time != AV_NOPTS_VALUE && pos < tmp_pos) {
-            pos = tmp_pos;
+int ff_player_post_command(
+    ff_player_t* player,
+    const ff_player_command_t* command,
+    const ff_command_done_callback done,
+    void* opaque
+) {
+    if (player->commands == NULL) {
+        return AVERROR(EINVAL);
+    }
+    if (is_gain_command(command->type)) {
+        const int result = run_command(player, command);
+        if (done != NULL) {
+            done(opaque, result);
         }
-        pos *= AV_TIME_BASE;
-        incr *= AV_TIME_BASE;
+        return 0;
     }
-    stream_seek(player, (int64_t)pos, (int64_t)incr, player->opts.seek_by_bytes);
+    const queued_command_t queued = {
+        .command = *command,
+        .done = done,
+        .opaque = opaque,
+    };
+    const int ret = ff_command_queue_push(player->commands, &queued);
+    if (ret >= 0) {
+        cnd_signal(&player->continue_read_thread);
+    }
+    return ret;
+}
+
+int ff_player_toggle_pause(ff_player_t* player) {
+    return ff_player_post_command(player, &(ff_player_command_t){ .type = FF_PLAYER_COMMAND_TOGGLE_PAUSE }, NULL, NULL);
+}
+
+int ff_player_update_volume(ff_player_t* player, const int max_volume, const int sign, const double step) {
+    const ff_player_command_t command = {
+        .type = FF_PLAYER_COMMAND_UPDATE_VOLUME,
+        .args.volume = { .max_volume = max_volume, .sign = sign, .step = step },
+    };
+    return ff_player_post_command(player, &command, NULL, NULL);
+}
+
+int ff_player_toggle_mute(ff_player_t* player) {
+    return ff_player_post_command(player, &(ff_player_command_t){ .type = FF_PLAYER_COMMAND_TOGGLE_MUTE }, NULL, NULL);
+}
+
+int ff_player_step_to_next_frame(ff_player_t *player) {
+    return ff_player_post_command(player, &(ff_player_command_t){ .type = FF_PLAYER_COMMAND_STEP_TO_NEXT_FRAME }, NULL, NULL);
+}
+
+int ff_player_cycle_channel(ff_player_t* player, const enum AVMediaType media_type) {
+    const ff_player_command_t command = {
+        .type = FF_PLAYER_COMMAND_CYCLE_CHANNEL,
+        .args.media_type = media_type,
+    };
+    return ff_player_post_command(player, &command, NULL, NULL);
+}
+
+int ff_player_seek_chapter(ff_player_t* player, const int incr) {
+    const ff_player_command_t command = {
+        .type = FF_PLAYER_COMMAND_SEEK_CHAPTER,
+        .args.chapter_incr = incr,
+    };
+    return ff_player_post_command(player, &command, NULL, NULL);
+}
+
+int ff_player_set_standby(ff_player_t* player, const bool standby) {
+    const ff_player_command_t command = {
+        .type = FF_PLAYER_COMMAND_SET_STANDBY,
+        .args.standby = standby,
+    };
+    return ff_player_post_command(player, &command, NULL, NULL);
+}
+
+int ff_player_seek(ff_player_t* player, const double incr) {
+    const ff_player_command_t command = {
+        .type = FF_PLAYER_COMMAND_SEEK,
+        .args.seek_incr = incr,
+    };
+    return ff_player_post_command(player, &command, NULL, NULL);
 }
 
 const ff_audio_params_t* ff_player_get_audio_params(const ff_player_t* player) {
@@ -1962,21 +3971,162 @@ const ff_audio_params_t* ff_player_get_audio_params(const ff_player_t* player) {
 }
 
 int ff_player_get_audio_volume(const ff_player_t* player) {
-    return player->opts.audio_volume;
+    return player->audio_volume;
 }
 
 const AVFormatContext* ff_player_get_format_context(const ff_player_t* player) {
     return player->format_context;
 }
 
+bool ff_player_get_muted(const ff_player_t* player) {
+    return player->muted;
+}
+
+double ff_player_get_audio_clock(const ff_player_t* player) {
+    return ff_clock_get(&player->audio_clock);
+}
+
+int ff_player_get_video_skip_level(const ff_player_t* player) {
+    if (player->video_decoder == NULL) {
+        return FF_DECODER_SKIP_NONE;
+    }
+    return ff_decoder_get_skip_level(player->video_decoder);
+}
+
 bool ff_player_get_paused(const ff_player_t* player) {
     return player->paused;
 }
 
+bool ff_player_get_standby(const ff_player_t* player) {
+    return player->standby;
+}
+
+int ff_player_start_recording(ff_player_t* player, const char* path, const char* format) {
+    char* path_copy = av_strdup(path);
+    char* format_copy = format != NULL ? av_strdup(format) : NULL;
+    if (path_copy == NULL || (format != NULL && format_copy == NULL)) {
+        av_free(path_copy);
+        av_free(format_copy);
+        return AVERROR(ENOMEM);
+    }
+    mtx_lock(&player->recorder_mutex);
+    const bool busy = player->recorder != NULL || player->record_req || player->record_error != 0;
+    if (!busy) {
+        player->record_req = true;
+        player->record_path = path_copy;
+        player->record_format = format_copy;
+    }
+    mtx_unlock(&player->recorder_mutex);
+    if (busy) {
+        av_free(path_copy);
+        av_free(format_copy);
+        return AVERROR(EBUSY);
+    }
+    cnd_signal(&player->continue_read_thread);
+    return 0;
+}
+
+void ff_player_stop_recording(ff_player_t* player) {
+    mtx_lock(&player->recorder_mutex);
+    ff_recorder_t* recorder = player->recorder;
+    player->recorder = NULL;
+    clear_recording_request(player);
+    player->record_error = 0;
+    mtx_unlock(&player->recorder_mutex);
+    if (recorder != NULL) {
+        ff_recorder_destroy(recorder);
+    }
+}
+
+bool ff_player_get_recording_stats(ff_player_t* player, ff_recorder_stats_t* stats) {
+    mtx_lock(&player->recorder_mutex);
+    const bool recording = player->recorder != NULL || player->record_req || player->record_error != 0;
+    if (player->recorder != NULL) {
+        ff_recorder_get_stats(player->recorder, stats);
+    } else if (recording) {
+        memset(stats, 0, sizeof(ff_recorder_stats_t));
+        stats->error = player->record_error;
+    }
+    mtx_unlock(&player->recorder_mutex);
+    return recording;
+}
+
+bool ff_player_get_timeshift_window(const ff_player_t* player, int64_t* start, int64_t* end) {
+    if (player->timeshift == NULL) {
+        return false;
+    }
+    ff_timeshift_get_window(player->timeshift, start, end);
+    return true;
+}
+
+int64_t ff_player_get_buffered_bytes(const ff_player_t* player) {
+    return (int64_t)(ff_packet_queue_get_size(player->audio_packet_queue) +
+                     ff_packet_queue_get_size(player->video_packet_queue) +
+                     ff_packet_queue_get_size(player->subtitle_packet_queue));
+}
+
 bool ff_player_get_force_refresh(const ff_player_t* player) {
     return player->force_refresh;
 }
 
 void ff_player_set_force_refresh(ff_player_t* player, bool force_refresh) {
     player->force_refresh = force_refresh;
-}
\ No newline at end of file
+    if (force_refresh) {
+        presenter_wake(player->presenter);
+    }
+}
+
+static int set_filters(ff_player_t* player, filter_update_t* update, const char* filters) {
+    char* copy = NULL;
+    if (filters != NULL && (copy = av_strdup(filters)) == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    mtx_lock(&player->filter_mutex);
+    av_free(update->filters);
+    update->filters = copy;
+    update->pending = true;
+    mtx_unlock(&player->filter_mutex);
+
+    return 0;
+}
+
+int ff_player_set_video_filters(ff_player_t* player, const char* filters) {
+    return set_filters(player, &player->video_filter_update, filters);
+}
+
+int ff_player_set_audio_filters(ff_player_t* player, const char* filters) {
+    return set_filters(player, &player->audio_filter_update, filters);
+}
+
+int ff_player_send_filter_command(
+    ff_player_t* player,
+    const enum AVMediaType media_type,
+    const char* target,
+    const char* command,
+    const char* arg
+) {
+    filter_update_t* update = NULL;
+    if (media_type == AVMEDIA_TYPE_VIDEO) {
+        update = &player->video_filter_update;
+    } else if (media_type == AVMEDIA_TYPE_AUDIO) {
+        update = &player->audio_filter_update;
+    } else {
+        return AVERROR(EINVAL);
+    }
+    filter_command_t* item = &(filter_command_t){
+        .target = av_strdup(target),
+        .command = av_strdup(command),
+        .arg = av_strdup(arg != NULL ? arg : "")
+    };
+    if (item->target == NULL || item->command == NULL || item->arg == NULL) {
+        filter_command_release(item);
+        return AVERROR(ENOMEM);
+    }
+    mtx_lock(&player->filter_mutex);
+    const int ret = av_fifo_write(update->commands, item, 1);
+    mtx_unlock(&player->filter_mutex);
+    if (ret < 0) {
+        filter_command_release(item);
+    }
+    return ret;
+}
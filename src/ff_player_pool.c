@@ -0,0 +1,172 @@
+#include "ff_player_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+typedef struct player_pool_entry {
+    char* filename;
+    ff_player_t* player;
+} player_pool_entry_t;
+
+// entries are kept in least recently used order
+struct ff_player_pool {
+    player_pool_entry_t* entries;
+    int entry_count;
+    int capacity;
+    int64_t max_bytes;
+};
+
+static void close_player(ff_player_t* player) {
+    ff_player_close(player);
+    ff_player_destroy(player);
+}
+
+static void player_pool_remove(ff_player_pool_t* pool, const int index) {
+    av_free(pool->entries[index].filename);
+    memmove(
+        pool->entries + index,
+        pool->entries + index + 1,
+        (size_t)(pool->entry_count - index - 1) * sizeof(player_pool_entry_t)
+    );
+    --pool->entry_count;
+}
+
+static void player_pool_evict(ff_player_pool_t* pool) {
+    close_player(pool->entries[0].player);
+    player_pool_remove(pool, 0);
+}
+
+static int player_pool_find(const ff_player_pool_t* pool, const char* filename) {
+    for (int i = 0; i < pool->entry_count; ++i) {
+        if (strcmp(pool->entries[i].filename, filename) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int player_pool_insert(ff_player_pool_t* pool, const char* filename, ff_player_t* player) {
+    char* key = av_strdup(filename);
+    if (key == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    if (pool->entry_count == pool->capacity) {
+        player_pool_evict(pool);
+    }
+    pool->entries[pool->entry_count++] = (player_pool_entry_t){
+        .filename = key,
+        .player = player
+    };
+    ff_player_pool_trim(pool);
+    return 0;
+}
+
+static int open_player(const char* filename, const ff_player_opts_t* opts, const bool standby, ff_player_t** player) {
+    ff_player_opts_t pool_opts = *opts;
+    pool_opts.run_sync = false;
+    pool_opts.standby = standby;
+
+    *player = ff_player_create();
+    if (*player == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    const int ret = ff_player_open(*player, filename, opts->input_format, NULL, &pool_opts);
+    if (ret < 0) {
+        ff_player_destroy(*player);
+        *player = NULL;
+    }
+    return ret;
+}
+
+ff_player_pool_t* ff_player_pool_create(const int capacity, const int64_t max_bytes) {
+    if (capacity < 0) {
+        return NULL;
+    }
+    ff_player_pool_t* pool = (ff_player_pool_t*)calloc(1, sizeof(ff_player_pool_t));
+    if (pool != NULL) {
+        pool->entries = (player_pool_entry_t*)calloc((size_t)FFMAX(capacity, 1), sizeof(player_pool_entry_t));
+        if (pool->entries != NULL) {
+            pool->capacity = capacity;
+            pool->max_bytes = max_bytes;
+            return pool;
+        }
+        free(pool);
+    }
+    return NULL;
+}
+
+void ff_player_pool_destroy(ff_player_pool_t* pool) {
+    while (pool->entry_count > 0) {
+        player_pool_evict(pool);
+    }
+    free(pool->entries);
+    free(pool);
+}
+
+int ff_player_pool_prepare(ff_player_pool_t* pool, const char* filename, const ff_player_opts_t* opts) {
+    if (pool->capacity == 0 || player_pool_find(pool, filename) >= 0) {
+        return 0;
+    }
+    ff_player_t* player;
+    int ret = open_player(filename, opts, true, &player);
+    if (ret >= 0) {
+        ret = player_pool_insert(pool, filename, player);
+        if (ret < 0) {
+            close_player(player);
+        }
+    }
+    return ret;
+}
+
+int ff_player_pool_acquire(ff_player_pool_t* pool, const char* filename, const ff_player_opts_t* opts, ff_player_t** player) {
+    const int index = player_pool_find(pool, filename);
+    if (index < 0) {
+        return open_player(filename, opts, false, player);
+    }
+    *player = pool->entries[index].player;
+    player_pool_remove(pool, index);
+    const int ret = ff_player_set_standby(*player, false);
+    if (ret < 0) {
+        close_player(*player);
+        *player = NULL;
+    }
+    return ret;
+}
+
+int ff_player_pool_release(ff_player_pool_t* pool, const char* filename, ff_player_t* player) {
+    const int index = player_pool_find(pool, filename);
+    if (index >= 0) {
+        close_player(pool->entries[index].player);
+        player_pool_remove(pool, index);
+    }
+    if (pool->capacity == 0) {
+        close_player(player);
+        return 0;
+    }
+    int ret = ff_player_set_standby(player, true);
+    if (ret >= 0) {
+        ret = player_pool_insert(pool, filename, player);
+    }
+    if (ret < 0) {
+        close_player(player);
+    }
+    return ret;
+}
+
+void ff_player_pool_trim(ff_player_pool_t* pool) {
+    if (pool->max_bytes <= 0) {
+        return;
+    }
+    int64_t total = 0;
+    for (int i = 0; i < pool->entry_count; ++i) {
+        total += ff_player_get_buffered_bytes(pool->entries[i].player);
+    }
+    while (pool->entry_count > 0 && total > pool->max_bytes) {
+        total -= ff_player_get_buffered_bytes(pool->entries[0].player);
+        player_pool_evict(pool);
+    }
+}
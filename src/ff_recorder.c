@@ -0,0 +1,323 @@
+#include "ff_recorder.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libavutil/fifo.h>
+#include <libavutil/error.h>
+
+#ifdef HAVE_THREAD_H
+#include "thread.h"
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+enum {
+    RECORDER_MAX_QUEUE_SIZE = 32 * 1024 * 1024,
+};
+
+typedef struct recorder_stream {
+    int output_index;
+    AVRational time_base;
+    int64_t start_pts;
+    int64_t last_dts;
+    // timeline last_dts belongs to
+    int epoch;
+} recorder_stream_t;
+
+struct ff_recorder {
+    AVFormatContext* output;
+
+    recorder_stream_t* streams;
+    int nb_streams;
+    int sync_stream_index;
+    int64_t start_time;
+    // end of the written timeline in AV_TIME_BASE units
+    int64_t end_time;
+    int epoch;
+    bool wait_keyframe;
+    bool rebase;
+
+    AVFifo* packets;
+    size_t queued_size;
+    bool finished;
+    bool failed;
+    ff_recorder_stats_t stats;
+
+    mtx_t mutex;
+    cnd_t cond;
+    thrd_t thread;
+};
+
+static void drop_packet(ff_recorder_t* recorder, AVPacket** packet) {
+    ++recorder->stats.packets_dropped;
+    recorder->stats.bytes_dropped += (*packet)->size;
+    av_packet_free(packet);
+}
+
+static void set_error(ff_recorder_t* recorder, const int error) {
+    mtx_lock(&recorder->mutex);
+    if (recorder->stats.error == 0) {
+        recorder->stats.error = error;
+    }
+    recorder->failed = true;
+    mtx_unlock(&recorder->mutex);
+}
+
+static void set_start_time(ff_recorder_t* recorder, const int64_t start_time) {
+    recorder->start_time = start_time;
+    for (int i = 0; i < recorder->nb_streams; ++i) {
+        if (recorder->streams[i].output_index >= 0) {
+            recorder->streams[i].start_pts = av_rescale_q(start_time, AV_TIME_BASE_Q, recorder->streams[i].time_base);
+        }
+    }
+}
+
+// maps the input timestamps onto the output timeline; false when the packet
+// has to wait for the next sync point or would still go backwards
+static bool map_timestamps(ff_recorder_t* recorder, const AVPacket* packet, const bool sync_point, int64_t* pts, int64_t* dts) {
+    const recorder_stream_t* stream = &recorder->streams[packet->stream_index];
+    const int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    // seeks and time-shift jumps go backwards, which muxers reject; streams
+    // that have not caught up with a rebase only drop their overlap
+    if (ts != AV_NOPTS_VALUE && stream->last_dts != AV_NOPTS_VALUE && stream->epoch == recorder->epoch &&
+        recorder->start_time != AV_NOPTS_VALUE && ts - stream->start_pts <= stream->last_dts) {
+        recorder->rebase = true;
+        recorder->wait_keyframe = recorder->sync_stream_index >= 0;
+    }
+    if (recorder->wait_keyframe && !sync_point) {
+        return false;
+    }
+    if (ts != AV_NOPTS_VALUE && recorder->start_time == AV_NOPTS_VALUE) {
+        set_start_time(recorder, av_rescale_q(ts, stream->time_base, AV_TIME_BASE_Q));
+    } else if (ts != AV_NOPTS_VALUE && recorder->rebase) {
+        // the new timeline continues where the written one ends
+        set_start_time(recorder, av_rescale_q(ts, stream->time_base, AV_TIME_BASE_Q) - recorder->end_time);
+        ++recorder->epoch;
+        recorder->rebase = false;
+    }
+    *pts = packet->pts != AV_NOPTS_VALUE ? packet->pts - stream->start_pts : AV_NOPTS_VALUE;
+    *dts = packet->dts != AV_NOPTS_VALUE ? packet->dts - stream->start_pts : AV_NOPTS_VALUE;
+    const int64_t out = *dts != AV_NOPTS_VALUE ? *dts : *pts;
+    return out == AV_NOPTS_VALUE || stream->last_dts == AV_NOPTS_VALUE || out > stream->last_dts;
+}
+
+static void track_timestamps(ff_recorder_t* recorder, const AVPacket* packet, const int64_t ts) {
+    recorder_stream_t* stream = &recorder->streams[packet->stream_index];
+    if (ts == AV_NOPTS_VALUE) {
+        return;
+    }
+    stream->last_dts = ts;
+    stream->epoch = recorder->epoch;
+    const int64_t end = av_rescale_q_rnd(
+        ts + FFMAX(packet->duration, 1),
+        stream->time_base,
+        AV_TIME_BASE_Q,
+        AV_ROUND_UP | AV_ROUND_PASS_MINMAX
+    );
+    recorder->end_time = FFMAX(recorder->end_time, end);
+}
+
+static int write_packet(ff_recorder_t* recorder, AVPacket* packet) {
+    const recorder_stream_t* stream = &recorder->streams[packet->stream_index];
+    const AVStream* output_stream = recorder->output->streams[stream->output_index];
+    packet->stream_index = stream->output_index;
+    packet->pos = -1;
+    av_packet_rescale_ts(packet, stream->time_base, output_stream->time_base);
+    return av_interleaved_write_frame(recorder->output, packet);
+}
+
+static int mux_thread(void* arg) {
+    ff_recorder_t* recorder = arg;
+    AVFormatContext* output = recorder->output;
+    int ret = 0;
+    if (!(output->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&output->pb, output->url, AVIO_FLAG_WRITE);
+    }
+    if (ret >= 0) {
+        ret = avformat_write_header(output, NULL);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not write header of %s, %s\n", output->url, av_err2str(ret));
+        }
+    } else {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s, %s\n", output->url, av_err2str(ret));
+    }
+    if (ret < 0) {
+        set_error(recorder, ret);
+        avio_closep(&output->pb);
+        return ret;
+    }
+    for (;;) {
+        AVPacket* packet = NULL;
+        mtx_lock(&recorder->mutex);
+        while (av_fifo_read(recorder->packets, &packet, 1) < 0 && !recorder->finished) {
+            cnd_wait(&recorder->cond, &recorder->mutex);
+        }
+        if (packet != NULL) {
+            recorder->queued_size -= packet->size;
+        }
+        mtx_unlock(&recorder->mutex);
+        if (packet == NULL) {
+            break;
+        }
+        const int size = packet->size;
+        ret = write_packet(recorder, packet);
+        av_packet_free(&packet);
+
+        mtx_lock(&recorder->mutex);
+        if (ret >= 0) {
+            ++recorder->stats.packets_written;
+            recorder->stats.bytes_written += size;
+        } else {
+            ++recorder->stats.packets_dropped;
+            recorder->stats.bytes_dropped += size;
+        }
+        mtx_unlock(&recorder->mutex);
+        if (ret < 0 && ret != AVERROR(EINVAL)) {
+            av_log(NULL, AV_LOG_ERROR, "Could not write to %s, %s\n", output->url, av_err2str(ret));
+            set_error(recorder, ret);
+            break;
+        }
+    }
+    ret = av_write_trailer(output);
+    if (!(output->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&output->pb);
+    }
+    return ret;
+}
+
+static bool add_stream(ff_recorder_t* recorder, const AVStream* input_stream) {
+    AVStream* stream = avformat_new_stream(recorder->output, NULL);
+    if (stream == NULL || avcodec_parameters_copy(stream->codecpar, input_stream->codecpar) < 0) {
+        return false;
+    }
+    stream->codecpar->codec_tag = 0;
+    stream->time_base = input_stream->time_base;
+
+    recorder_stream_t* entry = &recorder->streams[input_stream->index];
+    entry->output_index = stream->index;
+    entry->time_base = input_stream->time_base;
+    if (input_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && recorder->sync_stream_index < 0 &&
+        !(input_stream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+        recorder->sync_stream_index = input_stream->index;
+    }
+    return true;
+}
+
+static bool add_streams(ff_recorder_t* recorder, const AVFormatContext* input, const int* stream_indices, const int nb_stream_indices) {
+    for (int i = 0; i < recorder->nb_streams; ++i) {
+        recorder->streams[i].output_index = -1;
+        recorder->streams[i].start_pts = 0;
+        recorder->streams[i].last_dts = AV_NOPTS_VALUE;
+    }
+    for (int i = 0; i < nb_stream_indices; ++i) {
+        const int index = stream_indices[i];
+        if (index >= 0 && (unsigned int)index < input->nb_streams && !add_stream(recorder, input->streams[index])) {
+            return false;
+        }
+    }
+    return recorder->output->nb_streams > 0;
+}
+
+ff_recorder_t* ff_recorder_create(
+    const char* path,
+    const char* format,
+    const AVFormatContext* input,
+    const int* stream_indices,
+    const int nb_stream_indices
+) {
+    ff_recorder_t* recorder = (ff_recorder_t*)calloc(1, sizeof(ff_recorder_t));
+    if (recorder != NULL) {
+        recorder->sync_stream_index = -1;
+        recorder->start_time = AV_NOPTS_VALUE;
+        recorder->wait_keyframe = true;
+        recorder->nb_streams = (int)input->nb_streams;
+        recorder->streams = (recorder_stream_t*)calloc(input->nb_streams, sizeof(recorder_stream_t));
+        if (recorder->streams != NULL) {
+            if (avformat_alloc_output_context2(&recorder->output, NULL, format, path) >= 0) {
+                if (add_streams(recorder, input, stream_indices, nb_stream_indices)) {
+                    recorder->packets = av_fifo_alloc2(1, sizeof(AVPacket*), AV_FIFO_FLAG_AUTO_GROW);
+                    if (recorder->packets != NULL) {
+                        if (mtx_init(&recorder->mutex, mtx_plain) == thrd_success) {
+                            if (cnd_init(&recorder->cond) == thrd_success) {
+                                if (thrd_create(&recorder->thread, mux_thread, recorder) == thrd_success) {
+                                    return recorder;
+                                }
+                                cnd_destroy(&recorder->cond);
+                            }
+                            mtx_destroy(&recorder->mutex);
+                        }
+                        av_fifo_freep2(&recorder->packets);
+                    }
+                }
+                avformat_free_context(recorder->output);
+            } else {
+                av_log(NULL, AV_LOG_ERROR, "Could not find an output format for %s\n", path);
+            }
+            free(recorder->streams);
+        }
+        free(recorder);
+    }
+    return NULL;
+}
+
+void ff_recorder_destroy(ff_recorder_t* recorder) {
+    mtx_lock(&recorder->mutex);
+    recorder->finished = true;
+    cnd_signal(&recorder->cond);
+    mtx_unlock(&recorder->mutex);
+    thrd_join(recorder->thread, NULL);
+
+    AVPacket* packet;
+    while (av_fifo_read(recorder->packets, &packet, 1) >= 0) {
+        av_packet_free(&packet);
+    }
+    av_fifo_freep2(&recorder->packets);
+    cnd_destroy(&recorder->cond);
+    mtx_destroy(&recorder->mutex);
+    avformat_free_context(recorder->output);
+    free(recorder->streams);
+    free(recorder);
+}
+
+void ff_recorder_write(ff_recorder_t* recorder, const AVPacket* packet) {
+    if (packet->stream_index < 0 || packet->stream_index >= recorder->nb_streams ||
+        recorder->streams[packet->stream_index].output_index < 0 || packet->size == 0) {
+        return;
+    }
+    const bool sync_point = recorder->sync_stream_index < 0 ||
+        (packet->stream_index == recorder->sync_stream_index && (packet->flags & AV_PKT_FLAG_KEY));
+    int64_t pts;
+    int64_t dts;
+    if (!map_timestamps(recorder, packet, sync_point, &pts, &dts)) {
+        return;
+    }
+    AVPacket* ref = av_packet_clone(packet);
+
+    mtx_lock(&recorder->mutex);
+    if (ref == NULL || recorder->failed || recorder->queued_size + (size_t)packet->size > RECORDER_MAX_QUEUE_SIZE) {
+        ++recorder->stats.packets_dropped;
+        recorder->stats.bytes_dropped += packet->size;
+        av_packet_free(&ref);
+        // video resumes at the next keyframe rather than with broken references
+        recorder->wait_keyframe = recorder->sync_stream_index >= 0;
+    } else {
+        ref->pts = pts;
+        ref->dts = dts;
+        track_timestamps(recorder, ref, dts != AV_NOPTS_VALUE ? dts : pts);
+        recorder->wait_keyframe = false;
+        if (av_fifo_write(recorder->packets, &ref, 1) >= 0) {
+            recorder->queued_size += ref->size;
+            cnd_signal(&recorder->cond);
+        } else {
+            drop_packet(recorder, &ref);
+        }
+    }
+    mtx_unlock(&recorder->mutex);
+}
+
+void ff_recorder_get_stats(ff_recorder_t* recorder, ff_recorder_stats_t* stats) {
+    mtx_lock(&recorder->mutex);
+    *stats = recorder->stats;
+    mtx_unlock(&recorder->mutex);
+}
@@ -0,0 +1,257 @@
+#include "ff_thumbnailer.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/cpu.h>
+#include <libswscale/swscale.h>
+
+#include "ff_decoder_pool.h"
+
+enum {
+    // gives up on a seek point that is not followed by a keyframe
+    THUMBNAILER_MAX_PACKETS = 4096,
+};
+
+struct ff_thumbnailer {
+    AVFormatContext* format_context;
+    AVStream* stream;
+    AVCodecContext* codec_context;
+    ff_decoder_pool_t* pool;
+    struct SwsContext* sws_context;
+
+    AVPacket* packet;
+    AVFrame* frame;
+    AVFrame* thumbnail;
+
+    ff_thumbnailer_opts_t opts;
+};
+
+static void thumbnailer_free(ff_thumbnailer_t* thumbnailer) {
+    if (thumbnailer->pool != NULL) {
+        ff_decoder_pool_destroy(thumbnailer->pool);
+    }
+    sws_freeContext(thumbnailer->sws_context);
+    av_frame_free(&thumbnailer->thumbnail);
+    av_frame_free(&thumbnailer->frame);
+    av_packet_free(&thumbnailer->packet);
+    avcodec_free_context(&thumbnailer->codec_context);
+    avformat_close_input(&thumbnailer->format_context);
+    free(thumbnailer);
+}
+
+// largest decoder downscale that still covers the requested size
+static int choose_lowres(const AVCodec* codec, const AVCodecParameters* codecpar, const ff_thumbnailer_opts_t* opts) {
+    int lowres = 0;
+    if (opts->width <= 0 && opts->height <= 0) {
+        return 0;
+    }
+    while (lowres < codec->max_lowres &&
+           (codecpar->width >> (lowres + 1)) >= opts->width &&
+           (codecpar->height >> (lowres + 1)) >= opts->height) {
+        ++lowres;
+    }
+    return lowres;
+}
+
+static int open_decoder(ff_thumbnailer_t* thumbnailer) {
+    AVFormatContext* format_context = thumbnailer->format_context;
+    const AVCodec* codec = NULL;
+    const int stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (stream_index < 0) {
+        return stream_index;
+    }
+    for (unsigned int i = 0; i < format_context->nb_streams; ++i) {
+        format_context->streams[i]->discard = (int)i == stream_index ? AVDISCARD_NONKEY : AVDISCARD_ALL;
+    }
+    thumbnailer->stream = format_context->streams[stream_index];
+
+    AVCodecContext* codec_context = avcodec_alloc_context3(codec);
+    if (codec_context == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    thumbnailer->codec_context = codec_context;
+    int ret = avcodec_parameters_to_context(codec_context, thumbnailer->stream->codecpar);
+    if (ret < 0) {
+        return ret;
+    }
+    codec_context->pkt_timebase = thumbnailer->stream->time_base;
+    codec_context->lowres = choose_lowres(codec, thumbnailer->stream->codecpar, &thumbnailer->opts);
+    codec_context->skip_frame = AVDISCARD_NONKEY;
+    // a lone keyframe must come out without waiting for reordering
+    codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    codec_context->thread_count = 1;
+    ret = avcodec_open2(codec_context, codec, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+    const int nb_threads = thumbnailer->opts.nb_threads > 0 ? thumbnailer->opts.nb_threads : av_cpu_count();
+    thumbnailer->pool = ff_decoder_pool_create(codec_context, nb_threads);
+    return thumbnailer->pool != NULL ? 0 : AVERROR(ENOMEM);
+}
+
+ff_thumbnailer_t* ff_thumbnailer_create(const char* url, const ff_thumbnailer_opts_t* opts) {
+    ff_thumbnailer_t* thumbnailer = (ff_thumbnailer_t*)calloc(1, sizeof(ff_thumbnailer_t));
+    if (thumbnailer == NULL) {
+        return NULL;
+    }
+    thumbnailer->opts = *opts;
+    int ret = avformat_open_input(&thumbnailer->format_context, url, NULL, NULL);
+    if (ret >= 0) {
+        ret = avformat_find_stream_info(thumbnailer->format_context, NULL);
+    }
+    if (ret >= 0) {
+        ret = open_decoder(thumbnailer);
+    }
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s for thumbnails, %s\n", url, av_err2str(ret));
+        thumbnailer_free(thumbnailer);
+        return NULL;
+    }
+    thumbnailer->packet = av_packet_alloc();
+    thumbnailer->frame = av_frame_alloc();
+    thumbnailer->thumbnail = av_frame_alloc();
+    if (thumbnailer->packet == NULL || thumbnailer->frame == NULL || thumbnailer->thumbnail == NULL) {
+        thumbnailer_free(thumbnailer);
+        return NULL;
+    }
+    return thumbnailer;
+}
+
+void ff_thumbnailer_destroy(ff_thumbnailer_t* thumbnailer) {
+    thumbnailer_free(thumbnailer);
+}
+
+static int read_keyframe(ff_thumbnailer_t* thumbnailer, int64_t timestamp) {
+    AVFormatContext* format_context = thumbnailer->format_context;
+    if (format_context->start_time != AV_NOPTS_VALUE) {
+        timestamp += format_context->start_time;
+    }
+    int ret = avformat_seek_file(format_context, -1, INT64_MIN, timestamp, timestamp, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    for (int i = 0; i < THUMBNAILER_MAX_PACKETS; ++i) {
+        ret = av_read_frame(format_context, thumbnailer->packet);
+        if (ret < 0) {
+            return ret;
+        }
+        if (thumbnailer->packet->stream_index == thumbnailer->stream->index &&
+            (thumbnailer->packet->flags & AV_PKT_FLAG_KEY)) {
+            return 0;
+        }
+        av_packet_unref(thumbnailer->packet);
+    }
+    return AVERROR_INVALIDDATA;
+}
+
+static void get_thumbnail_size(const ff_thumbnailer_opts_t* opts, const AVFrame* frame, int* width, int* height) {
+    const AVRational sar = frame->sample_aspect_ratio.num > 0 ? frame->sample_aspect_ratio : (AVRational){1, 1};
+    const double aspect = (double)frame->width * av_q2d(sar) / frame->height;
+    *width = frame->width;
+    *height = frame->height;
+    if (opts->width > 0 && opts->height > 0) {
+        *width = opts->width;
+        *height = opts->height;
+    } else if (opts->width > 0) {
+        *width = opts->width;
+        *height = FFMAX((int)lrint(opts->width / aspect), 1);
+    } else if (opts->height > 0) {
+        *width = FFMAX((int)lrint(opts->height * aspect), 1);
+        *height = opts->height;
+    }
+}
+
+static int scale_thumbnail(ff_thumbnailer_t* thumbnailer) {
+    const AVFrame* frame = thumbnailer->frame;
+    AVFrame* thumbnail = thumbnailer->thumbnail;
+    const enum AVPixelFormat format = thumbnailer->opts.pix_fmt != AV_PIX_FMT_NONE ? thumbnailer->opts.pix_fmt : frame->format;
+    int width;
+    int height;
+    get_thumbnail_size(&thumbnailer->opts, frame, &width, &height);
+    if (width == frame->width && height == frame->height && format == frame->format) {
+        return av_frame_ref(thumbnail, frame);
+    }
+    thumbnailer->sws_context = sws_getCachedContext(
+        thumbnailer->sws_context,
+        frame->width, frame->height, frame->format,
+        width, height, format,
+        SWS_AREA, NULL, NULL, NULL
+    );
+    if (thumbnailer->sws_context == NULL) {
+        return AVERROR(EINVAL);
+    }
+    thumbnail->width = width;
+    thumbnail->height = height;
+    thumbnail->format = format;
+    int ret = av_frame_get_buffer(thumbnail, 0);
+    if (ret >= 0) {
+        ret = av_frame_copy_props(thumbnail, frame);
+        if (ret >= 0) {
+            sws_scale(
+                thumbnailer->sws_context,
+                (const uint8_t* const*)frame->data,
+                frame->linesize,
+                0,
+                frame->height,
+                thumbnail->data,
+                thumbnail->linesize
+            );
+            thumbnail->sample_aspect_ratio = (AVRational){1, 1};
+        }
+    }
+    return ret;
+}
+
+// waits for the oldest submitted keyframe and hands its thumbnail out
+static void receive_thumbnail(ff_thumbnailer_t* thumbnailer, const int index, const ff_thumbnail_callback callback, void* opaque) {
+    int ret;
+    do {
+        ret = ff_decoder_pool_receive(thumbnailer->pool, thumbnailer->frame, true);
+    } while (ret == AVERROR(EAGAIN));
+    if (ret >= 0) {
+        ret = scale_thumbnail(thumbnailer);
+    }
+    callback(opaque, index, ret >= 0 ? thumbnailer->thumbnail : NULL, ret);
+    av_frame_unref(thumbnailer->thumbnail);
+    av_frame_unref(thumbnailer->frame);
+}
+
+int ff_thumbnailer_extract(
+    ff_thumbnailer_t* thumbnailer,
+    const int64_t* timestamps,
+    const int count,
+    const ff_thumbnail_callback callback,
+    void* opaque
+) {
+    if (count < 0) {
+        return AVERROR(EINVAL);
+    }
+    // the pool returns frames in submission order
+    int* submitted = (int*)malloc((size_t)FFMAX(count, 1) * sizeof(int));
+    if (submitted == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    int nb_submitted = 0;
+    int nb_received = 0;
+    for (int i = 0; i < count; ++i) {
+        while (!ff_decoder_pool_can_submit(thumbnailer->pool)) {
+            receive_thumbnail(thumbnailer, submitted[nb_received++], callback, opaque);
+        }
+        const int ret = read_keyframe(thumbnailer, timestamps[i]);
+        if (ret < 0) {
+            callback(opaque, i, NULL, ret);
+            continue;
+        }
+        submitted[nb_submitted++] = i;
+        ff_decoder_pool_submit(thumbnailer->pool, thumbnailer->packet, true);
+    }
+    while (nb_received < nb_submitted) {
+        receive_thumbnail(thumbnailer, submitted[nb_received++], callback, opaque);
+    }
+    free(submitted);
+    return 0;
+}
@@ -0,0 +1,236 @@
+// 64-bit fseeko offsets for windows beyond 2 GiB on 32-bit targets
+#define _FILE_OFFSET_BITS 64
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "ff_timeshift.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+
+enum {
+    // keeps a multi-hour window at two seek points per second
+    TIMESHIFT_INDEX_CAPACITY = 1 << 16,
+};
+
+#define TIMESHIFT_INDEX_INTERVAL (AV_TIME_BASE / 2)
+
+#ifdef _WIN32
+#define timeshift_fseek _fseeki64
+#else
+#define timeshift_fseek fseeko
+#endif
+
+typedef struct record_header {
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    int64_t pos;
+    int32_t stream_index;
+    int32_t flags;
+    // -1 marks the unused end of the file before wrapping
+    int32_t size;
+    int32_t reserved;
+} record_header_t;
+
+typedef struct index_entry {
+    int64_t offset;
+    int64_t time;
+} index_entry_t;
+
+// offsets grow monotonically, the file position is offset % size; data
+// older than write_offset - size has been overwritten
+struct ff_timeshift {
+    FILE* file;
+    int64_t size;
+
+    index_entry_t* index;
+    int index_first;
+    int index_count;
+
+    int64_t write_offset;
+    int64_t tail_offset;
+    int64_t read_offset;
+    bool overrun;
+
+    atomic_llong start_time;
+    atomic_llong end_time;
+};
+
+static index_entry_t* index_at(const ff_timeshift_t* timeshift, const int i) {
+    return &timeshift->index[(timeshift->index_first + i) % TIMESHIFT_INDEX_CAPACITY];
+}
+
+static void index_pop(ff_timeshift_t* timeshift) {
+    timeshift->index_first = (timeshift->index_first + 1) % TIMESHIFT_INDEX_CAPACITY;
+    --timeshift->index_count;
+}
+
+static void update_tail(ff_timeshift_t* timeshift, const int64_t min_offset) {
+    while (timeshift->index_count > 0 && index_at(timeshift, 0)->offset < min_offset) {
+        index_pop(timeshift);
+    }
+    // without a seek point left nothing before the write position can be parsed
+    const int64_t tail = timeshift->index_count > 0 ? index_at(timeshift, 0)->offset : timeshift->write_offset;
+    if (tail > timeshift->tail_offset) {
+        timeshift->tail_offset = tail;
+    }
+    if (timeshift->read_offset < timeshift->tail_offset) {
+        timeshift->read_offset = timeshift->tail_offset;
+        timeshift->overrun = true;
+    }
+    atomic_store(&timeshift->start_time, timeshift->index_count > 0 ? index_at(timeshift, 0)->time : AV_NOPTS_VALUE);
+}
+
+static int file_access(ff_timeshift_t* timeshift, const int64_t offset, void* data, const size_t size, const bool write) {
+    if (timeshift_fseek(timeshift->file, offset % timeshift->size, SEEK_SET) != 0) {
+        return AVERROR(errno);
+    }
+    const size_t done = write ? fwrite(data, 1, size, timeshift->file) : fread(data, 1, size, timeshift->file);
+    return done == size ? 0 : AVERROR(EIO);
+}
+
+ff_timeshift_t* ff_timeshift_create(const char* path, const int64_t size) {
+    ff_timeshift_t* timeshift = (ff_timeshift_t*)calloc(1, sizeof(ff_timeshift_t));
+    if (timeshift != NULL) {
+        timeshift->index = (index_entry_t*)calloc(TIMESHIFT_INDEX_CAPACITY, sizeof(index_entry_t));
+        if (timeshift->index != NULL) {
+            timeshift->file = path != NULL ? fopen(path, "w+b") : tmpfile();
+            if (timeshift->file != NULL) {
+                timeshift->size = size;
+                atomic_init(&timeshift->start_time, AV_NOPTS_VALUE);
+                atomic_init(&timeshift->end_time, AV_NOPTS_VALUE);
+                return timeshift;
+            }
+            free(timeshift->index);
+        }
+        free(timeshift);
+    }
+    return NULL;
+}
+
+void ff_timeshift_destroy(ff_timeshift_t* timeshift) {
+    fclose(timeshift->file);
+    free(timeshift->index);
+    free(timeshift);
+}
+
+int ff_timeshift_write(ff_timeshift_t* timeshift, const AVPacket* packet, const int64_t time, const bool sync) {
+    const int64_t record_size = (int64_t)sizeof(record_header_t) + packet->size;
+    if (record_size > timeshift->size / 2) {
+        return AVERROR(ENOSPC);
+    }
+    const int64_t room = timeshift->size - timeshift->write_offset % timeshift->size;
+    if (room < record_size) {
+        update_tail(timeshift, timeshift->write_offset + room + record_size - timeshift->size);
+        if (room >= (int64_t)sizeof(record_header_t)) {
+            record_header_t marker = { .size = -1 };
+            const int ret = file_access(timeshift, timeshift->write_offset, &marker, sizeof(marker), true);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        timeshift->write_offset += room;
+    } else {
+        update_tail(timeshift, timeshift->write_offset + record_size - timeshift->size);
+    }
+
+    record_header_t header = {
+        .pts = packet->pts,
+        .dts = packet->dts,
+        .duration = packet->duration,
+        .pos = packet->pos,
+        .stream_index = packet->stream_index,
+        .flags = packet->flags,
+        .size = packet->size,
+    };
+    int ret = file_access(timeshift, timeshift->write_offset, &header, sizeof(header), true);
+    if (ret >= 0 && packet->size > 0) {
+        ret = file_access(timeshift, timeshift->write_offset + (int64_t)sizeof(header), packet->data, (size_t)packet->size, true);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    if (time != AV_NOPTS_VALUE) {
+        const index_entry_t* last = timeshift->index_count > 0 ? index_at(timeshift, timeshift->index_count - 1) : NULL;
+        if (sync && (last == NULL || time - last->time >= TIMESHIFT_INDEX_INTERVAL)) {
+            if (timeshift->index_count == TIMESHIFT_INDEX_CAPACITY) {
+                index_pop(timeshift);
+                update_tail(timeshift, 0);
+            }
+            *index_at(timeshift, timeshift->index_count++) = (index_entry_t){
+                .offset = timeshift->write_offset,
+                .time = time
+            };
+            if (timeshift->index_count == 1) {
+                atomic_store(&timeshift->start_time, time);
+            }
+        }
+        atomic_store(&timeshift->end_time, time);
+    }
+    timeshift->write_offset += record_size;
+    return 0;
+}
+
+int ff_timeshift_read(ff_timeshift_t* timeshift, AVPacket* packet, bool* discontinuity) {
+    *discontinuity = timeshift->overrun;
+    timeshift->overrun = false;
+    while (timeshift->read_offset < timeshift->write_offset) {
+        const int64_t room = timeshift->size - timeshift->read_offset % timeshift->size;
+        record_header_t header = { .size = -1 };
+        if (room >= (int64_t)sizeof(record_header_t)) {
+            const int ret = file_access(timeshift, timeshift->read_offset, &header, sizeof(header), false);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        if (header.size < 0) {
+            timeshift->read_offset += room;
+            continue;
+        }
+        int ret = av_new_packet(packet, header.size);
+        if (ret < 0) {
+            return ret;
+        }
+        if (header.size > 0) {
+            ret = file_access(timeshift, timeshift->read_offset + (int64_t)sizeof(header), packet->data, (size_t)header.size, false);
+            if (ret < 0) {
+                av_packet_unref(packet);
+                return ret;
+            }
+        }
+        packet->pts = header.pts;
+        packet->dts = header.dts;
+        packet->duration = header.duration;
+        packet->pos = header.pos;
+        packet->stream_index = header.stream_index;
+        packet->flags = header.flags;
+        timeshift->read_offset += (int64_t)sizeof(header) + header.size;
+        return 0;
+    }
+    return AVERROR(EAGAIN);
+}
+
+int ff_timeshift_seek(ff_timeshift_t* timeshift, const int64_t time) {
+    if (timeshift->index_count == 0) {
+        return AVERROR(EAGAIN);
+    }
+    int i = timeshift->index_count - 1;
+    while (i > 0 && index_at(timeshift, i)->time > time) {
+        --i;
+    }
+    timeshift->read_offset = index_at(timeshift, i)->offset;
+    timeshift->overrun = false;
+    return 0;
+}
+
+void ff_timeshift_get_window(const ff_timeshift_t* timeshift, int64_t* start, int64_t* end) {
+    *start = atomic_load(&timeshift->start_time);
+    *end = atomic_load(&timeshift->end_time);
+}
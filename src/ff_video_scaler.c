@@ -0,0 +1,338 @@
+#include "ff_video_scaler.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libavutil/log.h>
+#include <libavutil/macros.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#ifdef HAVE_THREAD_H
+#include "thread.h"
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+enum {
+    VIDEO_SCALER_MAX_SLICES = 16,
+    VIDEO_SCALER_MIN_SLICE_HEIGHT = 64,
+    VIDEO_SCALER_CACHE_SIZE = 4,
+};
+
+typedef struct video_scaler_slice {
+    struct SwsContext* context;
+    int y;
+    int height;
+} video_scaler_slice_t;
+
+typedef struct video_scaler_config {
+    video_scaler_slice_t slices[VIDEO_SCALER_MAX_SLICES];
+    int nb_slices;
+
+    int width;
+    int height;
+    enum AVPixelFormat src_format;
+    enum AVPixelFormat dst_format;
+    enum AVColorSpace color_space;
+    enum AVColorRange color_range;
+} video_scaler_config_t;
+
+struct ff_video_scaler {
+    AVDictionary* sws_opts;
+
+    video_scaler_config_t* configs[VIDEO_SCALER_CACHE_SIZE];
+    int nb_configs;
+
+    thrd_t* threads;
+    int nb_threads;
+    int nb_slices;
+
+    mtx_t mutex;
+    cnd_t cond;
+    cnd_t done_cond;
+    const video_scaler_config_t* job_config;
+    const AVFrame* job_src;
+    AVFrame* job_dst;
+    int next_slice;
+    int slices_done;
+    int job_ret;
+    bool exit;
+};
+
+static void video_scaler_config_free(video_scaler_config_t* config) {
+    for (int i = 0; i < config->nb_slices; ++i) {
+        sws_freeContext(config->slices[i].context);
+    }
+    free(config);
+}
+
+static struct SwsContext* video_scaler_context_create(
+    const ff_video_scaler_t* scaler,
+    const AVFrame* src,
+    const int height,
+    const enum AVPixelFormat dst_format,
+    int* ret_ptr
+) {
+    struct SwsContext* context = sws_alloc_context();
+    if (context == NULL) {
+        *ret_ptr = AVERROR(ENOMEM);
+        return NULL;
+    }
+    AVDictionary* opts = NULL;
+    int ret = av_dict_copy(&opts, scaler->sws_opts, 0);
+    if (ret >= 0) {
+        ret = av_opt_set_dict(context, &opts);
+        av_dict_free(&opts);
+    }
+    if (ret >= 0 &&
+        (ret = av_opt_set_int(context, "srcw", src->width, 0)) >= 0 &&
+        (ret = av_opt_set_int(context, "srch", height, 0)) >= 0 &&
+        (ret = av_opt_set_int(context, "src_format", src->format, 0)) >= 0 &&
+        (ret = av_opt_set_int(context, "dstw", src->width, 0)) >= 0 &&
+        (ret = av_opt_set_int(context, "dsth", height, 0)) >= 0 &&
+        (ret = av_opt_set_int(context, "dst_format", dst_format, 0)) >= 0 &&
+        (ret = sws_init_context(context, NULL, NULL)) >= 0) {
+        const int* coefficients = sws_getCoefficients(src->colorspace);
+        const int full_range = src->color_range == AVCOL_RANGE_JPEG;
+        sws_setColorspaceDetails(context, coefficients, full_range, coefficients, full_range, 0, 1 << 16, 1 << 16);
+
+        return context;
+    }
+    sws_freeContext(context);
+    *ret_ptr = ret < 0 ? ret : AVERROR(EINVAL);
+
+    return NULL;
+}
+
+static int get_slice_alignment(const enum AVPixelFormat format) {
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(format);
+    return descriptor != NULL ? 1 << descriptor->log2_chroma_h : 1;
+}
+
+static video_scaler_config_t* video_scaler_config_create(
+    const ff_video_scaler_t* scaler,
+    const AVFrame* src,
+    const enum AVPixelFormat dst_format,
+    int* ret_ptr
+) {
+    video_scaler_config_t* config = (video_scaler_config_t*)calloc(1, sizeof(video_scaler_config_t));
+    if (config == NULL) {
+        *ret_ptr = AVERROR(ENOMEM);
+        return NULL;
+    }
+    const int alignment = FFMAX(get_slice_alignment(src->format), get_slice_alignment(dst_format));
+    const int nb_slices = av_clip(src->height / VIDEO_SCALER_MIN_SLICE_HEIGHT, 1, scaler->nb_slices);
+    const int slice_height = FFALIGN((src->height + nb_slices - 1) / nb_slices, alignment);
+
+    for (int y = 0; y < src->height; y += slice_height) {
+        video_scaler_slice_t* slice = &config->slices[config->nb_slices];
+        slice->y = y;
+        slice->height = FFMIN(slice_height, src->height - y);
+        slice->context = video_scaler_context_create(scaler, src, slice->height, dst_format, ret_ptr);
+        if (slice->context == NULL) {
+            video_scaler_config_free(config);
+            av_log(NULL, AV_LOG_ERROR, "Cannot initialize the conversion context from %s to %s\n",
+                   av_get_pix_fmt_name(src->format), av_get_pix_fmt_name(dst_format));
+            return NULL;
+        }
+        ++config->nb_slices;
+    }
+    config->width = src->width;
+    config->height = src->height;
+    config->src_format = src->format;
+    config->dst_format = dst_format;
+    config->color_space = src->colorspace;
+    config->color_range = src->color_range;
+
+    return config;
+}
+
+static const video_scaler_config_t* video_scaler_setup(ff_video_scaler_t* scaler, const AVFrame* src, const enum AVPixelFormat dst_format, int* ret_ptr) {
+    for (int i = 0; i < scaler->nb_configs; ++i) {
+        video_scaler_config_t* config = scaler->configs[i];
+        if (config->width == src->width &&
+            config->height == src->height &&
+            config->src_format == src->format &&
+            config->dst_format == dst_format &&
+            config->color_space == src->colorspace &&
+            config->color_range == src->color_range) {
+            for (; i > 0; --i) {
+                scaler->configs[i] = scaler->configs[i - 1];
+            }
+            scaler->configs[0] = config;
+            return config;
+        }
+    }
+    video_scaler_config_t* config = video_scaler_config_create(scaler, src, dst_format, ret_ptr);
+    if (config == NULL) {
+        return NULL;
+    }
+    if (scaler->nb_configs == VIDEO_SCALER_CACHE_SIZE) {
+        video_scaler_config_free(scaler->configs[--scaler->nb_configs]);
+    }
+    for (int i = scaler->nb_configs; i > 0; --i) {
+        scaler->configs[i] = scaler->configs[i - 1];
+    }
+    scaler->configs[0] = config;
+    ++scaler->nb_configs;
+
+    return config;
+}
+
+static int get_plane_shift(const AVPixFmtDescriptor* descriptor, const int plane) {
+    return (plane == 1 || plane == 2) ? descriptor->log2_chroma_h : 0;
+}
+
+static int video_scaler_convert_slice(const video_scaler_slice_t* slice, const AVFrame* src, AVFrame* dst) {
+    const AVPixFmtDescriptor* src_descriptor = av_pix_fmt_desc_get(src->format);
+    const AVPixFmtDescriptor* dst_descriptor = av_pix_fmt_desc_get(dst->format);
+    const uint8_t* src_data[4] = {0};
+    uint8_t* dst_data[4] = {0};
+    for (int i = 0; i < 4; ++i) {
+        if (src->data[i] != NULL) {
+            src_data[i] = src->data[i];
+            if (i == 0 || !(src_descriptor->flags & AV_PIX_FMT_FLAG_PAL)) {
+                src_data[i] += (ptrdiff_t)(slice->y >> get_plane_shift(src_descriptor, i)) * src->linesize[i];
+            }
+        }
+        if (dst->data[i] != NULL) {
+            dst_data[i] = dst->data[i];
+            if (i == 0 || !(dst_descriptor->flags & AV_PIX_FMT_FLAG_PAL)) {
+                dst_data[i] += (ptrdiff_t)(slice->y >> get_plane_shift(dst_descriptor, i)) * dst->linesize[i];
+            }
+        }
+    }
+    return sws_scale(slice->context, src_data, src->linesize, 0, slice->height, dst_data, dst->linesize);
+}
+
+static void video_scaler_run_slices(ff_video_scaler_t* scaler) {
+    for (;;) {
+        if (scaler->job_config == NULL || scaler->next_slice >= scaler->job_config->nb_slices) {
+            return;
+        }
+        const video_scaler_slice_t* slice = &scaler->job_config->slices[scaler->next_slice++];
+        mtx_unlock(&scaler->mutex);
+
+        const int ret = video_scaler_convert_slice(slice, scaler->job_src, scaler->job_dst);
+
+        mtx_lock(&scaler->mutex);
+        if (ret < 0) {
+            scaler->job_ret = ret;
+        }
+        if (++scaler->slices_done == scaler->job_config->nb_slices) {
+            cnd_signal(&scaler->done_cond);
+        }
+    }
+}
+
+static int video_scaler_thread(void* arg) {
+    ff_video_scaler_t* scaler = arg;
+
+    mtx_lock(&scaler->mutex);
+    while (!scaler->exit) {
+        video_scaler_run_slices(scaler);
+        cnd_wait(&scaler->cond, &scaler->mutex);
+    }
+    mtx_unlock(&scaler->mutex);
+
+    return 0;
+}
+
+static void video_scaler_stop_threads(ff_video_scaler_t* scaler) {
+    mtx_lock(&scaler->mutex);
+    scaler->exit = true;
+    cnd_broadcast(&scaler->cond);
+    mtx_unlock(&scaler->mutex);
+
+    for (int i = 0; i < scaler->nb_threads; ++i) {
+        thrd_join(scaler->threads[i], NULL);
+    }
+    free(scaler->threads);
+}
+
+ff_video_scaler_t* ff_video_scaler_create(const AVDictionary* sws_opts, const int nb_threads) {
+    ff_video_scaler_t* scaler = (ff_video_scaler_t*)calloc(1, sizeof(ff_video_scaler_t));
+    if (scaler != NULL) {
+        if (av_dict_copy(&scaler->sws_opts, sws_opts, 0) >= 0) {
+            if (mtx_init(&scaler->mutex, mtx_plain) == thrd_success) {
+                if (cnd_init(&scaler->cond) == thrd_success) {
+                    if (cnd_init(&scaler->done_cond) == thrd_success) {
+                        scaler->nb_slices = av_clip(nb_threads, 1, VIDEO_SCALER_MAX_SLICES);
+                        scaler->threads = (thrd_t*)calloc((size_t)scaler->nb_slices, sizeof(thrd_t));
+                        if (scaler->threads != NULL) {
+                            for (;;) {
+                                if (scaler->nb_threads == scaler->nb_slices - 1) {
+                                    return scaler;
+                                }
+                                if (thrd_create(&scaler->threads[scaler->nb_threads], video_scaler_thread, scaler) != thrd_success) {
+                                    break;
+                                }
+                                ++scaler->nb_threads;
+                            }
+                            video_scaler_stop_threads(scaler);
+                        }
+                        cnd_destroy(&scaler->done_cond);
+                    }
+                    cnd_destroy(&scaler->cond);
+                }
+                mtx_destroy(&scaler->mutex);
+            }
+        }
+        av_dict_free(&scaler->sws_opts);
+        free(scaler);
+    }
+    return NULL;
+}
+
+void ff_video_scaler_destroy(ff_video_scaler_t* scaler) {
+    video_scaler_stop_threads(scaler);
+    for (int i = 0; i < scaler->nb_configs; ++i) {
+        video_scaler_config_free(scaler->configs[i]);
+    }
+    cnd_destroy(&scaler->done_cond);
+    cnd_destroy(&scaler->cond);
+    mtx_destroy(&scaler->mutex);
+    av_dict_free(&scaler->sws_opts);
+    free(scaler);
+}
+
+int ff_video_scaler_convert(ff_video_scaler_t* scaler, AVFrame* dst, const AVFrame* src, const enum AVPixelFormat dst_format) {
+    int ret = 0;
+    const video_scaler_config_t* config = video_scaler_setup(scaler, src, dst_format, &ret);
+    if (config == NULL) {
+        return ret;
+    }
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->format = dst_format;
+    ret = av_frame_get_buffer(dst, 0);
+    if (ret >= 0) {
+        ret = av_frame_copy_props(dst, src);
+        if (ret >= 0) {
+            mtx_lock(&scaler->mutex);
+            scaler->job_config = config;
+            scaler->job_src = src;
+            scaler->job_dst = dst;
+            scaler->next_slice = 0;
+            scaler->slices_done = 0;
+            scaler->job_ret = 0;
+            if (config->nb_slices > 1) {
+                cnd_broadcast(&scaler->cond);
+            }
+            video_scaler_run_slices(scaler);
+            while (scaler->slices_done < config->nb_slices) {
+                cnd_wait(&scaler->done_cond, &scaler->mutex);
+            }
+            scaler->job_config = NULL;
+            ret = scaler->job_ret;
+            mtx_unlock(&scaler->mutex);
+            if (ret >= 0) {
+                return 0;
+            }
+        }
+        av_frame_unref(dst);
+    }
+    return ret;
+}